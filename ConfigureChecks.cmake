@@ -64,10 +64,13 @@ check_include_file(stdlib.h HAVE_STDLIB_H)
 check_include_file(string.h HAVE_STRING_H)
 check_include_file(strings.h HAVE_STRINGS_H)
 check_include_file(sys/stat.h HAVE_SYS_STAT_H)
+check_include_file(sys/mman.h HAVE_SYS_MMAN_H)
 check_include_file(sys/types.h HAVE_SYS_TYPES_H)
 check_include_file(time.h HAVE_TIME_H)
 check_include_file(unistd.h HAVE_UNISTD_H)
 check_include_file(stdatomic.h HAVE_STDATOMIC_H)
+check_include_file(linux/can/j1939.h HAVE_LINUX_CAN_J1939_H)
+check_include_file(linux/io_uring.h HAVE_LINUX_IO_URING_H)
 
 if (HAVE_TIME_H)
     check_struct_has_member("struct timespec" tv_sec "time.h" HAVE_STRUCT_TIMESPEC)
@@ -0,0 +1,55 @@
+#
+# Static ROM (text + data) and RAM (data + bss) usage of every module of
+# the library, from the output of the binutils size tool.
+#
+#   cmake -DSIZE=<size tool> -DLIB=<libj1939.a> -P J1939Size.cmake
+#
+# Initialized data is counted twice: its initial value is in ROM, the
+# variable in RAM.
+#
+if(NOT SIZE OR NOT LIB)
+    message(FATAL_ERROR "usage: cmake -DSIZE=<size> -DLIB=<lib> -P J1939Size.cmake")
+endif()
+
+execute_process(
+    COMMAND ${SIZE} ${LIB}
+    OUTPUT_VARIABLE _out
+    RESULT_VARIABLE _res
+)
+if(NOT _res EQUAL 0)
+    message(FATAL_ERROR "${SIZE} ${LIB} failed")
+endif()
+
+string(REPLACE "\n" ";" _lines "${_out}")
+
+set(_rom_total 0)
+set(_ram_total 0)
+set(_report "")
+
+foreach(_line IN LISTS _lines)
+    # text data bss dec hex filename (ex archive)
+    if(_line MATCHES "^[ \t]*([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)[ \t]+[0-9]+[ \t]+[0-9a-fA-F]+[ \t]+([^ \t]+)")
+        set(_text ${CMAKE_MATCH_1})
+        set(_data ${CMAKE_MATCH_2})
+        set(_bss ${CMAKE_MATCH_3})
+        get_filename_component(_module ${CMAKE_MATCH_4} NAME)
+        string(REGEX REPLACE "\\.(c\\.)?o(bj)?$" "" _module ${_module})
+
+        math(EXPR _rom "${_text} + ${_data}")
+        math(EXPR _ram "${_data} + ${_bss}")
+        math(EXPR _rom_total "${_rom_total} + ${_rom}")
+        math(EXPR _ram_total "${_ram_total} + ${_ram}")
+
+        string(LENGTH "${_module}" _len)
+        math(EXPR _pad "20 - ${_len}")
+        if(_pad LESS 1)
+            set(_pad 1)
+        endif()
+        string(SUBSTRING "                    " 0 ${_pad} _sp)
+        string(APPEND _report "${_module}${_sp}${_rom}\t${_ram}\n")
+    endif()
+endforeach()
+
+message("module              ROM\tRAM [bytes]\n"
+        "${_report}"
+        "total               ${_rom_total}\t${_ram_total}")
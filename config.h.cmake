@@ -54,6 +54,9 @@
 /* Define to 1 if you have the <sys/stat.h> header file. */
 #cmakedefine HAVE_SYS_STAT_H 1
 
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#cmakedefine HAVE_SYS_MMAN_H 1
+
 /* Define to 1 if you have the <sys/types.h> header file. */
 #cmakedefine HAVE_SYS_TYPES_H 1
 
@@ -66,6 +69,12 @@
 /* Define to 1 if you have the <stdatomic.h> header file. */
 #cmakedefine HAVE_STDATOMIC_H 1
 
+/* Define to 1 if you have the <linux/can/j1939.h> header file. */
+#cmakedefine HAVE_LINUX_CAN_J1939_H 1
+
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#cmakedefine HAVE_LINUX_IO_URING_H 1
+
 
 /**************************** STRUCTS ****************************/
 
@@ -154,7 +163,51 @@
    significant byte first (like Motorola and SPARC, unlike Intel). */
 #cmakedefine WORDS_BIGENDIAN 1
 
+/* Minimal footprint profile (see LIBJ1939_COMPACT) */
+#cmakedefine J1939_COMPACT 1
+
+/* Optional modules used by the core and the ports */
+#cmakedefine J1939_WITH_STORE 1
+#cmakedefine J1939_WITH_ISOTP 1
+#cmakedefine J1939_WITH_BUSLOAD 1
+#cmakedefine J1939_WITH_TXQ 1
+#cmakedefine J1939_WITH_ADDR 1
+
 #cmakedefine PGN_POOL_SIZE ${PGN_POOL_SIZE}
 
+/* Max number of mask based PGN subscriptions */
+#cmakedefine PGN_SUBSCRIPTIONS ${PGN_SUBSCRIPTIONS}
+
+/* Max number of PGN/source pairs cached for change-only PGNs */
+#cmakedefine PGN_VALUE_CACHE_SIZE ${PGN_VALUE_CACHE_SIZE}
+
+/* Max number of PGNs dispatched on a multiplexer byte (TP_CM included) */
+#cmakedefine PGN_MUXES ${PGN_MUXES}
+
+/* Max number of distinct callbacks registered with pgn_register() (compact) */
+#cmakedefine PGN_CALLBACKS ${PGN_CALLBACKS}
+
+/* Max number of PGN/source pairs in the latest value store */
+#cmakedefine J1939_STORE_SIZE ${J1939_STORE_SIZE}
+
+/* DM1/DM2: max number of sources and of DTCs per source */
+#cmakedefine J1939_DM_SOURCES ${J1939_DM_SOURCES}
+#cmakedefine J1939_DM_DTCS ${J1939_DM_DTCS}
+
+/* Max number of NMEA 2000 Fast Packet messages reassembled at the same time */
+#cmakedefine J1939_FP_SESSIONS ${J1939_FP_SESSIONS}
+
+/* Max number of ISO-TP messages received at the same time */
+#cmakedefine J1939_ISOTP_SESSIONS ${J1939_ISOTP_SESSIONS}
+
+/* Max number of gateway routes */
+#cmakedefine J1939_GW_ROUTES ${J1939_GW_ROUTES}
+
+/* Max number of PGN/source pairs tracked by the bus load monitor */
+#cmakedefine J1939_BUSLOAD_ENTRIES ${J1939_BUSLOAD_ENTRIES}
+
+/* Frames queued by the CAN RX interrupt, a power of two */
+#cmakedefine J1939_RXQ_SIZE ${J1939_RXQ_SIZE}
+
 /* Max number of active session (i.e different source address) */
 #cmakedefine MAX_J1939_SESSIONS ${MAX_J1939_SESSIONS}
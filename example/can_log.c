@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "can_log.h"
+
+static int parse_hex_bytes(const char *hex, uint8_t *data)
+{
+	int len = 0;
+
+	while (len < 8 && hex[0] && hex[1]) {
+		char byte[3] = { hex[0], hex[1], '\0' };
+		data[len++] = strtoul(byte, NULL, 16);
+		hex += 2;
+	}
+	return len;
+}
+
+int can_log_parse_candump(const char *line, struct j1939_log_frame *f)
+{
+	char ifname[32];
+	char frame[64];
+	unsigned long sec, usec;
+	char *hex;
+
+	if (sscanf(line, "(%lu.%lu) %31s %63s", &sec, &usec, ifname,
+		   frame) != 4) {
+		return -1;
+	}
+
+	hex = strchr(frame, '#');
+	if (hex == NULL || hex - frame != 8) {
+		/* not an extended frame */
+		return -1;
+	}
+	*hex++ = '\0';
+
+	f->time = (uint64_t)sec * 1000000u + usec;
+	f->id = strtoul(frame, NULL, 16) & 0x1FFFFFFFu;
+	f->flags = 0;
+	f->len = parse_hex_bytes(hex, f->data);
+	return 0;
+}
+
+int can_log_parse_asc(const char *line, struct j1939_log_frame *f)
+{
+	char id[16];
+	char dir[4];
+	char type;
+	double t;
+	unsigned int channel, dlc;
+	int pos, n;
+	size_t id_len;
+
+	if (sscanf(line, " %lf %u %15s %3s %c %u%n", &t, &channel, id, dir,
+		   &type, &dlc, &pos) != 6) {
+		return -1;
+	}
+
+	id_len = strlen(id);
+	if (type != 'd' || dlc > 8 || id_len < 2 || id[id_len - 1] != 'x') {
+		return -1;
+	}
+	id[id_len - 1] = '\0';
+
+	f->time = (uint64_t)(t * 1000000.0 + 0.5);
+	f->id = strtoul(id, NULL, 16) & 0x1FFFFFFFu;
+	f->flags = strcmp(dir, "Tx") == 0 ? J1939_LOG_FLAG_TX : 0;
+	f->len = dlc;
+
+	line += pos;
+	for (unsigned int i = 0; i < dlc; i++) {
+		unsigned int byte;
+		if (sscanf(line, " %2x%n", &byte, &n) != 1) {
+			return -1;
+		}
+		f->data[i] = byte;
+		line += n;
+	}
+	return 0;
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __CAN_LOG_H__
+#define __CAN_LOG_H__
+
+#include <stdint.h>
+#include "j1939_log.h"
+
+/**
+ * @brief Parse a candump log line
+ *
+ * (1600000000.123456) can0 18FEF680#0102030405060708
+ *
+ * @return 0 on success, -1 if the line is not an extended data frame
+ */
+int can_log_parse_candump(const char *line, struct j1939_log_frame *f);
+
+/**
+ * @brief Parse a Vector ASC log line
+ *
+ *    1.234567 1  18FEF680x       Rx   d 8 01 02 03 04 05 06 07 08
+ *
+ * @return 0 on success, -1 if the line is not an extended data frame
+ */
+int can_log_parse_asc(const char *line, struct j1939_log_frame *f);
+
+#endif /* __CAN_LOG_H__ */
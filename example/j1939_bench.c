@@ -0,0 +1,259 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Compare the CAN_RAW (library TP) and CAN_J1939 (kernel TP) backends.
+ *
+ *   j1939_bench <ifname> [-n count] [-s size]
+ *   J1939_BACKEND=kernel j1939_bench <ifname> [-n count] [-s size]
+ *
+ * A child process echoes every message received with a single frame:
+ * the parent measures the time from the start of j1939_tp() to the echo
+ * and the CPU time used by both processes. Run it on a vcan interface.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "j1939.h"
+
+#define NODE 0x80u
+#define PEER 0x81u
+#define BENCH_PGN 0xEF00u
+/* Proprietary B: not handled by the library nor the kernel */
+#define ECHO_PGN 0xFF00u
+
+extern int pgn_pool_receive(void);
+extern int pgn_register(const uint32_t pgn, uint8_t code, pgn_callback_t cb);
+extern int connect_canbus(const char *can_ifname);
+extern int disconnect_canbus(void);
+
+static unsigned int count = 100;
+static unsigned int size = 8;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static unsigned int echoes;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000u;
+}
+
+static double cpu_ms(const struct rusage *ru)
+{
+	return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1e3 +
+	       (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1e3;
+}
+
+/* Peer: echo every complete message */
+
+static unsigned int peer_bytes;
+static unsigned int peer_msgs;
+
+static void echo(void)
+{
+	uint8_t data[8] = { 0 };
+
+	peer_msgs++;
+	j1939_send(BENCH_PGN, J1939_PRIORITY_DEFAULT, PEER, NODE, data,
+		   sizeof(data));
+}
+
+static int peer_single(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		       uint8_t dest, uint8_t *data, uint8_t len)
+{
+	if (dest == PEER) {
+		echo();
+	}
+	return 0;
+}
+
+static int peer_tp(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		   uint8_t dest, uint8_t *data, uint8_t len)
+{
+	peer_bytes += len - 1;
+	if (peer_bytes >= size) {
+		peer_bytes = 0;
+		echo();
+	}
+	return 0;
+}
+
+static int peer(const char *ifname)
+{
+	uint8_t ready[8] = { 0xFF };
+
+	if (connect_canbus(ifname) < 0) {
+		perror(ifname);
+		return 1;
+	}
+	if (j1939_setup(peer_tp, NULL) < 0 ||
+	    pgn_register(BENCH_PGN, 0, peer_single) < 0) {
+		fprintf(stderr, "peer setup failed\n");
+		return 1;
+	}
+
+	/* binds PEER with the kernel backend and starts the parent */
+	j1939_send(ECHO_PGN, J1939_PRIORITY_DEFAULT, PEER, NODE, ready,
+		   sizeof(ready));
+
+	while (peer_msgs < count) {
+		if (pgn_pool_receive() < 0) {
+			break;
+		}
+	}
+
+	disconnect_canbus();
+	return 0;
+}
+
+/* Node: send and wait for the echo */
+
+static int node_echo(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		     uint8_t dest, uint8_t *data, uint8_t len)
+{
+	if (src == PEER) {
+		pthread_mutex_lock(&lock);
+		echoes++;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+	return 0;
+}
+
+static void *node_rx(void *arg)
+{
+	for (;;) {
+		pgn_pool_receive();
+	}
+	return NULL;
+}
+
+static bool wait_echo(const unsigned int n)
+{
+	struct timespec ts;
+	bool ret = true;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 5;
+
+	pthread_mutex_lock(&lock);
+	while (echoes < n && ret) {
+		ret = pthread_cond_timedwait(&cond, &lock, &ts) != ETIMEDOUT;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	const char *backend = getenv("J1939_BACKEND");
+	struct rusage self, children;
+	uint64_t *lat, t0;
+	uint8_t *data;
+	pthread_t rx;
+	pid_t pid;
+	int opt, status;
+	unsigned int i;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (optind >= argc || count == 0 || size == 0 ||
+	    size > J1939_MAX_DATA_LEN) {
+		fprintf(stderr, "usage: %s <ifname> [-n count] [-s size]\n",
+			argv[0]);
+		return 1;
+	}
+
+	data = calloc(size, 1);
+	lat = calloc(count, sizeof(*lat));
+	if (data == NULL || lat == NULL) {
+		return 1;
+	}
+
+	if (connect_canbus(argv[optind]) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (j1939_setup(NULL, NULL) < 0 ||
+	    pgn_register(BENCH_PGN, 0, node_echo) < 0 ||
+	    pgn_register(ECHO_PGN, 0, node_echo) < 0) {
+		fprintf(stderr, "setup failed\n");
+		return 1;
+	}
+	pthread_create(&rx, NULL, node_rx, NULL);
+
+	pid = fork();
+	if (pid == 0) {
+		return peer(argv[optind]);
+	}
+
+	if (!wait_echo(1)) {
+		fprintf(stderr, "peer not responding\n");
+		kill(pid, SIGTERM);
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		t0 = now_us();
+		if (j1939_tp(BENCH_PGN, J1939_PRIORITY_DEFAULT, NODE, PEER,
+			     data, size) < 0 ||
+		    !wait_echo(i + 2)) {
+			fprintf(stderr, "message %u lost\n", i);
+			break;
+		}
+		lat[i] = now_us() - t0;
+	}
+
+	waitpid(pid, &status, 0);
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	if (i > 0) {
+		qsort(lat, i, sizeof(*lat), cmp_u64);
+		printf("%s backend, %u messages of %u bytes\n",
+		       backend ? backend : "raw", i, size);
+		printf("latency [us]: min %" PRIu64 " p50 %" PRIu64
+		       " p99 %" PRIu64 " max %" PRIu64 "\n",
+		       lat[0], lat[i / 2], lat[(i * 99) / 100], lat[i - 1]);
+		printf("cpu [ms]: sender %.1f, receiver %.1f, "
+		       "%.3f per message\n", cpu_ms(&self), cpu_ms(&children),
+		       (cpu_ms(&self) + cpu_ms(&children)) / i);
+	}
+
+	free(data);
+	free(lat);
+	disconnect_canbus();
+	return i == count ? 0 : 1;
+}
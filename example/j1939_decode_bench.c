@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Compare j1939_id2pgn() called once per identifier with
+ * j1939_id2pgn_batch().
+ *
+ *   j1939_decode_bench [-n count] [-r rounds]
+ *
+ * Both paths decode the same random identifiers, their results are
+ * checked to be identical before the timings are printed.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "j1939.h"
+
+struct fields {
+	j1939_pgn_t *pgn;
+	uint8_t *priority;
+	uint8_t *src;
+	uint8_t *dst;
+};
+
+static uint32_t count = 1u << 20;
+static unsigned int rounds = 16;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static bool fields_alloc(struct fields *f)
+{
+	f->pgn = malloc(count * sizeof(*f->pgn));
+	f->priority = malloc(count);
+	f->src = malloc(count);
+	f->dst = malloc(count);
+
+	if (!f->pgn || !f->priority || !f->src || !f->dst) {
+		return false;
+	}
+	/* fault the pages in, not to time them */
+	memset(f->pgn, 0, count * sizeof(*f->pgn));
+	memset(f->priority, 0, count);
+	memset(f->src, 0, count);
+	memset(f->dst, 0, count);
+	return true;
+}
+
+static void fields_free(struct fields *f)
+{
+	free(f->pgn);
+	free(f->priority);
+	free(f->src);
+	free(f->dst);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n count] [-r rounds]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fields one, batch;
+	uint64_t t_one = 0, t_batch = 0;
+	uint32_t *ids, seed = 0x1939u;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (count == 0 || rounds == 0) {
+		usage(argv[0]);
+	}
+
+	ids = malloc(count * sizeof(*ids));
+	if (!ids || !fields_alloc(&one) || !fields_alloc(&batch)) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	/* xorshift, so both PDU1 and PDU2 identifiers are mixed */
+	for (uint32_t i = 0; i < count; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		ids[i] = seed & 0x1FFFFFFFu;
+	}
+
+	for (unsigned int r = 0; r < rounds; r++) {
+		uint64_t t = now_ns();
+
+		for (uint32_t i = 0; i < count; i++) {
+			j1939_id2pgn(ids[i], &one.pgn[i], &one.priority[i],
+				     &one.src[i], &one.dst[i]);
+		}
+		t_one += now_ns() - t;
+
+		t = now_ns();
+		j1939_id2pgn_batch(ids, count, batch.pgn, batch.priority,
+				   batch.src, batch.dst);
+		t_batch += now_ns() - t;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (one.pgn[i] != batch.pgn[i] ||
+		    one.priority[i] != batch.priority[i] ||
+		    one.src[i] != batch.src[i] || one.dst[i] != batch.dst[i]) {
+			fprintf(stderr, "mismatch on id %08" PRIX32 "\n", ids[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("ids:         %" PRIu32 " x %u\n", count, rounds);
+	printf("j1939_id2pgn:       %.3f ns/id\n",
+	       (double)t_one / ((double)count * rounds));
+	printf("j1939_id2pgn_batch: %.3f ns/id\n",
+	       (double)t_batch / ((double)count * rounds));
+
+	fields_free(&one);
+	fields_free(&batch);
+	free(ids);
+	return EXIT_SUCCESS;
+}
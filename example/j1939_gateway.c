@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Bridge a CAN interface with one or more others:
+ *
+ *   j1939_gateway <ifname> <ifname> [<ifname> ...]
+ *
+ * All the frames of the first interface are forwarded to the others and
+ * the frames of the others to the first one. All the interfaces are
+ * serviced by a single thread through io_uring.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "j1939.h"
+#include "j1939_gw.h"
+#include "pgn_pool.h"
+
+extern int j1939_uring_open(const char *const *ifnames, const size_t num);
+extern int j1939_uring_poll(const uint32_t timeout);
+extern int j1939_uring_bus(void);
+extern int j1939_uring_send(uint8_t bus, uint32_t id, uint8_t *data,
+			    uint8_t len);
+extern uint32_t j1939_uring_tx_errors(const uint8_t bus);
+extern int j1939_uring_close(void);
+
+#define STATS_PERIOD 5000u /* [msec] */
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+	running = 0;
+}
+
+/* Frames dispatched by j1939_uring_poll() */
+static void rx_hook(uint32_t id, const uint8_t *data, uint8_t len)
+{
+	j1939_gw_forward(j1939_uring_bus(), id, (uint8_t *)data, len, 0);
+}
+
+static void print_stats(const size_t num_routes)
+{
+	struct j1939_gw_route_stats st;
+
+	for (size_t i = 0; i < num_routes; i++) {
+		j1939_gw_get_stats(i, &st);
+		fprintf(stderr, "route %zu: %u forwarded, %u dropped", i,
+			st.forwarded, st.dropped);
+		if (st.latency_samples) {
+			fprintf(stderr, ", latency %u/%llu/%u us", st.latency_min,
+				(unsigned long long)(st.latency_sum /
+						     st.latency_samples),
+				st.latency_max);
+		}
+		fputc('\n', stderr);
+	}
+	for (size_t i = 0; i < num_routes; i++) {
+		fprintf(stderr, "bus %zu: %u send errors\n", i,
+			j1939_uring_tx_errors(i));
+	}
+	fprintf(stderr, "unrouted: %u\n", j1939_gw_unrouted());
+}
+
+int main(int argc, char **argv)
+{
+	j1939_gw_send_t buses[J1939_GW_MAX_BUSES];
+	struct j1939_gw_route routes[J1939_GW_MAX_BUSES];
+	const size_t num = argc - 1;
+	uint32_t others, last;
+	int ret;
+
+	if (argc < 3 || num > J1939_GW_MAX_BUSES) {
+		fprintf(stderr, "usage: %s <ifname> <ifname> [<ifname> ...]\n",
+			argv[0]);
+		return 1;
+	}
+
+	/* bus 0 to all the others, the others to bus 0 */
+	others = (0xFFFFFFFFu >> (32u - num)) & ~0x1u;
+	for (size_t i = 0; i < num; i++) {
+		buses[i] = j1939_uring_send;
+		routes[i] = (struct j1939_gw_route){
+			.in_bus = i,
+			.out_buses = i ? 0x1u : others,
+			.new_src = J1939_GW_KEEP_ADDR,
+			.new_dst = J1939_GW_KEEP_ADDR,
+		};
+	}
+
+	if (j1939_uring_open((const char *const *)&argv[1], num) < 0) {
+		perror("j1939_uring_open");
+		return 1;
+	}
+
+	pgn_pool_init();
+	ret = j1939_gw_setup(buses, num, routes, num);
+	if (ret < 0) {
+		fprintf(stderr, "j1939_gw_setup: %d\n", ret);
+		return 1;
+	}
+	j1939_set_frame_hooks(rx_hook, NULL);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	last = j1939_get_time();
+	while (running) {
+		if (j1939_uring_poll(STATS_PERIOD) < 0) {
+			break;
+		}
+		if (j1939_get_time() - last >= STATS_PERIOD) {
+			last = j1939_get_time();
+			print_stats(num);
+		}
+	}
+
+	print_stats(num);
+	j1939_uring_close();
+	return 0;
+}
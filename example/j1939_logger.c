@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Record J1939 traffic into the binary log format and dump it back.
+ *
+ *   j1939_logger record <ifname> <file>
+ *   j1939_logger import <candump.log|file.asc> <file>
+ *   j1939_logger dump <file> [-s start_us] [-e end_us] [-p pgn]...
+ */
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "j1939.h"
+#include "j1939_log.h"
+#include "can_log.h"
+
+#define MAX_QUERY_PGNS 64
+
+extern int connect_canbus(const char *can_ifname);
+extern int disconnect_canbus(void);
+
+static volatile sig_atomic_t stop;
+static struct j1939_log_writer writer;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static int record(const char *ifname, const char *path)
+{
+	j1939_pgn_t pgn;
+	uint8_t priority, src, dst;
+	uint8_t data[8];
+	uint32_t len;
+	uint32_t last_flush;
+
+	if (connect_canbus(ifname) < 0) {
+		perror(ifname);
+		return 1;
+	}
+
+	if (j1939_log_open(&writer, path) < 0) {
+		perror(path);
+		disconnect_canbus();
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	j1939_log_attach(&writer);
+	last_flush = j1939_get_time();
+	while (!stop) {
+		if (j1939_receive(&pgn, &priority, &src, &dst, data, &len) < 0) {
+			break;
+		}
+		/* bound the frames lost on power failure */
+		if (j1939_get_time() - last_flush > 1000) {
+			j1939_log_flush(&writer);
+			last_flush = j1939_get_time();
+		}
+	}
+	j1939_log_attach(NULL);
+
+	disconnect_canbus();
+	return j1939_log_close(&writer) < 0;
+}
+
+static int import(const char *in, const char *path)
+{
+	char line[256];
+	struct j1939_log_frame frame;
+	unsigned long n = 0;
+	bool asc;
+	FILE *f;
+
+	f = fopen(in, "r");
+	if (f == NULL) {
+		perror(in);
+		return 1;
+	}
+
+	if (j1939_log_open(&writer, path) < 0) {
+		perror(path);
+		fclose(f);
+		return 1;
+	}
+
+	asc = strstr(in, ".asc") != NULL;
+	while (fgets(line, sizeof(line), f)) {
+		int ret = asc ? can_log_parse_asc(line, &frame) :
+				can_log_parse_candump(line, &frame);
+		if (ret < 0) {
+			continue;
+		}
+		j1939_log_append(&writer, frame.time, frame.id, frame.flags,
+				 frame.data, frame.len);
+		n++;
+	}
+	fclose(f);
+
+	printf("%lu frames imported\n", n);
+	return j1939_log_close(&writer) < 0;
+}
+
+static int dump(const char *path, int argc, char **argv)
+{
+	struct j1939_log_reader reader;
+	struct j1939_log_query query = { .t_end = UINT64_MAX };
+	struct j1939_log_frame f;
+	j1939_pgn_t pgns[MAX_QUERY_PGNS];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:e:p:")) != -1) {
+		switch (opt) {
+		case 's':
+			query.t_start = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			query.t_end = strtoull(optarg, NULL, 0);
+			break;
+		case 'p':
+			if (query.num_pgns < MAX_QUERY_PGNS) {
+				pgns[query.num_pgns++] =
+					strtoul(optarg, NULL, 0);
+			}
+			break;
+		default:
+			return 1;
+		}
+	}
+	query.pgns = pgns;
+
+	if (j1939_log_reader_open(&reader, path) < 0) {
+		perror(path);
+		return 1;
+	}
+
+	j1939_log_seek(&reader, &query);
+	while (j1939_log_next(&reader, &f)) {
+		printf("(%" PRIu64 ".%06" PRIu64 ") %s %08X#", f.time / 1000000u,
+		       f.time % 1000000u,
+		       (f.flags & J1939_LOG_FLAG_TX) ? "tx" : "rx", f.id);
+		for (uint8_t i = 0; i < f.len; i++) {
+			printf("%02X", f.data[i]);
+		}
+		printf("\n");
+	}
+
+	j1939_log_reader_close(&reader);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s record <ifname> <file>\n"
+		"       %s import <candump.log|file.asc> <file>\n"
+		"       %s dump <file> [-s start_us] [-e end_us] [-p pgn]...\n",
+		prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 4 && strcmp(argv[1], "record") == 0) {
+		return record(argv[2], argv[3]);
+	}
+	if (argc >= 4 && strcmp(argv[1], "import") == 0) {
+		return import(argv[2], argv[3]);
+	}
+	if (argc >= 3 && strcmp(argv[1], "dump") == 0) {
+		return dump(argv[2], argc - 2, argv + 2);
+	}
+
+	usage(argv[0]);
+	return 1;
+}
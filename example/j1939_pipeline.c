@@ -0,0 +1,454 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Decode a binary log on all the CPU cores.
+ *
+ *   j1939_pipeline [-j threads] [-q] <file.bin>
+ *
+ * The log is split into chunks of whole blocks. A first pass, looking only
+ * at TP.CM/TP.DT identifiers, marks the block boundaries where no transport
+ * session is open: chunks start only there, so every chunk can be decoded
+ * from scratch with its own PGN pool and session table (the library is
+ * built with J1939_THREAD_LOCAL_STATE).
+ *
+ * Chunks are spread over per-thread deques: workers take their own chunks
+ * oldest first and steal the newest ones from the others when idle. The
+ * output of every chunk is buffered and written in chunk order, that is in
+ * timestamp order.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "j1939.h"
+#include "j1939_log.h"
+#include "pgn.h"
+
+#define MAX_THREADS 64
+#define CHUNKS_PER_THREAD 8
+#define SESSION_KEYS 0x10000u
+
+#define CONN_MODE_RTS 0x10u
+#define CONN_MODE_EOM_ACK 0x13u
+#define CONN_MODE_BAM 0x20u
+#define CONN_MODE_ABORT 0xFFu
+
+extern int pgn_pool_dispatch(const uint32_t id, uint8_t *data,
+			     const uint8_t len);
+
+struct chunk {
+	size_t first;
+	size_t num;
+	char *out;
+	size_t out_len;
+	size_t out_cap;
+	uint64_t frames;
+	bool done;
+};
+
+struct deque {
+	pthread_mutex_t lock;
+	size_t *items;
+	size_t head;
+	size_t tail;
+};
+
+static struct j1939_log_reader reader;
+static struct chunk *chunks;
+static size_t num_chunks;
+static struct deque deques[MAX_THREADS];
+static unsigned int num_threads;
+static uint64_t first_time;
+static bool quiet;
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread struct chunk *cur_chunk;
+static __thread uint64_t cur_time;
+static __thread uint32_t now;
+
+/* Transport: frames come from the log, nothing is sent */
+int j1939_cansend(uint32_t id, uint8_t *data, uint8_t len)
+{
+	return len;
+}
+
+int j1939_canrcv(uint32_t *id, uint8_t *data)
+{
+	return -1;
+}
+
+int j1939_filter(struct j1939_pgn_filter *filter, uint32_t num_filters)
+{
+	return 0;
+}
+
+uint32_t j1939_get_time(void)
+{
+	return now;
+}
+
+static void emit(const char *fmt, ...)
+{
+	struct chunk *c = cur_chunk;
+	va_list ap;
+	int n;
+
+	if (quiet) {
+		return;
+	}
+
+	for (;;) {
+		size_t room = c->out_cap - c->out_len;
+
+		va_start(ap, fmt);
+		n = vsnprintf(c->out + c->out_len, room, fmt, ap);
+		va_end(ap);
+		if (n < 0) {
+			return;
+		}
+		if ((size_t)n < room) {
+			c->out_len += n;
+			return;
+		}
+
+		c->out_cap = c->out_cap ? c->out_cap * 2 : 1 << 16;
+		c->out = realloc(c->out, c->out_cap);
+		if (c->out == NULL) {
+			abort();
+		}
+	}
+}
+
+static void emit_data(const uint8_t *data, const uint8_t len)
+{
+	for (uint8_t i = 0; i < len; i++) {
+		emit("%02X", data[i]);
+	}
+	emit("\n");
+}
+
+static int rcv_tp_dt(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		     uint8_t dest, uint8_t *data, uint8_t len)
+{
+	emit("%" PRIu64 " TP %02X %02X %3u ", cur_time, src, dest, data[0]);
+	emit_data(data + 1, len - 1);
+	return 0;
+}
+
+static void error_handler(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+			  uint8_t dest, int err)
+{
+	emit("%" PRIu64 " ERR %02X %02X %d\n", cur_time, src, dest, err);
+}
+
+static void decode_chunk(struct chunk *c)
+{
+	struct j1939_log_reader slice;
+	struct j1939_log_frame f;
+	j1939_pgn_t pgn;
+	uint8_t priority, src, dst;
+
+	cur_chunk = c;
+	j1939_setup(rcv_tp_dt, error_handler);
+
+	j1939_log_reader_slice(&slice, &reader, c->first, c->num);
+	while (j1939_log_next(&slice, &f)) {
+		cur_time = f.time;
+		now = (uint32_t)((f.time - first_time) / 1000u);
+		c->frames++;
+
+		j1939_id2pgn(f.id, &pgn, &priority, &src, &dst);
+		if (pgn != TP_CM && pgn != TP_DT) {
+			emit("%" PRIu64 " %05X %u %02X %02X ", f.time, pgn,
+			     priority, src, dst);
+			emit_data(f.data, f.len);
+		}
+		if (f.len > 0) {
+			pgn_pool_dispatch(f.id, f.data, f.len);
+		}
+	}
+
+	j1939_dispose();
+}
+
+static bool deque_pop(struct deque *d, size_t *item, bool steal)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->head < d->tail) {
+		*item = steal ? d->items[--d->tail] : d->items[d->head++];
+		ret = true;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return ret;
+}
+
+static bool next_chunk(unsigned int self, size_t *item)
+{
+	if (deque_pop(&deques[self], item, false)) {
+		return true;
+	}
+	for (unsigned int i = 1; i < num_threads; i++) {
+		if (deque_pop(&deques[(self + i) % num_threads], item, true)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void *worker(void *arg)
+{
+	unsigned int self = (unsigned int)(uintptr_t)arg;
+	size_t i;
+
+	while (next_chunk(self, &i)) {
+		decode_chunk(&chunks[i]);
+
+		pthread_mutex_lock(&done_lock);
+		chunks[i].done = true;
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&done_lock);
+	}
+	return NULL;
+}
+
+struct tp_tracker {
+	uint8_t remaining[SESSION_KEYS];
+	uint32_t last[SESSION_KEYS];
+	uint16_t open[SESSION_KEYS];
+	uint32_t pos[SESSION_KEYS];
+	uint32_t num_open;
+};
+
+static void tp_open(struct tp_tracker *t, uint16_t key, uint8_t packets,
+		    uint32_t time)
+{
+	if (t->remaining[key] == 0 && packets > 0) {
+		t->pos[key] = t->num_open;
+		t->open[t->num_open++] = key;
+	}
+	t->remaining[key] = packets;
+	t->last[key] = time;
+}
+
+static void tp_close(struct tp_tracker *t, uint16_t key)
+{
+	if (t->remaining[key] != 0) {
+		uint16_t moved = t->open[--t->num_open];
+		t->open[t->pos[key]] = moved;
+		t->pos[moved] = t->pos[key];
+		t->remaining[key] = 0;
+	}
+}
+
+static void tp_track(struct tp_tracker *t, const struct j1939_log_frame *f,
+		     uint32_t time)
+{
+	j1939_pgn_t pgn;
+	uint8_t priority, src, dst;
+	uint16_t key, rkey;
+
+	j1939_id2pgn(f->id, &pgn, &priority, &src, &dst);
+	key = (src << 8) | dst;
+	rkey = (dst << 8) | src;
+
+	if (pgn == TP_CM && f->len >= 4) {
+		switch (f->data[0]) {
+		case CONN_MODE_RTS:
+		case CONN_MODE_BAM:
+			tp_open(t, key, f->data[3], time);
+			break;
+		case CONN_MODE_EOM_ACK:
+		case CONN_MODE_ABORT:
+			tp_close(t, key);
+			tp_close(t, rkey);
+			break;
+		default:
+			if (t->remaining[rkey]) {
+				t->last[rkey] = time;
+			}
+			break;
+		}
+	} else if (pgn == TP_DT && t->remaining[key]) {
+		t->last[key] = time;
+		if (--t->remaining[key] == 0) {
+			/* remaining already 0, remove from the open list */
+			t->remaining[key] = 1;
+			tp_close(t, key);
+		}
+	}
+}
+
+static void tp_expire(struct tp_tracker *t, uint32_t time)
+{
+	for (uint32_t i = 0; i < t->num_open;) {
+		uint16_t key = t->open[i];
+		if (time - t->last[key] > T1) {
+			tp_close(t, key);
+		} else {
+			i++;
+		}
+	}
+}
+
+/*
+ * Cut the log at block boundaries with no open TP session, aiming at
+ * CHUNKS_PER_THREAD chunks per thread.
+ */
+static int make_chunks(void)
+{
+	struct tp_tracker *t;
+	struct j1939_log_reader blk;
+	struct j1939_log_frame f;
+	size_t target, start = 0;
+	uint32_t time = 0;
+	bool first = true;
+
+	t = calloc(1, sizeof(*t));
+	chunks = calloc(reader.nblocks + 1, sizeof(*chunks));
+	if (t == NULL || chunks == NULL) {
+		free(t);
+		return -1;
+	}
+
+	target = reader.nblocks / (num_threads * CHUNKS_PER_THREAD);
+	if (target == 0) {
+		target = 1;
+	}
+
+	for (size_t b = 0; b < reader.nblocks; b++) {
+		j1939_log_reader_slice(&blk, &reader, b, 1);
+		while (j1939_log_next(&blk, &f)) {
+			if (first) {
+				first_time = f.time;
+				first = false;
+			}
+			time = (uint32_t)((f.time - first_time) / 1000u);
+			tp_track(t, &f, time);
+		}
+		tp_expire(t, time);
+
+		if (b + 1 - start >= target && t->num_open == 0) {
+			chunks[num_chunks].first = start;
+			chunks[num_chunks].num = b + 1 - start;
+			num_chunks++;
+			start = b + 1;
+		}
+	}
+	if (start < reader.nblocks) {
+		chunks[num_chunks].first = start;
+		chunks[num_chunks].num = reader.nblocks - start;
+		num_chunks++;
+	}
+
+	free(t);
+	return 0;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t tid[MAX_THREADS];
+	uint64_t frames = 0;
+	double start, wall;
+	int opt;
+
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "j:q")) != -1) {
+		switch (opt) {
+		case 'j':
+			num_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (num_threads == 0 || num_threads > MAX_THREADS) {
+		num_threads = MAX_THREADS;
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-j threads] [-q] <file.bin>\n",
+			argv[0]);
+		return 1;
+	}
+
+	if (j1939_log_reader_open(&reader, argv[optind]) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	start = now_sec();
+	if (make_chunks() < 0) {
+		perror("chunks");
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		pthread_mutex_init(&deques[i].lock, NULL);
+		deques[i].items = calloc(num_chunks + 1, sizeof(size_t));
+	}
+	/* contiguous ranges keep the chunks of a thread close in time */
+	for (size_t i = 0; i < num_chunks; i++) {
+		struct deque *d = &deques[i * num_threads / num_chunks];
+		d->items[d->tail++] = i;
+	}
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		int err = pthread_create(&tid[i], NULL, worker,
+					 (void *)(uintptr_t)i);
+		if (err != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			/* exiting stops the workers already started */
+			return 1;
+		}
+	}
+
+	/* merge */
+	for (size_t i = 0; i < num_chunks; i++) {
+		pthread_mutex_lock(&done_lock);
+		while (!chunks[i].done) {
+			pthread_cond_wait(&done_cond, &done_lock);
+		}
+		pthread_mutex_unlock(&done_lock);
+
+		fwrite(chunks[i].out, 1, chunks[i].out_len, stdout);
+		free(chunks[i].out);
+		frames += chunks[i].frames;
+	}
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		pthread_join(tid[i], NULL);
+		free(deques[i].items);
+	}
+	wall = now_sec() - start;
+
+	fprintf(stderr, "%" PRIu64 " frames, %zu chunks, %u threads, "
+		"%.3f s, %.0f frames/s\n", frames, num_chunks, num_threads,
+		wall, wall > 0 ? frames / wall : 0);
+
+	free(chunks);
+	j1939_log_reader_close(&reader);
+	return 0;
+}
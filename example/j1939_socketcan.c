@@ -16,11 +16,79 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
+#include "config.h"
 #include "j1939.h"
+#include "j1939_spn.h"
+#if defined(J1939_WITH_ADDR)
+#include "j1939_addr.h"
+#endif
 
 extern int connect_canbus(const char *can_ifname);
 extern void disconnect_canbus(void);
 
+/* Inlet/Exhaust Conditions 1 (PGN 65270) */
+static const struct j1939_spn_def ic1_spns[] = {
+	J1939_SPN_DEF(81, J1939_SPN_POS(1, 1), 8, 0.5f, 0.0f),
+	J1939_SPN_DEF(102, J1939_SPN_POS(2, 1), 8, 2.0f, 0.0f),
+	J1939_SPN_DEF(105, J1939_SPN_POS(3, 1), 8, 1.0f, -40.0f),
+	J1939_SPN_DEF(106, J1939_SPN_POS(4, 1), 8, 2.0f, 0.0f),
+	J1939_SPN_DEF(107, J1939_SPN_POS(5, 1), 8, 0.05f, 0.0f),
+	J1939_SPN_DEF(173, J1939_SPN_POS(6, 1), 16, 0.03125f, -273.0f),
+	J1939_SPN_DEF(112, J1939_SPN_POS(8, 1), 8, 0.5f, 0.0f),
+};
+
+static const struct j1939_spn_pgn spn_table[] = {
+	{ .pgn = 65270, .len = 8, .spns = ic1_spns,
+	  .num_spns = sizeof(ic1_spns) / sizeof(ic1_spns[0]) },
+};
+
+/*
+ * With J1939_SNAPSHOT=<file> in the environment the address claimed by the
+ * previous run is announced at once, without claiming it again.
+ */
+static int claim(const uint8_t src, ecu_name_t name)
+{
+#if defined(J1939_WITH_ADDR)
+	ecu_name_t last;
+	uint8_t addr;
+
+	if (j1939_addr_get(&addr, &last) == J1939_ADDR_CLAIMED &&
+	    addr == src && last.value == name.value) {
+		return j1939_address_claimed(src, name);
+	}
+#endif
+	int ret = j1939_address_claim(src, name);
+	if (ret < 0) {
+		return ret;
+	}
+	return j1939_address_claimed(src, name);
+}
+
+static void dump_spn(const j1939_pgn_t pgn, const uint8_t *data,
+		     const uint32_t len)
+{
+	const struct j1939_spn_pgn *def;
+	float values[8];
+	uint8_t status[8];
+	int n;
+
+	def = j1939_spn_find(spn_table,
+			     sizeof(spn_table) / sizeof(spn_table[0]), pgn);
+	if (def == NULL) {
+		return;
+	}
+
+	n = j1939_spn_decode(def, data, len, values, status);
+	for (int i = 0; i < n; i++) {
+		if (status[i] == J1939_SPN_VALID) {
+			printf("SPN %u: %.2f\n", def->spns[i].spn, values[i]);
+		} else {
+			printf("SPN %u: %s\n", def->spns[i].spn,
+			       status[i] == J1939_SPN_ERROR ? "error" : "n/a");
+		}
+	}
+}
+
 int main(void)
 {
 	int ret, ntimes = 5;
@@ -35,8 +103,8 @@ int main(void)
 		0x46, /* Intake Manifold 1 Temperature (SPN 105) */
 		J1930_NA_8, /* Air Inlet Pressure (SPN 106) */
 		J1930_NA_8, /* Air Filter 1 Differential. Pressure (SPN 107) */
-		J1930_NA_16_MSB, /* Exhaust Gas Temperature (SPN 173) - MSB */
 		J1930_NA_16_LSB, /* Exhaust Gas Temperature (SPN 173) - LSB */
+		J1930_NA_16_MSB, /* Exhaust Gas Temperature (SPN 173) - MSB */
 		J1930_NA_8, /* Coolant Filter Differ. Pressure 112) */
 	};
 
@@ -58,18 +126,19 @@ int main(void)
 		return 1;
 	}
 
-	ret = j1939_address_claim(src, name);
+	j1939_setup(NULL, NULL);
+
+	ret = claim(src, name);
 	if (ret < 0) {
 		printf("J1939 AC returns with code %d\n", ret);
 	}
 
-	j1939_address_claimed(src, name);
-
 	do {
 		ret = j1939_tp(pgn, 6, src, dest, data, 8);
 		if (ret < 0) {
 			printf("J1939 TP returns with code %d\n", ret);
 		}
+		dump_spn(pgn, data, sizeof(data));
 		data[2]++;
 	} while (ntimes-- && ret >= 0);
 
@@ -80,6 +149,9 @@ int main(void)
 		printf("J1939 BAM returns with code %d\n", ret);
 	}
 
+#if defined(J1939_WITH_ADDR)
+	j1939_addr_save();
+#endif
 	disconnect_canbus();
 	return 0;
 }
@@ -30,6 +30,7 @@
 extern int pgn_pool_receive(void);
 extern void j1939_task_yield(void);
 extern int connect_canbus(const char *can_ifname);
+extern int j1939_tx_writer_start(void);
 extern void disconnect_canbus(void);
 extern uint32_t j1939_get_time(void);
 
@@ -102,6 +103,12 @@ int main(void)
 		return 1;
 	}
 
+	/*
+	 * Three senders and the RX thread (CTS, EOM ACK) share the socket:
+	 * queue their frames to a single writer, if available.
+	 */
+	j1939_tx_writer_start();
+
 	j1939_setup(rcv_tp_dt, error_handler);
 
 	pthread_create(&tid, NULL, pgn_rx, NULL);
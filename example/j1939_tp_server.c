@@ -30,6 +30,7 @@ static void *pgn_rx(void *x)
 {
 	while (!stop) {
 		pgn_pool_receive();
+		j1939_tp_poll();
 	}
 	return NULL;
 }
@@ -8,19 +8,67 @@
 #include <bits/time.h>
 #include <pthread.h>
 #include <net/if.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <limits.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/futex.h>
 
+#include "config.h"
 #include "j1939.h"
+#include "pgn.h"
 
+#include "pgn_pool.h"
+
+#if defined(HAVE_LINUX_CAN_J1939_H)
+#include <linux/can/j1939.h>
+#endif
+#if defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#endif
+#if defined(J1939_WITH_TXQ)
+#include "j1939_txq.h"
+#endif
+
+extern uint32_t j1939_get_time_us(void);
 extern void j1939_task_yield(void);
 
 static int cansock = -1;
 
+/*
+ * With the CAN_J1939 backend the kernel runs TP/ETP: frames are sent on a
+ * socket bound to their source address (opened on first use) and all the
+ * traffic is received on a promiscuous socket. The kernel answers an RTS
+ * only for addresses bound by a local socket, so a node must send before
+ * it can receive TP messages (e.g. its address claim).
+ */
+static bool kernel_j1939;
+#if defined(HAVE_LINUX_CAN_J1939_H)
+static int can_ifindex;
+static int tx_sock[256];
+static uint8_t tx_prio[256];
+static uint8_t rx_buf[J1939_MAX_DATA_LEN];
+#endif
+
 int connect_canbus(const char *can_ifname);
+int connect_canbus_j1939(const char *can_ifname);
 int disconnect_canbus(void);
+int j1939_uring_open(const char *const *ifnames, const size_t num);
+int j1939_uring_poll(const uint32_t timeout);
+int j1939_uring_bus(void);
+int j1939_uring_send(uint8_t bus, uint32_t id, uint8_t *data, uint8_t len);
+uint32_t j1939_uring_tx_errors(const uint8_t bus);
+void j1939_uring_select(const int bus);
+int j1939_uring_close(void);
+int j1939_tx_writer_start(void);
+int j1939_tx_writer_stop(void);
+int j1939_nv_read(uint8_t *buf, const size_t size);
+int j1939_nv_write(const uint8_t *buf, const size_t len);
 
 static inline ssize_t xread(int fd, void *buf, size_t len)
 {
@@ -44,11 +92,20 @@ static inline ssize_t xwrite(int fd, const void *buf, size_t len)
 	}
 }
 
+/*
+ * The backend is selected at runtime: J1939_BACKEND=kernel in the
+ * environment uses CAN_J1939 sockets instead of CAN_RAW.
+ */
 int connect_canbus(const char *can_ifname)
 {
 	int ret, sock;
 	struct ifreq ifr;
 	struct sockaddr_can addr;
+	const char *backend = getenv("J1939_BACKEND");
+
+	if (backend && strcmp(backend, "kernel") == 0) {
+		return connect_canbus_j1939(can_ifname);
+	}
 
 	sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
 	if (sock < 0) {
@@ -71,8 +128,978 @@ int connect_canbus(const char *can_ifname)
 	return 0;
 }
 
+#if defined(HAVE_LINUX_CAN_J1939_H)
+int connect_canbus_j1939(const char *can_ifname)
+{
+	int sock, on = 1;
+	struct ifreq ifr;
+	struct sockaddr_can addr;
+
+	sock = socket(PF_CAN, SOCK_DGRAM, CAN_J1939);
+	if (sock < 0) {
+		return sock;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, can_ifname, IFNAMSIZ - 1);
+	if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	addr.can_addr.j1939.name = J1939_NO_NAME;
+	addr.can_addr.j1939.pgn = J1939_NO_PGN;
+	addr.can_addr.j1939.addr = J1939_NO_ADDR;
+
+	if (setsockopt(sock, SOL_CAN_J1939, SO_J1939_PROMISC, &on,
+		       sizeof(on)) < 0 ||
+	    bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	can_ifindex = ifr.ifr_ifindex;
+	cansock = sock;
+	kernel_j1939 = true;
+	return 0;
+}
+
+/* Socket sending from src, it receives nothing (rx is on cansock) */
+static int j1939_tx_socket(const uint8_t src)
+{
+	int sock, on = 1;
+	struct sockaddr_can addr;
+	const struct j1939_filter none = {
+		.pgn = J1939_NO_PGN,
+		.pgn_mask = J1939_NO_PGN | J1939_PGN_MAX,
+	};
+
+	if (tx_sock[src] > 0) {
+		return tx_sock[src];
+	}
+
+	sock = socket(PF_CAN, SOCK_DGRAM, CAN_J1939);
+	if (sock < 0) {
+		return sock;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = can_ifindex;
+	addr.can_addr.j1939.name = J1939_NO_NAME;
+	addr.can_addr.j1939.pgn = J1939_NO_PGN;
+	addr.can_addr.j1939.addr = src;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)) < 0 ||
+	    setsockopt(sock, SOL_CAN_J1939, SO_J1939_FILTER, &none,
+		       sizeof(none)) < 0 ||
+	    bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	tx_prio[src] = J1939_PRIORITY_DEFAULT;
+	tx_sock[src] = sock;
+	return sock;
+}
+
+static int j1939_sendto(const j1939_pgn_t pgn, const uint8_t priority,
+			const uint8_t src, const uint8_t dst,
+			const uint8_t *data, const uint16_t len)
+{
+	struct sockaddr_can addr;
+	int prio = priority;
+	int sock = j1939_tx_socket(src);
+
+	if (sock < 0) {
+		return sock;
+	}
+
+	if (tx_prio[src] != priority) {
+		if (setsockopt(sock, SOL_CAN_J1939, SO_J1939_SEND_PRIO, &prio,
+			       sizeof(prio)) < 0) {
+			return -1;
+		}
+		tx_prio[src] = priority;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = can_ifindex;
+	addr.can_addr.j1939.name = J1939_NO_NAME;
+	addr.can_addr.j1939.pgn = pgn;
+	addr.can_addr.j1939.addr = dst;
+
+	return sendto(sock, data, len, 0, (struct sockaddr *)&addr,
+		      sizeof(addr));
+}
+
+int j1939_tp_offload(const j1939_pgn_t pgn, const uint8_t priority,
+		     const uint8_t src, const uint8_t dst, uint8_t *data,
+		     const uint16_t len)
+{
+	if (!kernel_j1939) {
+		return -J1939_ENOTSUP;
+	}
+	if (j1939_sendto(pgn, priority, src, dst, data, len) != len) {
+		return -J1939_EIO;
+	}
+	return 0;
+}
+
+static int j1939_kernel_send(uint32_t id, uint8_t *data, uint8_t len)
+{
+	j1939_pgn_t pgn;
+	uint8_t priority, src, dst;
+
+	j1939_id2pgn(id, &pgn, &priority, &src, &dst);
+	if (!j1939_pdu_is_p2p(pgn)) {
+		dst = J1939_NO_ADDR;
+	}
+	return j1939_sendto(pgn, priority, src, dst, data, len);
+}
+
+static int j1939_kernel_rcv(uint32_t *id, uint8_t *data)
+{
+	struct sockaddr_can addr;
+	/* destination address, destination name and priority */
+	uint8_t ctrl[CMSG_SPACE(sizeof(uint64_t)) * 3];
+	struct iovec iov = { .iov_base = rx_buf, .iov_len = sizeof(rx_buf) };
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctrl,
+		.msg_controllen = sizeof(ctrl),
+	};
+	struct cmsghdr *cmsg;
+	uint8_t priority = J1939_PRIORITY_DEFAULT, dst = J1939_NO_ADDR;
+	ssize_t len;
+	j1939_pgn_t pgn;
+
+	do {
+		len = recvmsg(cansock, &msg, 0);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) {
+		return -1;
+	}
+
+	/* sent by this process, CAN_RAW does not receive its own frames */
+	if ((msg.msg_flags & MSG_DONTROUTE) &&
+	    tx_sock[addr.can_addr.j1939.addr] > 0) {
+		return 0;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_CAN_J1939) {
+			continue;
+		}
+		if (cmsg->cmsg_type == SCM_J1939_DEST_ADDR) {
+			dst = *CMSG_DATA(cmsg);
+		} else if (cmsg->cmsg_type == SCM_J1939_PRIO) {
+			priority = *CMSG_DATA(cmsg);
+		}
+	}
+
+	pgn = addr.can_addr.j1939.pgn;
+	if (len > 8) {
+		j1939_tp_received(priority, addr.can_addr.j1939.addr, dst,
+				  rx_buf, len);
+		return 0;
+	}
+
+	*id = ((uint32_t)priority << 26) | ((pgn & 0x3FFFFu) << 8) |
+	      addr.can_addr.j1939.addr;
+	if (j1939_pdu_is_p2p(pgn)) {
+		*id |= (uint32_t)dst << 8;
+	}
+	memcpy(data, rx_buf, len);
+	return len;
+}
+
+static int j1939_kernel_filter(struct j1939_pgn_filter *filter,
+			       uint32_t num_filters)
+{
+	struct j1939_filter kfilter[num_filters];
+
+	memset(kfilter, 0, sizeof(kfilter));
+	for (size_t i = 0; i < num_filters; i++) {
+		kfilter[i].pgn = filter[i].pgn;
+		kfilter[i].pgn_mask = filter[i].pgn_mask;
+		kfilter[i].addr = filter[i].addr;
+		kfilter[i].addr_mask = filter[i].addr_mask;
+	}
+	return setsockopt(cansock, SOL_CAN_J1939, SO_J1939_FILTER, &kfilter,
+			  sizeof(kfilter));
+}
+#else
+int connect_canbus_j1939(const char *can_ifname)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif /* HAVE_LINUX_CAN_J1939_H */
+
+#if defined(HAVE_LINUX_IO_URING_H)
+/*
+ * io_uring engine: a single thread services the CAN_RAW sockets of several
+ * interfaces. Every socket has a multishot receive armed on a ring of
+ * provided buffers, so received frames are collected without any syscall
+ * per frame and dispatched to the PGN pool. Frames are sent with
+ * WRITE_FIXED from a registered buffer: sends from the polling thread (e.g.
+ * replies from the callbacks) are submitted with the next wait, sends from
+ * other threads are submitted at once.
+ */
+#define URING_MAX_BUS 16u
+#define URING_ENTRIES 256u
+#define URING_CQ_ENTRIES 4096u
+#define URING_RX_BUFS 1024u
+#define URING_TX_BUFS 512u
+#define URING_BGID 0u
+
+/* user_data: operation in the upper 32 bits, bus or tx slot in the lower */
+#define URING_OP_RX 1ull
+#define URING_OP_TX 2ull
+
+static struct {
+	int fd;
+	int sock[URING_MAX_BUS];
+	size_t num_bus;
+	pthread_t poller;
+	pthread_mutex_t lock;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size;
+	unsigned int *sq_head, *sq_tail, *sq_array, sq_mask;
+	unsigned int *cq_head, *cq_tail, cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_local;
+	unsigned int to_submit;
+
+	struct io_uring_buf_ring *br;
+	uint16_t br_tail;
+	struct can_frame *rx_frames;
+	struct can_frame *tx_frames;
+	uint16_t tx_free[URING_TX_BUFS];
+	size_t num_tx_free;
+	/* bus of every tx slot, failed writes per bus */
+	uint8_t tx_bus[URING_TX_BUFS];
+	uint32_t tx_errors[URING_MAX_BUS];
+} uring = {
+	.fd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * Bus used by j1939_cansend() from this thread: the bus of the frame being
+ * dispatched in the polling thread, the one of j1939_uring_select() in the
+ * others.
+ */
+static __thread int uring_bus;
+
+static int uring_enter(unsigned int to_submit, unsigned int min_complete,
+		       unsigned int flags)
+{
+	int ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, uring.fd, to_submit,
+			      min_complete, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+/* Called with the lock held */
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+
+	while (uring.sq_local - head > uring.sq_mask) {
+		/*
+		 * Full: push all the entries not consumed yet to the kernel,
+		 * to_submit may not count them if the poller just took it.
+		 * The slot is only reused once the kernel moved the head.
+		 */
+		if (uring_enter(uring.sq_local - head, 0, 0) < 0) {
+			return NULL;
+		}
+		uring.to_submit = 0;
+		if (__atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) == head) {
+			errno = EBUSY;
+			return NULL;
+		}
+		head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	sqe = &uring.sqes[uring.sq_local & uring.sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static void uring_commit_sqe(void)
+{
+	uring.sq_array[uring.sq_local & uring.sq_mask] =
+		uring.sq_local & uring.sq_mask;
+	uring.sq_local++;
+	uring.to_submit++;
+	__atomic_store_n(uring.sq_tail, uring.sq_local, __ATOMIC_RELEASE);
+}
+
+static void uring_give_rx_buf(const uint16_t bid)
+{
+	struct io_uring_buf *buf =
+		&uring.br->bufs[uring.br_tail & (URING_RX_BUFS - 1u)];
+
+	buf->addr = (uint64_t)(uintptr_t)&uring.rx_frames[bid];
+	buf->len = sizeof(struct can_frame);
+	buf->bid = bid;
+	uring.br_tail++;
+}
+
+static int uring_arm_rx(const size_t bus)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = bus;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = (URING_OP_RX << 32) | bus;
+	uring_commit_sqe();
+	return 0;
+}
+
+static int uring_send(const int bus, const uint32_t id, const uint8_t *data,
+		      const uint8_t len)
+{
+	const bool poller = pthread_equal(uring.poller, pthread_self());
+	struct io_uring_sqe *sqe;
+	struct can_frame *frame;
+	uint16_t slot;
+
+	pthread_mutex_lock(&uring.lock);
+	while (uring.num_tx_free == 0) {
+		/* slots are released by the polling thread */
+		pthread_mutex_unlock(&uring.lock);
+		if (poller) {
+			errno = ENOBUFS;
+			return -1;
+		}
+		j1939_task_yield();
+		pthread_mutex_lock(&uring.lock);
+	}
+
+	sqe = uring_get_sqe();
+	if (sqe == NULL) {
+		pthread_mutex_unlock(&uring.lock);
+		return -1;
+	}
+
+	slot = uring.tx_free[--uring.num_tx_free];
+	uring.tx_bus[slot] = bus;
+	frame = &uring.tx_frames[slot];
+	frame->can_id = id | CAN_EFF_FLAG;
+	frame->can_dlc = len;
+	memcpy(frame->data, data, len);
+
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = bus;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->addr = (uint64_t)(uintptr_t)frame;
+	sqe->len = sizeof(*frame);
+	sqe->buf_index = 0;
+	sqe->user_data = (URING_OP_TX << 32) | slot;
+	uring_commit_sqe();
+
+	if (!poller) {
+		if (uring_enter(uring.to_submit, 0, 0) < 0) {
+			pthread_mutex_unlock(&uring.lock);
+			return -1;
+		}
+		uring.to_submit = 0;
+	}
+	pthread_mutex_unlock(&uring.lock);
+	return len;
+}
+
+static int uring_setup(void)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	struct iovec iov;
+	uint8_t *sq_ptr, *cq_ptr;
+	size_t i;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_CQ_ENTRIES;
+	uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (uring.fd < 0) {
+		return -1;
+	}
+
+	uring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	uring.cq_size =
+		p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	sq_ptr = mmap(NULL, uring.sq_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+	cq_ptr = mmap(NULL, uring.cq_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+	uring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  uring.fd, IORING_OFF_SQES);
+	if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED ||
+	    uring.sqes == MAP_FAILED) {
+		return -1;
+	}
+	uring.sq_ptr = sq_ptr;
+	uring.cq_ptr = cq_ptr;
+	uring.sq_head = (unsigned int *)(sq_ptr + p.sq_off.head);
+	uring.sq_tail = (unsigned int *)(sq_ptr + p.sq_off.tail);
+	uring.sq_mask = *(unsigned int *)(sq_ptr + p.sq_off.ring_mask);
+	uring.sq_array = (unsigned int *)(sq_ptr + p.sq_off.array);
+	uring.sq_local = *uring.sq_tail;
+	uring.cq_head = (unsigned int *)(cq_ptr + p.cq_off.head);
+	uring.cq_tail = (unsigned int *)(cq_ptr + p.cq_off.tail);
+	uring.cq_mask = *(unsigned int *)(cq_ptr + p.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+	/* sockets, indexed by bus number */
+	if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_FILES,
+		    uring.sock, uring.num_bus) < 0) {
+		return -1;
+	}
+
+	/* tx frames */
+	uring.tx_frames = mmap(NULL, URING_TX_BUFS * sizeof(struct can_frame),
+			       PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (uring.tx_frames == MAP_FAILED) {
+		return -1;
+	}
+	iov.iov_base = uring.tx_frames;
+	iov.iov_len = URING_TX_BUFS * sizeof(struct can_frame);
+	if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_BUFFERS,
+		    &iov, 1) < 0) {
+		return -1;
+	}
+	for (i = 0; i < URING_TX_BUFS; i++) {
+		uring.tx_free[i] = URING_TX_BUFS - 1u - i;
+	}
+	uring.num_tx_free = URING_TX_BUFS;
+
+	/* rx frames, provided to the kernel through a buffer ring */
+	uring.br = mmap(NULL, URING_RX_BUFS * sizeof(struct io_uring_buf),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0);
+	uring.rx_frames = mmap(NULL, URING_RX_BUFS * sizeof(struct can_frame),
+			       PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (uring.br == MAP_FAILED || uring.rx_frames == MAP_FAILED) {
+		return -1;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)uring.br;
+	reg.ring_entries = URING_RX_BUFS;
+	reg.bgid = URING_BGID;
+	if (syscall(__NR_io_uring_register, uring.fd,
+		    IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		return -1;
+	}
+	for (i = 0; i < URING_RX_BUFS; i++) {
+		uring_give_rx_buf(i);
+	}
+	__atomic_store_n(&uring.br->tail, uring.br_tail, __ATOMIC_RELEASE);
+
+	for (i = 0; i < uring.num_bus; i++) {
+		if (uring_arm_rx(i) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void uring_teardown(void)
+{
+	size_t i;
+
+	if (uring.fd >= 0) {
+		close(uring.fd);
+		uring.fd = -1;
+	}
+	if (uring.sq_ptr && uring.sq_ptr != MAP_FAILED) {
+		munmap(uring.sq_ptr, uring.sq_size);
+	}
+	if (uring.cq_ptr && uring.cq_ptr != MAP_FAILED) {
+		munmap(uring.cq_ptr, uring.cq_size);
+	}
+	if (uring.sqes && uring.sqes != MAP_FAILED) {
+		munmap(uring.sqes, URING_ENTRIES * sizeof(struct io_uring_sqe));
+	}
+	if (uring.tx_frames && uring.tx_frames != MAP_FAILED) {
+		munmap(uring.tx_frames,
+		       URING_TX_BUFS * sizeof(struct can_frame));
+	}
+	if (uring.br && uring.br != MAP_FAILED) {
+		munmap(uring.br, URING_RX_BUFS * sizeof(struct io_uring_buf));
+	}
+	if (uring.rx_frames && uring.rx_frames != MAP_FAILED) {
+		munmap(uring.rx_frames,
+		       URING_RX_BUFS * sizeof(struct can_frame));
+	}
+	for (i = 0; i < uring.num_bus; i++) {
+		close(uring.sock[i]);
+	}
+	uring.sq_ptr = uring.cq_ptr = NULL;
+	uring.sqes = NULL;
+	uring.tx_frames = uring.rx_frames = NULL;
+	uring.br = NULL;
+	uring.num_bus = 0;
+	uring.to_submit = 0;
+}
+
+/*
+ * Open CAN_RAW sockets on num interfaces and service them with io_uring.
+ * The interface index in ifnames is the bus number of j1939_uring_bus().
+ * j1939_uring_poll() must be called from a single thread, the one calling
+ * j1939_uring_open().
+ */
+int j1939_uring_open(const char *const *ifnames, const size_t num)
+{
+	struct ifreq ifr;
+	struct sockaddr_can addr;
+	size_t i;
+	int sock;
+
+	if (num == 0 || num > URING_MAX_BUS || uring.fd >= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(uring.tx_errors, 0, sizeof(uring.tx_errors));
+
+	for (i = 0; i < num; i++) {
+		sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+		if (sock < 0) {
+			break;
+		}
+		uring.sock[uring.num_bus++] = sock;
+
+		memset(&ifr, 0, sizeof(ifr));
+		strncpy(ifr.ifr_name, ifnames[i], IFNAMSIZ - 1);
+		if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+			break;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.can_family = AF_CAN;
+		addr.can_ifindex = ifr.ifr_ifindex;
+		if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			break;
+		}
+	}
+
+	uring.poller = pthread_self();
+	if (i < num || uring_setup() < 0) {
+		uring_teardown();
+		return -1;
+	}
+
+	/* j1939_filter() and j1939_canrcv() use the first bus */
+	cansock = uring.sock[0];
+	uring_bus = 0;
+	return 0;
+}
+
+/*
+ * Submit the pending sends, wait up to timeout ms for events and dispatch
+ * the frames received.
+ *
+ * @return number of frames dispatched, -1 on error
+ */
+int j1939_uring_poll(const uint32_t timeout)
+{
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout / 1000u,
+		.tv_nsec = (timeout % 1000u) * 1000000L,
+	};
+	struct io_uring_getevents_arg arg = {
+		.ts = (uint64_t)(uintptr_t)&ts,
+	};
+	struct io_uring_cqe *cqe;
+	struct can_frame *frame;
+	unsigned int head, tail, to_submit;
+	uint32_t op, idx;
+	int ret, dispatched = 0;
+
+	pthread_mutex_lock(&uring.lock);
+	to_submit = uring.to_submit;
+	uring.to_submit = 0;
+	pthread_mutex_unlock(&uring.lock);
+
+	head = *uring.cq_head;
+	if (head == __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+		do {
+			ret = syscall(__NR_io_uring_enter, uring.fd, to_submit,
+				      1, IORING_ENTER_GETEVENTS |
+				      IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0 && errno != ETIME) {
+			return -1;
+		}
+	} else if (to_submit && uring_enter(to_submit, 0, 0) < 0) {
+		return -1;
+	}
+
+	tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &uring.cqes[head & uring.cq_mask];
+		op = cqe->user_data >> 32;
+		idx = cqe->user_data & 0xFFFFFFFFu;
+
+		if (op == URING_OP_TX) {
+			/* the frame was not sent, e.g. -ENOBUFS or bus-off */
+			if (cqe->res < 0) {
+				__atomic_add_fetch(
+					&uring.tx_errors[uring.tx_bus[idx]], 1,
+					__ATOMIC_RELAXED);
+			}
+			pthread_mutex_lock(&uring.lock);
+			uring.tx_free[uring.num_tx_free++] = idx;
+			pthread_mutex_unlock(&uring.lock);
+			continue;
+		}
+
+		if (cqe->flags & IORING_CQE_F_BUFFER) {
+			frame = &uring.rx_frames[cqe->flags >>
+						 IORING_CQE_BUFFER_SHIFT];
+			if (cqe->res == sizeof(*frame) &&
+			    (frame->can_id & CAN_EFF_FLAG)) {
+				uring_bus = idx;
+				pgn_pool_dispatch(frame->can_id, frame->data,
+						  frame->can_dlc);
+				dispatched++;
+			}
+			uring_give_rx_buf(cqe->flags >>
+					  IORING_CQE_BUFFER_SHIFT);
+		}
+
+		/* multishot ended (e.g. out of buffers): arm it again */
+		if (!(cqe->flags & IORING_CQE_F_MORE)) {
+			pthread_mutex_lock(&uring.lock);
+			ret = uring_arm_rx(idx);
+			pthread_mutex_unlock(&uring.lock);
+			if (ret < 0) {
+				return -1;
+			}
+		}
+	}
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+	__atomic_store_n(&uring.br->tail, uring.br_tail, __ATOMIC_RELEASE);
+	return dispatched;
+}
+
+/* Bus of the frame being dispatched, frames are sent on it */
+int j1939_uring_bus(void)
+{
+	return uring_bus;
+}
+
+/* Send on a bus, e.g. as the j1939_gw_send_t of every bus */
+int j1939_uring_send(uint8_t bus, uint32_t id, uint8_t *data, uint8_t len)
+{
+	if (bus >= uring.num_bus) {
+		errno = EINVAL;
+		return -1;
+	}
+	return uring_send(bus, id, data, len);
+}
+
+/*
+ * Frames j1939_uring_send() queued but the kernel failed to write: the
+ * writes complete after the call returned.
+ */
+uint32_t j1939_uring_tx_errors(const uint8_t bus)
+{
+	if (bus >= URING_MAX_BUS) {
+		return 0;
+	}
+	return __atomic_load_n(&uring.tx_errors[bus], __ATOMIC_RELAXED);
+}
+
+/* Select the bus of the next frames sent by the calling thread */
+void j1939_uring_select(const int bus)
+{
+	if (bus >= 0 && (size_t)bus < uring.num_bus) {
+		uring_bus = bus;
+	}
+}
+
+int j1939_uring_close(void)
+{
+	if (uring.fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	uring_teardown();
+	cansock = -1;
+	return 0;
+}
+#else
+int j1939_uring_open(const char *const *ifnames, const size_t num)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int j1939_uring_poll(const uint32_t timeout)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int j1939_uring_bus(void)
+{
+	return 0;
+}
+
+int j1939_uring_send(uint8_t bus, uint32_t id, uint8_t *data, uint8_t len)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+uint32_t j1939_uring_tx_errors(const uint8_t bus)
+{
+	return 0;
+}
+
+void j1939_uring_select(const int bus)
+{
+}
+
+int j1939_uring_close(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
+#if defined(J1939_WITH_TXQ)
+/*
+ * TX writer: j1939_cansend() only queues the frame, a single thread sends
+ * the queued frames with one sendmmsg() per batch. Senders never contend
+ * on the socket and frames leave in the order they were queued. Producers
+ * yield while the queue is full.
+ *
+ * The writer also paces the BAMs handed over by j1939_cansend_bam(): it
+ * sends the announce, then the TP.DT packets one per period between the
+ * batches, timed from the frames actually sent.
+ */
+#define TXQ_SLOTS 1024u
+#define TXQ_BATCH 32u
+#define TXQ_BAMS 4u
+
+struct txq_bam {
+	bool busy;
+	uint32_t cm_id;
+	uint32_t dt_id;
+	uint32_t period;
+	/* time the next packet is due */
+	uint32_t due;
+	/* frames[0] is the announce */
+	uint16_t next;
+	uint16_t num_frames;
+	uint8_t frames[256][8];
+};
+
+static struct {
+	bool active;
+	bool stop;
+	pthread_t writer;
+	struct j1939_txq q;
+	struct j1939_txq_frame slots[TXQ_SLOTS];
+	pthread_mutex_t bam_lock;
+	struct txq_bam bams[TXQ_BAMS];
+} txq;
+
+static void txq_send(const struct j1939_txq_frame *batch, const size_t num)
+{
+	struct can_frame frames[TXQ_BATCH];
+	struct mmsghdr msgs[TXQ_BATCH];
+	struct iovec iov[TXQ_BATCH];
+	size_t sent = 0;
+	int ret;
+
+	memset(msgs, 0, sizeof(msgs[0]) * num);
+	for (size_t i = 0; i < num; i++) {
+		frames[i].can_id = batch[i].id | CAN_EFF_FLAG;
+		frames[i].can_dlc = batch[i].len;
+		memcpy(frames[i].data, batch[i].data, batch[i].len);
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = sizeof(frames[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < num) {
+		ret = sendmmsg(cansock, &msgs[sent], num - sent, 0);
+		if (ret > 0) {
+			sent += ret;
+		} else if (errno == ENOBUFS || errno == EAGAIN) {
+			/* TX queue of the interface full */
+			j1939_task_yield();
+		} else if (errno != EINTR) {
+			/* drop the frame the interface refuses */
+			sent++;
+		}
+	}
+}
+
+/* Send the BAM packets due, return the time to the next one [msec] */
+static uint32_t txq_bam_release(bool *pending)
+{
+	const uint32_t now = j1939_get_time();
+	struct j1939_txq_frame f = { .len = 8 };
+	uint32_t wait = 100;
+
+	*pending = false;
+	pthread_mutex_lock(&txq.bam_lock);
+	for (size_t i = 0; i < TXQ_BAMS; i++) {
+		struct txq_bam *b = &txq.bams[i];
+		int32_t left;
+
+		if (!b->busy) {
+			continue;
+		}
+		left = b->next == 0 ? 0 : (int32_t)(b->due - now);
+		if (left <= 0) {
+			f.id = b->next == 0 ? b->cm_id : b->dt_id;
+			memcpy(f.data, b->frames[b->next], 8);
+			txq_send(&f, 1);
+			/* from now: a late packet does not shorten the gap */
+			b->due = now + b->period;
+			left = b->period;
+			if (++b->next == b->num_frames) {
+				b->busy = false;
+				continue;
+			}
+		}
+		if ((uint32_t)left < wait) {
+			wait = left;
+		}
+		*pending = true;
+	}
+	pthread_mutex_unlock(&txq.bam_lock);
+	return wait;
+}
+
+static void *txq_writer(void *arg)
+{
+	struct j1939_txq_frame batch[TXQ_BATCH];
+	uint32_t wait;
+	bool pending;
+	size_t n;
+
+	for (;;) {
+		n = j1939_txq_pop(&txq.q, batch, TXQ_BATCH);
+		if (n > 0) {
+			txq_send(batch, n);
+		}
+		wait = txq_bam_release(&pending);
+		if (n > 0) {
+			continue;
+		}
+		if (!pending &&
+		    __atomic_load_n(&txq.stop, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		j1939_txq_wait(&txq.q, wait);
+	}
+	return NULL;
+}
+
+/* Send the frames of the CAN_RAW socket from a writer thread */
+int j1939_tx_writer_start(void)
+{
+	if (cansock < 0 || kernel_j1939 || txq.active) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	j1939_txq_init(&txq.q, txq.slots, TXQ_SLOTS);
+	pthread_mutex_init(&txq.bam_lock, NULL);
+	memset(txq.bams, 0, sizeof(txq.bams));
+	txq.stop = false;
+	if (pthread_create(&txq.writer, NULL, txq_writer, NULL) != 0) {
+		return -1;
+	}
+	__atomic_store_n(&txq.active, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Send the frames and the BAMs still queued and stop the writer */
+int j1939_tx_writer_stop(void)
+{
+	if (!txq.active) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	__atomic_store_n(&txq.active, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&txq.stop, true, __ATOMIC_RELEASE);
+	j1939_wake(&txq.q.wake);
+	return pthread_join(txq.writer, NULL);
+}
+
+static int txq_push(uint32_t id, uint8_t *data, uint8_t len)
+{
+	int ret;
+
+	while ((ret = j1939_txq_push(&txq.q, id, data, len)) == -J1939_EBUSY) {
+		j1939_task_yield();
+	}
+	return ret;
+}
+#else
+int j1939_tx_writer_start(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int j1939_tx_writer_stop(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif /* J1939_WITH_TXQ */
+
 int disconnect_canbus(void)
 {
+#if defined(HAVE_LINUX_CAN_J1939_H)
+	for (size_t i = 0; i < 256; i++) {
+		if (tx_sock[i] > 0) {
+			close(tx_sock[i]);
+			tx_sock[i] = 0;
+		}
+	}
+#endif
+#if defined(J1939_WITH_TXQ)
+	if (txq.active) {
+		j1939_tx_writer_stop();
+	}
+#endif
+	kernel_j1939 = false;
 	return close(cansock);
 }
 
@@ -81,11 +1108,19 @@ int j1939_filter(struct j1939_pgn_filter *filter, uint32_t num_filters)
 	struct can_filter rfilter[num_filters];
 	uint32_t id;
 
+#if defined(HAVE_LINUX_CAN_J1939_H)
+	if (kernel_j1939) {
+		return j1939_kernel_filter(filter, num_filters);
+	}
+#endif
+
 	for (size_t i = 0; i < num_filters; i++) {
 		id = j1939_pgn2id(filter[i].pgn, filter[i].priority,
 				  filter[i].addr);
 		rfilter[i].can_id = id | CAN_EFF_FLAG;
-		rfilter[i].can_mask = filter[i].pgn_mask;
+		/* PGN and source address masks into a CAN identifier mask */
+		rfilter[i].can_mask = ((filter[i].pgn_mask & 0x3FFFFu) << 8) |
+				      filter[i].addr_mask | CAN_EFF_FLAG;
 	}
 	return setsockopt(cansock, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter,
 			  sizeof(rfilter));
@@ -96,6 +1131,24 @@ int j1939_cansend(uint32_t id, uint8_t *data, uint8_t len)
 	int ret;
 	struct can_frame frame;
 
+#if defined(HAVE_LINUX_CAN_J1939_H)
+	if (kernel_j1939) {
+		return j1939_kernel_send(id, data, len);
+	}
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H)
+	if (uring.fd >= 0) {
+		return uring_send(uring_bus, id, data, len);
+	}
+#endif
+
+#if defined(J1939_WITH_TXQ)
+	if (__atomic_load_n(&txq.active, __ATOMIC_ACQUIRE)) {
+		return txq_push(id, data, len);
+	}
+#endif
+
 	frame.can_id = id | CAN_EFF_FLAG;
 	frame.can_dlc = len;
 	memcpy(frame.data, data, frame.can_dlc);
@@ -107,11 +1160,69 @@ int j1939_cansend(uint32_t id, uint8_t *data, uint8_t len)
 	return frame.can_dlc;
 }
 
+#if defined(J1939_WITH_TXQ)
+/*
+ * BAM frame sets through the TX writer: the writer sends the announce and
+ * the packets period [msec] apart. The frames queued before may still be
+ * waiting: the announce can leave before them.
+ */
+int j1939_cansend_bam(const uint32_t cm_id, const uint32_t dt_id,
+		      uint8_t (*frames)[8], const uint16_t num_frames,
+		      const uint32_t period)
+{
+	struct txq_bam *b = NULL;
+
+	if (kernel_j1939 ||
+#if defined(HAVE_LINUX_IO_URING_H)
+	    uring.fd >= 0 ||
+#endif
+	    !__atomic_load_n(&txq.active, __ATOMIC_ACQUIRE)) {
+		return -J1939_ENOTSUP;
+	}
+	if (num_frames < 2 || num_frames > 256) {
+		return -J1939_EARGS;
+	}
+
+	pthread_mutex_lock(&txq.bam_lock);
+	for (size_t i = 0; i < TXQ_BAMS; i++) {
+		/* one BAM at a time per source */
+		if (txq.bams[i].busy && txq.bams[i].dt_id == dt_id) {
+			b = NULL;
+			break;
+		}
+		if (!txq.bams[i].busy && b == NULL) {
+			b = &txq.bams[i];
+		}
+	}
+	if (b == NULL) {
+		pthread_mutex_unlock(&txq.bam_lock);
+		return -J1939_EBUSY;
+	}
+	memcpy(b->frames, frames, num_frames * sizeof(frames[0]));
+	b->num_frames = num_frames;
+	b->next = 0;
+	b->cm_id = cm_id;
+	b->dt_id = dt_id;
+	b->period = period;
+	b->busy = true;
+	pthread_mutex_unlock(&txq.bam_lock);
+
+	j1939_txq_kick(&txq.q);
+	return 0;
+}
+#endif
+
 int j1939_canrcv(uint32_t *id, uint8_t *data)
 {
 	int ret;
 	struct can_frame frame;
 
+#if defined(HAVE_LINUX_CAN_J1939_H)
+	if (kernel_j1939) {
+		return j1939_kernel_rcv(id, data);
+	}
+#endif
+
 	ret = xread(cansock, &frame, sizeof(frame));
 	if (ret != sizeof(frame)) {
 		return -1;
@@ -129,7 +1240,79 @@ uint32_t j1939_get_time(void)
 	return tv.tv_sec * 1000 + tv.tv_nsec / 1000000;
 }
 
+uint32_t j1939_get_time_us(void)
+{
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tv);
+	return tv.tv_sec * 1000000u + tv.tv_nsec / 1000u;
+}
+
 void j1939_task_yield(void)
 {
 	pthread_yield();
 }
+
+/* j1939_tp() sleeps on a futex until the receiving thread wakes it up */
+int j1939_wait(int *addr, const int expected, const uint32_t timeout)
+{
+	struct timespec ts = {
+		.tv_sec = timeout / 1000u,
+		.tv_nsec = (timeout % 1000u) * 1000000L,
+	};
+
+	if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, &ts, NULL,
+		    0) < 0 && errno == ETIMEDOUT) {
+		return -J1939_ETIMEOUT;
+	}
+	return 0;
+}
+
+void j1939_wake(int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Warm restart snapshot (see j1939_addr.h), in the file named by
+ * J1939_SNAPSHOT in the environment. It is replaced atomically.
+ */
+int j1939_nv_read(uint8_t *buf, const size_t size)
+{
+	const char *path = getenv("J1939_SNAPSHOT");
+	ssize_t ret;
+	int fd;
+
+	if (path == NULL) {
+		return -J1939_ENOTSUP;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -J1939_ENODATA;
+	}
+	ret = xread(fd, buf, size);
+	close(fd);
+	return ret < 0 ? -J1939_EIO : (int)ret;
+}
+
+int j1939_nv_write(const uint8_t *buf, const size_t len)
+{
+	const char *path = getenv("J1939_SNAPSHOT");
+	char tmp[PATH_MAX];
+	ssize_t ret;
+	int fd;
+
+	if (path == NULL) {
+		return -J1939_ENOTSUP;
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return -J1939_EIO;
+	}
+	ret = xwrite(fd, buf, len);
+	if (close(fd) < 0 || ret != (ssize_t)len || rename(tmp, path) < 0) {
+		unlink(tmp);
+		return -J1939_EIO;
+	}
+	return 0;
+}
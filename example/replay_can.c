@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "j1939.h"
+#include "j1939_log.h"
+#include "can_log.h"
+#include "replay_can.h"
+
+#define REPLAY_MAX_FILTERS 64
+
+enum replay_format {
+	REPLAY_CANDUMP,
+	REPLAY_ASC,
+	REPLAY_BINARY,
+};
+
+static enum replay_format format;
+static FILE *text;
+static struct j1939_log_reader reader;
+
+static struct j1939_pgn_filter filters[REPLAY_MAX_FILTERS];
+static uint32_t num_filters;
+
+static bool eof;
+static bool started;
+static uint64_t first_time;
+static uint32_t now;
+static uint64_t frames;
+static uint64_t sent;
+
+int replay_open(const char *path)
+{
+	char magic[8];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+
+	eof = false;
+	started = false;
+	now = 0;
+	frames = 0;
+	sent = 0;
+
+	if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+	    memcmp(magic, J1939_LOG_MAGIC, sizeof(magic)) == 0) {
+		fclose(f);
+		format = REPLAY_BINARY;
+		return j1939_log_reader_open(&reader, path);
+	}
+
+	rewind(f);
+	text = f;
+	format = strstr(path, ".asc") ? REPLAY_ASC : REPLAY_CANDUMP;
+	return 0;
+}
+
+int replay_close(void)
+{
+	if (format == REPLAY_BINARY) {
+		j1939_log_reader_close(&reader);
+		return 0;
+	}
+	if (text) {
+		fclose(text);
+		text = NULL;
+	}
+	return 0;
+}
+
+bool replay_eof(void)
+{
+	return eof;
+}
+
+uint64_t replay_frames(void)
+{
+	return frames;
+}
+
+uint64_t replay_sent(void)
+{
+	return sent;
+}
+
+static bool next_frame(struct j1939_log_frame *f)
+{
+	char line[256];
+
+	if (format == REPLAY_BINARY) {
+		return j1939_log_next(&reader, f) == 1;
+	}
+
+	while (fgets(line, sizeof(line), text)) {
+		int ret = (format == REPLAY_ASC) ?
+				  can_log_parse_asc(line, f) :
+				  can_log_parse_candump(line, f);
+		if (ret == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool accepted(const uint32_t id)
+{
+	if (num_filters == 0) {
+		return true;
+	}
+
+	for (uint32_t i = 0; i < num_filters; i++) {
+		uint32_t fid = j1939_pgn2id(filters[i].pgn,
+					    filters[i].priority,
+					    filters[i].addr);
+		uint32_t mask = ((filters[i].pgn_mask & 0x3FFFFu) << 8) |
+				filters[i].addr_mask;
+		if (((id ^ fid) & mask) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int j1939_filter(struct j1939_pgn_filter *filter, uint32_t n)
+{
+	if (n > REPLAY_MAX_FILTERS) {
+		return -1;
+	}
+	memcpy(filters, filter, n * sizeof(*filter));
+	num_filters = n;
+	return 0;
+}
+
+int j1939_cansend(uint32_t id, uint8_t *data, uint8_t len)
+{
+	/* nobody is listening on a recorded bus */
+	sent++;
+	return len;
+}
+
+int j1939_canrcv(uint32_t *id, uint8_t *data)
+{
+	struct j1939_log_frame f;
+
+	do {
+		if (eof || !next_frame(&f)) {
+			eof = true;
+			return -1;
+		}
+
+		if (!started) {
+			first_time = f.time;
+			started = true;
+		}
+		now = (uint32_t)((f.time - first_time) / 1000u);
+	} while (!accepted(f.id) || (f.flags & J1939_LOG_FLAG_TX));
+
+	frames++;
+	*id = f.id;
+	memcpy(data, f.data, f.len);
+	return f.len;
+}
+
+uint32_t j1939_get_time(void)
+{
+	return now;
+}
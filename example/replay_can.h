@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __REPLAY_CAN_H__
+#define __REPLAY_CAN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Replay transport
+ *
+ * Implements j1939_canrcv(), j1939_cansend(), j1939_filter() and
+ * j1939_get_time() on top of a recorded log (candump, Vector ASC or the
+ * library binary format), so the PGN dispatch and TP session code can be
+ * run against recorded traffic as fast as the CPU allows.
+ *
+ * j1939_get_time() returns the timestamp of the last frame received, in
+ * milliseconds from the first frame of the log: timeouts expire as they
+ * did on the recorded bus, independently of the replay speed.
+ */
+
+int replay_open(const char *path);
+int replay_close(void);
+
+/** @brief true once the last frame has been received */
+bool replay_eof(void);
+
+/** @brief Number of frames received so far */
+uint64_t replay_frames(void);
+
+/** @brief Number of frames sent by the application (not transmitted) */
+uint64_t replay_sent(void);
+
+#endif /* __REPLAY_CAN_H__ */
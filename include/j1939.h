@@ -20,6 +20,9 @@
 #define J1939_EWRONG_DATA_LEN	104
 #define J1939_ENO_RESOURCE	105
 #define J1939_EIO		106
+#define J1939_ENODATA		107
+#define J1939_ENOTSUP		108
+#define J1939_EABORTED		109
 
 /** @brief indicates that the parameter is "not available" */
 #define J1930_NOT_AVAILABLE_8 0xFFu
@@ -159,6 +162,52 @@ extern int j1939_canrcv(uint32_t *id, uint8_t *data);
 extern int j1939_filter(struct j1939_pgn_filter *filter, uint32_t num_filters);
 extern uint32_t j1939_get_time(void);
 
+/**
+ * @brief Block the calling thread until *addr != expected or timeout
+ *
+ * Used by the blocking j1939_tp() to sleep while waiting for a CTS and
+ * between packets, j1939_wake() is called after updating *addr. Spurious
+ * wakeups are allowed. The library provides a weak busy wait calling
+ * j1939_task_yield(); ports can map it on a futex, a condition variable or
+ * an RTOS semaphore/event flag.
+ *
+ * @param addr wait address
+ * @param expected value of *addr at the time the caller decided to sleep
+ * @param timeout max wait [msec]
+ * @return 0 if woken up, -J1939_ETIMEOUT otherwise
+ */
+extern int j1939_wait(int *addr, const int expected, const uint32_t timeout);
+
+/** @brief Wake up all the threads blocked in j1939_wait() on addr */
+extern void j1939_wake(int *addr);
+
+/**
+ * @brief Transport protocol offload
+ *
+ * Called by j1939_tp() and j1939_tp_bam() for messages longer than 8
+ * bytes. Ports whose CAN driver implements the transport protocol (e.g.
+ * Linux CAN_J1939 sockets) send the whole message and return 0 or a
+ * negative error. The library provides a weak version returning
+ * -J1939_ENOTSUP, that selects the library TP.
+ */
+extern int j1939_tp_offload(const j1939_pgn_t pgn, const uint8_t priority,
+			    const uint8_t src, const uint8_t dst,
+			    uint8_t *data, const uint16_t len);
+
+/**
+ * @brief Queue the frames of a BAM at once
+ *
+ * Called by j1939_tp_frames_send() with the TP.CM announce (frames[0],
+ * identifier cm_id) followed by the TP.DT packets (identifier dt_id).
+ * Ports whose driver can pace the transmission (TX scheduler, timed
+ * mailboxes) queue all the frames, period [msec] apart, and return 0 or a
+ * negative error. The library provides a weak version returning
+ * -J1939_ENOTSUP: the frames are then sent one by one with j1939_send().
+ */
+extern int j1939_cansend_bam(const uint32_t cm_id, const uint32_t dt_id,
+			     uint8_t (*frames)[8], const uint16_t num_frames,
+			     const uint32_t period);
+
 
 bool static inline j1939_valid_priority(const uint8_t p)
 {
@@ -168,12 +217,78 @@ bool static inline j1939_valid_priority(const uint8_t p)
 uint32_t j1939_pgn2id(const j1939_pgn_t pgn, const uint8_t priority,
 		      const uint8_t src);
 
+/**
+ * @brief Split a 29-bit CAN identifier into its J1939 fields
+ *
+ * @param id CAN identifier
+ * @param pgn PGN (destination address removed if peer-to-peer)
+ * @param priority message priority
+ * @param src source address
+ * @param dst destination address, ADDRESS_NULL if broadcast
+ */
+void j1939_id2pgn(const uint32_t id, j1939_pgn_t *pgn, uint8_t *priority,
+		  uint8_t *src, uint8_t *dst);
+
+/**
+ * @brief Split n CAN identifiers into arrays of J1939 fields
+ *
+ * Same result as j1939_id2pgn() on every identifier, computed without
+ * branches, with SSE2/AVX2 when the CPU supports them.
+ *
+ * @param ids CAN identifiers
+ * @param n number of identifiers
+ * @param pgn n PGNs
+ * @param priority n priorities
+ * @param src n source addresses
+ * @param dst n destination addresses
+ */
+void j1939_id2pgn_batch(const uint32_t *ids, const uint32_t n,
+			j1939_pgn_t *pgn, uint8_t *priority, uint8_t *src,
+			uint8_t *dst);
+
+/** @brief Raw frame observer, called for every frame sent or received */
+typedef void (*j1939_frame_hook_t)(uint32_t id, const uint8_t *data,
+				   uint8_t len);
+
+/**
+ * @brief Install frame observers on the receive and transmit paths
+ *
+ * @param rx called by j1939_receive() for every received frame (or NULL)
+ * @param tx called by j1939_send() for every frame to be sent (or NULL)
+ */
+void j1939_set_frame_hooks(j1939_frame_hook_t rx, j1939_frame_hook_t tx);
+
 int j1939_send(const j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 	       const uint8_t dst, uint8_t *data, const uint32_t len);
 
+/**
+ * @brief Read and decode a frame with j1939_canrcv()
+ *
+ * @return frame length, 0 if no frame was read or the port consumed it
+ * (the outputs are not set), negative value in case of error
+ */
 int j1939_receive(j1939_pgn_t *pgn, uint8_t *priority, uint8_t *src,
 		  uint8_t *dst, uint8_t *data, uint32_t *len);
 
+/**
+ * @brief Account a frame received outside j1939_canrcv()
+ *
+ * Same as j1939_receive() for frames already read by the application
+ * (e.g. replayed or queued frames): decode the identifier and run the
+ * receive frame hook.
+ */
+void j1939_receive_frame(const uint32_t id, const uint8_t *data,
+			 const uint8_t len, j1939_pgn_t *pgn,
+			 uint8_t *priority, uint8_t *src, uint8_t *dst);
+
+/**
+ * @brief Account a frame sent outside j1939_send()
+ *
+ * Run the transmit frame hook and the bus load accounting for a frame
+ * handed to the CAN driver by other means (e.g. j1939_cansend_bam()).
+ */
+void j1939_sent_frame(const uint32_t id, uint8_t *data, const uint8_t len);
+
 /**
  * @brief J1939 Transport Protocol (TP)
  *
@@ -208,9 +323,96 @@ int j1939_cannot_claim_address(ecu_name_t name);
 int j1939_send_tp_cts(const uint8_t src, const uint8_t dst,
 		      const uint8_t num_packets, const uint8_t next_packet);
 
+/**
+ * @brief Time out the transport connections being received
+ *
+ * A receiver that got no packet T2 [msec] after a CTS, or T1 after the
+ * previous packet, asks again for the missing packets, up to
+ * J1939_TP_RX_RETRIES times, then aborts the connection (error callback of
+ * j1939_setup() called with -J1939_ETIMEOUT). Call it periodically, e.g.
+ * after every received frame, from the thread dispatching the frames.
+ *
+ * @return number of connections timed out
+ */
+int j1939_tp_poll(void);
+
 int send_tp_bam(const uint8_t priority, const uint8_t src, uint8_t *data,
 		const uint16_t len);
 
+/**
+ * @brief Broadcast a PGN longer than 8 bytes using the BAM transport
+ *
+ * @param pgn PGN announced in the BAM
+ * @param priority PGN priority
+ * @param src source address
+ * @param data array of bytes to be sent
+ * @param len data length (in bytes), up to J1939_MAX_DATA_LEN
+ * @return negative value in case of error, 0 otherwise
+ */
+int j1939_tp_bam(const j1939_pgn_t pgn, const uint8_t priority,
+		 const uint8_t src, uint8_t *data, const uint16_t len);
+
+/** @brief Number of frames of a BAM of _len bytes: announce and packets */
+#define J1939_TP_FRAMES(_len) (1u + ((_len) + 6u) / 7u)
+
+/**
+ * @brief BAM segmented once, sent as many times as needed
+ *
+ * For PGNs broadcast periodically with (mostly) the same payload: the
+ * announce and the padded TP.DT packets are built by j1939_tp_frames_init(),
+ * j1939_tp_frames_update() rewrites only the packets holding the bytes that
+ * changed and j1939_tp_frames_send() transmits the frames as they are.
+ */
+struct j1939_tp_frames {
+	/* TP.CM announce, then TP.DT packets 1..n */
+	uint8_t (*frames)[8];
+	uint16_t num_frames;
+	uint16_t len;
+	uint8_t priority;
+	uint8_t src;
+};
+
+/**
+ * @brief Segment a payload into a BAM frame set
+ *
+ * @param set frame set
+ * @param frames storage of J1939_TP_FRAMES(len) frames
+ * @param max_frames number of frames in storage
+ * @param pgn PGN announced in the BAM
+ * @param priority PGN priority
+ * @param src source address
+ * @param data payload
+ * @param len payload length, 9..J1939_MAX_DATA_LEN
+ * @return 0 on success, -J1939_EARGS if len is out of range or the frames
+ * do not fit in storage
+ */
+int j1939_tp_frames_init(struct j1939_tp_frames *set, uint8_t (*frames)[8],
+			 const uint16_t max_frames, const j1939_pgn_t pgn,
+			 const uint8_t priority, const uint8_t src,
+			 const uint8_t *data, const uint16_t len);
+
+/**
+ * @brief Change part of the payload of a frame set
+ *
+ * @param set frame set
+ * @param offset first payload byte to change
+ * @param data new bytes
+ * @param len number of bytes
+ * @return 0 on success, -J1939_EARGS if the bytes exceed the payload
+ */
+int j1939_tp_frames_update(struct j1939_tp_frames *set, const uint16_t offset,
+			   const uint8_t *data, const uint16_t len);
+
+/**
+ * @brief Broadcast a frame set
+ *
+ * The frames are handed to j1939_cansend_bam() in one call, or sent
+ * SEND_PERIOD apart if the port does not implement it.
+ *
+ * @return negative value in case of error, 0 otherwise
+ */
+int j1939_tp_frames_send(const struct j1939_tp_frames *set);
+
 typedef int (*pgn_callback_t)(j1939_pgn_t pgn, uint8_t priority,
 			      uint8_t src, uint8_t dest,
 			      uint8_t *data, uint8_t len);
@@ -220,6 +422,17 @@ typedef void (*pgn_error_cb_t)(j1939_pgn_t pgn, uint8_t priority,
 			      uint8_t src, uint8_t dest, int err);
 
 int j1939_setup(pgn_callback_t rcv_tp, pgn_error_cb_t err_cb);
+
+/**
+ * @brief Deliver a message reassembled by the CAN driver
+ *
+ * Counterpart of j1939_tp_offload() on the receive side: the message is
+ * passed to the rcv_tp callback of j1939_setup() split in TP.DT packets,
+ * as if received through the library TP.
+ */
+int j1939_tp_received(const uint8_t priority, const uint8_t src,
+		      const uint8_t dst, const uint8_t *data,
+		      const uint16_t len);
 int j1939_dispose(void);
 
 #endif /* __J1939_H__ */
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_ADDR_H__
+#define __J1939_ADDR_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Address claim state and address table, with warm restart
+ *
+ * The NAME claimed by every address is learnt from the Address Claimed
+ * messages (SAE J1939-81) and the state of our own claim is tracked: an
+ * address is ours J1939_ADDR_CLAIM_TIME [msec] after j1939_address_claim()
+ * unless a NAME of higher priority (lower value) claims it.
+ *
+ * Both can be saved in a snapshot and are restored by j1939_setup(): after
+ * a restart the ECU announces its address with j1939_address_claimed() and
+ * talks at once, instead of claiming again and rediscovering the network.
+ * The snapshot is read and written through the j1939_nv_read() and
+ * j1939_nv_write() port hooks (e.g. a file or a RAM region not cleared at
+ * reset), or passed around with j1939_addr_snapshot()/j1939_addr_restore().
+ *
+ * PGN registrations and filters are code, the application sets them up
+ * again; TP sessions are not kept, peers abort them on timeout.
+ *
+ * The table is fed by the Address Claimed handler registered by
+ * j1939_setup(): pgn_register(AC, ...) then fails, the application gets
+ * the Address Claimed messages through j1939_addr_register() instead.
+ *
+ * j1939_setup() and j1939_addr_save() share a static buffer of
+ * J1939_ADDR_SNAPSHOT_MAX bytes, they are not reentrant.
+ */
+
+#define J1939_ADDR_CLAIM_TIME 250u
+
+/** @brief Snapshot header, followed by one entry per known address */
+#define J1939_ADDR_SNAPSHOT_HDR 16u
+#define J1939_ADDR_SNAPSHOT_ENTRY 9u
+#define J1939_ADDR_SNAPSHOT_MAX                                                \
+	(J1939_ADDR_SNAPSHOT_HDR + 254u * J1939_ADDR_SNAPSHOT_ENTRY + 4u)
+
+enum j1939_addr_state {
+	/* no address claimed */
+	J1939_ADDR_NONE,
+	/* claim sent, J1939_ADDR_CLAIM_TIME not elapsed yet */
+	J1939_ADDR_CLAIMING,
+	J1939_ADDR_CLAIMED,
+	/* claimed by a NAME of higher priority */
+	J1939_ADDR_LOST,
+};
+
+/**
+ * @brief Read a snapshot from non-volatile storage (port hook)
+ *
+ * @return number of bytes read, a negative value if there is none
+ */
+extern int j1939_nv_read(uint8_t *buf, const size_t size);
+
+/**
+ * @brief Write a snapshot to non-volatile storage (port hook)
+ *
+ * @return 0 on success, a negative value otherwise
+ */
+extern int j1939_nv_write(const uint8_t *buf, const size_t len);
+
+/**
+ * @brief Reset the address table and restore the last snapshot
+ *
+ * Called by j1939_setup(), registers the Address Claimed handler.
+ *
+ * @return 0 on success, the pgn_register() error otherwise
+ */
+int j1939_addr_init(void);
+
+/**
+ * @brief Application handler of the Address Claimed messages
+ *
+ * Called for every Address Claimed message once the address table is
+ * updated. Reset by j1939_setup().
+ *
+ * @param cb handler, NULL to remove it
+ */
+void j1939_addr_register(pgn_callback_t cb);
+
+/**
+ * @brief State of our address claim
+ *
+ * @param addr our address (can be NULL)
+ * @param name our NAME (can be NULL)
+ */
+enum j1939_addr_state j1939_addr_get(uint8_t *addr, ecu_name_t *name);
+
+/**
+ * @brief Address claimed by a NAME
+ *
+ * @return address, -J1939_ENODATA if the NAME has not been seen
+ */
+int j1939_addr_lookup(const ecu_name_t name);
+
+/**
+ * @brief NAME claiming an address
+ *
+ * @return 0 on success, -J1939_ENODATA if the address has not been claimed
+ */
+int j1939_addr_name(const uint8_t addr, ecu_name_t *name);
+
+/**
+ * @brief Serialize the claim state and address table
+ *
+ * Only a claimed address is saved, with the addresses of the other nodes.
+ *
+ * @param buf buffer, J1939_ADDR_SNAPSHOT_MAX bytes are always enough
+ * @param size buffer size
+ * @return snapshot length, 0 if the buffer is too small
+ */
+size_t j1939_addr_snapshot(uint8_t *buf, const size_t size);
+
+/**
+ * @brief Restore a snapshot taken with j1939_addr_snapshot()
+ *
+ * @return 0 on success, -J1939_EARGS if the snapshot is not valid
+ */
+int j1939_addr_restore(const uint8_t *buf, const size_t len);
+
+/**
+ * @brief Save a snapshot with j1939_nv_write()
+ *
+ * @return 0 on success, a negative value otherwise
+ */
+int j1939_addr_save(void);
+
+/** @brief Update our claim, called by j1939_address_claim() and co. */
+void j1939_addr_claim_update(const uint8_t addr, const ecu_name_t name,
+			     const enum j1939_addr_state state);
+
+#endif /* __J1939_ADDR_H__ */
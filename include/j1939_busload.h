@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_BUSLOAD_H__
+#define __J1939_BUSLOAD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Bus load monitor
+ *
+ * Every frame sent with j1939_send() or received with j1939_receive()/
+ * pgn_pool_dispatch() is accounted with its time on the wire: the bits of
+ * a CAN 2.0B extended data frame, from the start of frame to the end of
+ * the interframe space, including the stuff bits.
+ *
+ * The load is averaged over a sliding window, split in
+ * J1939_BUSLOAD_BUCKETS buckets: the oldest bucket is dropped every
+ * window_ms / J1939_BUSLOAD_BUCKETS [msec]. Besides the whole bus, the load
+ * of up to J1939_BUSLOAD_ENTRIES PGN/source pairs is kept.
+ *
+ * Frames may be accounted from different threads (e.g. the receiving
+ * thread and j1939_tp() senders).
+ */
+
+#ifndef J1939_BUSLOAD_BUCKETS
+#define J1939_BUSLOAD_BUCKETS 10u
+#endif
+
+/** @brief Bits of an extended frame before stuffing (SOF..CRC) */
+#define J1939_FRAME_STUFFED_BITS(_len) (54u + 8u * (_len))
+/** @brief Bits after the CRC: delimiters, ACK, EOF and interframe space */
+#define J1939_FRAME_TAIL_BITS 13u
+
+/**
+ * @brief Bits on the wire of a frame, stuff bits included
+ *
+ * @param id 29-bit CAN identifier
+ * @param data payload
+ * @param len payload length (0..8)
+ */
+uint16_t j1939_frame_bits(const uint32_t id, const uint8_t *data,
+			  const uint8_t len);
+
+/** @brief Bits on the wire of a frame with the most stuff bits possible */
+uint16_t j1939_frame_bits_worst(const uint8_t len);
+
+/**
+ * @brief Start (or restart) the bus load monitor
+ *
+ * @param bitrate bus bitrate [bit/s], 0 to stop the monitor
+ * @param window_ms averaging window [msec], at least J1939_BUSLOAD_BUCKETS
+ * @param worst_case account the worst case stuffing instead of the actual
+ * one (cheaper, pessimistic)
+ * @return 0 on success, -J1939_EARGS otherwise
+ */
+int j1939_busload_setup(const uint32_t bitrate, const uint32_t window_ms,
+			const bool worst_case);
+
+/** @brief Account a frame, called on the library receive/send paths */
+void j1939_busload_frame(const uint32_t id, const uint8_t *data,
+			 const uint8_t len);
+
+/** @brief Bus load over the window [0.01 %] */
+uint32_t j1939_busload(void);
+
+/**
+ * @brief Load of a PGN sent by a source over the window [0.01 %]
+ *
+ * @return 0 on success, -J1939_ENODATA if the pair is not tracked
+ */
+int j1939_busload_pgn(const j1939_pgn_t pgn, const uint8_t src,
+		      uint32_t *load);
+
+#endif /* __J1939_BUSLOAD_H__ */
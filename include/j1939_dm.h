@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_DM_H__
+#define __J1939_DM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Diagnostic messages DM1 (active DTCs) and DM2 (previously active
+ * DTCs) according to SAE J1939-73
+ *
+ * The DTC lists received from every source, as single frames or BAM, are
+ * kept as sorted arrays: a new message is compared with the previous one
+ * in a single merge pass and only the differences are reported.
+ *
+ * Up to J1939_DM_SOURCES sources and J1939_DM_DTCS DTCs per list are kept.
+ */
+
+#define J1939_DM_PGN_DM1 0x00FECAu
+#define J1939_DM_PGN_DM2 0x00FECBu
+
+/** @brief Lamp status (2 bits each) in the lamps field */
+#define J1939_DM_LAMP_PROTECT(_l) (((_l) >> 0) & 0x3u)
+#define J1939_DM_LAMP_AMBER(_l) (((_l) >> 2) & 0x3u)
+#define J1939_DM_LAMP_RED(_l) (((_l) >> 4) & 0x3u)
+#define J1939_DM_LAMP_MIL(_l) (((_l) >> 6) & 0x3u)
+
+/** @brief Diagnostic Trouble Code */
+struct j1939_dtc {
+	uint32_t spn;
+	/* Failure Mode Identifier */
+	uint8_t fmi;
+	/* Occurrence Count */
+	uint8_t oc;
+};
+
+enum j1939_dm_event_type {
+	J1939_DM_DTC_ADDED,
+	J1939_DM_DTC_CLEARED,
+	/* occurrence count changed */
+	J1939_DM_DTC_CHANGED,
+	J1939_DM_LAMPS_CHANGED,
+};
+
+struct j1939_dm_event {
+	/* J1939_DM_PGN_DM1 or J1939_DM_PGN_DM2 */
+	j1939_pgn_t pgn;
+	uint8_t src;
+	enum j1939_dm_event_type type;
+	/* not used by J1939_DM_LAMPS_CHANGED */
+	struct j1939_dtc dtc;
+	/* lamp status (byte 1) and flash (byte 2) */
+	uint16_t lamps;
+};
+
+typedef void (*j1939_dm_cb_t)(const struct j1939_dm_event *event);
+
+/**
+ * @brief Start tracking DM1/DM2
+ *
+ * Registers the DM1/DM2 handlers and two PGN subscriptions (BAM), so it
+ * must be called after j1939_setup().
+ *
+ * @param cb called for every difference from the previous message
+ * @return 0 on success, a negative value otherwise
+ */
+int j1939_dm_setup(j1939_dm_cb_t cb);
+
+/**
+ * @brief Copy the DTCs last reported by a source
+ *
+ * @param pgn J1939_DM_PGN_DM1 or J1939_DM_PGN_DM2
+ * @param src source address
+ * @param dtcs array of max_dtcs entries, sorted by SPN and FMI on return
+ * @param lamps lamp status (can be NULL)
+ * @return number of DTCs, -J1939_ENODATA if nothing has been received
+ */
+int j1939_dm_get(const j1939_pgn_t pgn, const uint8_t src,
+		 struct j1939_dtc *dtcs, const size_t max_dtcs,
+		 uint16_t *lamps);
+
+/** @brief Check if a source reports a DTC as active (DM1) */
+bool j1939_dm_is_active(const uint8_t src, const uint32_t spn,
+			const uint8_t fmi);
+
+/**
+ * @brief Send our DM1
+ *
+ * Up to one DTC fits in a single frame, longer lists are sent with BAM.
+ *
+ * @param src source address
+ * @param lamps lamp status (byte 1) and flash (byte 2)
+ * @param dtcs active DTCs
+ * @param num_dtcs number of DTCs, up to J1939_DM_DTCS
+ * @return negative value in case of error, 0 otherwise
+ */
+int j1939_dm1_send(const uint8_t src, const uint16_t lamps,
+		   const struct j1939_dtc *dtcs, const size_t num_dtcs);
+
+#endif /* __J1939_DM_H__ */
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_FP_H__
+#define __J1939_FP_H__
+
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief NMEA 2000 Fast Packet
+ *
+ * Fast Packet messages carry up to 223 bytes in up to 32 frames of the
+ * message PGN, without any handshake. The first data byte of every frame
+ * holds a 3-bit sequence counter, that tells apart consecutive messages,
+ * and a 5-bit frame counter:
+ *
+ * | frame 0: | seq/frame | length | 6 data bytes |
+ * | frame n: | seq/frame |     7 data bytes      |
+ *
+ * Messages are reassembled in a fixed pool of J1939_FP_SESSIONS contexts,
+ * one per (source, PGN, sequence counter): a missing frame drops the
+ * message, as do T1 [msec] without frames.
+ */
+
+#define J1939_FP_MAX_DATA_LEN 223u
+
+struct j1939_fp_stats {
+	/* messages delivered */
+	uint32_t messages;
+	/* messages dropped because of a missing frame */
+	uint32_t lost;
+	/* messages dropped because of the T1 timeout */
+	uint32_t timeouts;
+	/* messages dropped because all the contexts were in use */
+	uint32_t overruns;
+};
+
+/**
+ * @brief Reset the Fast Packet contexts and statistics
+ *
+ * Must be called after j1939_setup(), before j1939_fp_register().
+ */
+void j1939_fp_setup(void);
+
+/**
+ * @brief Receive a PGN as Fast Packet
+ *
+ * @param pgn PGN
+ * @param cb called with every complete message (up to 223 bytes)
+ * @return 0 on success, a negative value otherwise
+ */
+int j1939_fp_register(const j1939_pgn_t pgn, pgn_callback_t cb);
+int j1939_fp_deregister(const j1939_pgn_t pgn);
+
+/**
+ * @brief Send a Fast Packet message
+ *
+ * Unused bytes of the last frame are set to 0xFF.
+ *
+ * @param pgn PGN
+ * @param priority message priority
+ * @param src source address
+ * @param dst destination address (ignored by PDU2 PGNs)
+ * @param data message
+ * @param len message length (1..223)
+ * @return negative value in case of error, 0 otherwise
+ */
+int j1939_fp_send(const j1939_pgn_t pgn, const uint8_t priority,
+		  const uint8_t src, const uint8_t dst, const uint8_t *data,
+		  const uint8_t len);
+
+void j1939_fp_get_stats(struct j1939_fp_stats *stats);
+
+#endif /* __J1939_FP_H__ */
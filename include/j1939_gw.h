@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_GW_H__
+#define __J1939_GW_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Bus to bus gateway
+ *
+ * Frames received on a bus are matched against a routing table and sent
+ * unchanged (apart from the optional address translation) on the output
+ * buses of the first matching route. Routes are compiled into a value and
+ * a mask on the 29-bit CAN identifier, so frames are forwarded without
+ * decoding the identifier or copying the payload. Frames never go back to
+ * the bus they came from, frames matching no route are dropped.
+ *
+ * With J1939_GW_ROUTE_TP the route matches the PGN carried by TP
+ * connections (RTS or BAM): all the TP.CM/TP.DT frames of a matching
+ * connection are forwarded, the ones from the receiver (CTS, EOM ACK,
+ * abort) back to the input bus.
+ */
+
+#define J1939_GW_MAX_BUSES 32u
+
+/** @brief Keep the source/destination address in j1939_gw_route */
+#define J1939_GW_KEEP_ADDR 0xFFFFu
+
+/** @brief Route TP connections carrying the route PGN (no translation) */
+#define J1939_GW_ROUTE_TP 0x1u
+
+/**
+ * @brief Send a frame on a bus
+ *
+ * Same contract as j1939_cansend(), bus is the index of the function in
+ * the table passed to j1939_gw_setup() (the same function may serve more
+ * buses).
+ */
+typedef int (*j1939_gw_send_t)(uint8_t bus, uint32_t id, uint8_t *data,
+			       uint8_t len);
+
+struct j1939_gw_route {
+	/* bus the frames are received from */
+	uint8_t in_bus;
+	/* bit n set to send on bus n */
+	uint32_t out_buses;
+	/*
+	 * match, as (field & mask) == (value & mask): dst is the PDU
+	 * specific byte of PDU1 PGNs. dst_mask and new_dst are rejected
+	 * unless pgn/pgn_mask only match PDU1 PGNs (PF < 240).
+	 */
+	j1939_pgn_t pgn;
+	j1939_pgn_t pgn_mask;
+	uint8_t src;
+	uint8_t src_mask;
+	uint8_t dst;
+	uint8_t dst_mask;
+	/* address translation, J1939_GW_KEEP_ADDR to keep the address */
+	uint16_t new_src;
+	uint16_t new_dst;
+	/* J1939_GW_ROUTE_* */
+	uint8_t flags;
+};
+
+struct j1939_gw_route_stats {
+	/* frames sent (once per output bus) */
+	uint32_t forwarded;
+	/* frames the output bus did not accept */
+	uint32_t dropped;
+	/*
+	 * reception to send latency [usec], latency_min is UINT32_MAX until
+	 * the first frame
+	 */
+	uint32_t latency_min;
+	uint32_t latency_max;
+	uint64_t latency_sum;
+	/* frames in latency_sum, once per frame whatever the output buses */
+	uint32_t latency_samples;
+};
+
+/**
+ * @brief Time in microseconds, used for the latency counters
+ *
+ * The library provides a weak version based on j1939_get_time().
+ */
+extern uint32_t j1939_get_time_us(void);
+
+/**
+ * @brief Set the buses and compile the routing table
+ *
+ * The tables are copied: the gateway can be set up again at any time
+ * while no frame is being forwarded.
+ *
+ * @param buses send function of every bus
+ * @param num_buses number of buses, up to J1939_GW_MAX_BUSES
+ * @param routes routing table, the first matching route is used
+ * @param num_routes number of routes, up to J1939_GW_ROUTES
+ * @return 0 on success, -J1939_EARGS for invalid routes,
+ * -J1939_ENO_RESOURCE if the table is too large
+ */
+int j1939_gw_setup(const j1939_gw_send_t *buses, const size_t num_buses,
+		   const struct j1939_gw_route *routes,
+		   const size_t num_routes);
+
+/**
+ * @brief Forward a frame received on a bus
+ *
+ * @param bus input bus
+ * @param id CAN identifier
+ * @param data payload
+ * @param len payload length
+ * @param rx_time reception time (j1939_get_time_us()), 0 if unknown
+ * @return number of buses the frame was sent to, a negative value if a
+ * send failed
+ */
+int j1939_gw_forward(const uint8_t bus, uint32_t id, uint8_t *data,
+		     const uint8_t len, uint32_t rx_time);
+
+/**
+ * @brief Counters of a route
+ *
+ * @return 0 on success, -J1939_EARGS if the route does not exist
+ */
+int j1939_gw_get_stats(const size_t route, struct j1939_gw_route_stats *st);
+
+/** @brief Frames received matching no route */
+uint32_t j1939_gw_unrouted(void);
+
+void j1939_gw_reset_stats(void);
+
+#endif /* __J1939_GW_H__ */
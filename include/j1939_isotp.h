@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_ISOTP_H__
+#define __J1939_ISOTP_H__
+
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief ISO 15765-2 transport (ISO-TP) with normal fixed addressing
+ *
+ * Messages up to 4095 bytes are carried in 29-bit frames of the
+ * physical (0xDA00) or functional (0xDB00) PGN, with the target and
+ * source addresses in the identifier (e.g. 0x18DAF100):
+ *
+ * | Single Frame      | 0x0 | len [4]   | up to 7 data bytes      |
+ * | First Frame       | 0x1 | len [12]              | 6 data bytes |
+ * | Consecutive Frame | 0x2 | SN [4]    | 7 data bytes            |
+ * | Flow Control      | 0x3 | FS [4]    | BS | STmin              |
+ *
+ * Unlike J1939 TP the sender is paced by the receiver only: with a block
+ * size of 0 and a STmin of 0 the whole message is sent back to back after
+ * the first Flow Control.
+ *
+ * Transfers use the J1939 session table (one session per source and
+ * destination address, shared with j1939_tp()) and j1939_wait() to wait
+ * for Flow Control frames.
+ */
+
+#define J1939_ISOTP_PGN_PHYS 0x00DA00u
+#define J1939_ISOTP_PGN_FUNC 0x00DB00u
+
+#define J1939_ISOTP_MAX_DATA_LEN 4095u
+
+/** @brief Flow Control parameters sent by the receiver */
+struct j1939_isotp_config {
+	/* Consecutive Frames between Flow Controls, 0 for no limit */
+	uint8_t block_size;
+	/*
+	 * minimum gap between Consecutive Frames: 0x00..0x7F [msec],
+	 * 0xF1..0xF9 100..900 [usec]
+	 */
+	uint8_t st_min;
+};
+
+/**
+ * @brief Message received
+ *
+ * @param pgn J1939_ISOTP_PGN_PHYS or J1939_ISOTP_PGN_FUNC
+ * @param src source address
+ * @param dst target address
+ * @param data message
+ * @param len message length
+ */
+typedef void (*j1939_isotp_cb_t)(j1939_pgn_t pgn, uint8_t src, uint8_t dst,
+				 const uint8_t *data, uint16_t len);
+
+/**
+ * @brief Register the ISO-TP handlers
+ *
+ * Must be called after j1939_setup().
+ *
+ * @param cfg Flow Control parameters, NULL for block size and STmin 0
+ * @return 0 on success, a negative value otherwise
+ */
+int j1939_isotp_setup(const struct j1939_isotp_config *cfg);
+
+/**
+ * @brief Receive the messages sent to addr
+ *
+ * Physical messages are received only by bound addresses, functional
+ * messages (single frame only) are delivered to every binding.
+ *
+ * @return 0 on success, -J1939_ENO_RESOURCE if too many addresses are
+ * bound
+ */
+int j1939_isotp_bind(const uint8_t addr, j1939_isotp_cb_t cb);
+
+/**
+ * @brief Send a message, blocking until the last frame is sent
+ *
+ * @param pgn J1939_ISOTP_PGN_PHYS or J1939_ISOTP_PGN_FUNC (single frame)
+ * @param src source address
+ * @param dst target address
+ * @param data message
+ * @param len message length (1..4095)
+ * @return 0 on success, -J1939_ETIMEOUT if no Flow Control is received,
+ * -J1939_ENO_RESOURCE if the receiver reports an overflow, another
+ * negative value otherwise
+ */
+int j1939_isotp_send(const j1939_pgn_t pgn, const uint8_t src,
+		     const uint8_t dst, const uint8_t *data,
+		     const uint16_t len);
+
+#endif /* __J1939_ISOTP_H__ */
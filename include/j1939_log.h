@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_LOG_H__
+#define __J1939_LOG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Compact binary frame log
+ *
+ * The file starts with a J1939_LOG_HDR_SIZE bytes header followed by
+ * blocks of J1939_LOG_BLOCK_SIZE bytes. Every block holds a header with
+ * the time span of its frames and a bitmap of the PGNs it contains, so a
+ * reader can binary search a time range and skip blocks not holding the
+ * requested PGNs without decoding them.
+ *
+ * Frames are stored as:
+ *
+ * | delta time [us] | ID + flags | DLC (optional) | payload |
+ * |  varint, 1..5   |  4 bytes   |    1 byte      | 0..8    |
+ *
+ * All the fields are little-endian.
+ */
+
+#define J1939_LOG_MAGIC "J1939LOG"
+#define J1939_LOG_VERSION 1u
+#define J1939_LOG_HDR_SIZE 64u
+
+#ifndef J1939_LOG_BLOCK_SIZE
+#define J1939_LOG_BLOCK_SIZE 65536u
+#endif
+
+#define J1939_LOG_BLOCK_MAGIC 0x4B4C424Au /*<! "JBLK" */
+#define J1939_LOG_PGN_MAP_BITS 1024u
+#define J1939_LOG_BLOCK_HDR_SIZE (32u + J1939_LOG_PGN_MAP_BITS / 8u)
+
+/** @brief frame was sent by this node */
+#define J1939_LOG_FLAG_TX 0x1u
+
+struct j1939_log_frame {
+	/* timestamp [us] */
+	uint64_t time;
+	/* 29-bit CAN identifier */
+	uint32_t id;
+	uint8_t flags;
+	uint8_t len;
+	uint8_t data[8];
+};
+
+struct j1939_log_writer {
+	int fd;
+	uint64_t block_off;
+	uint64_t last_time;
+	uint32_t nrec;
+	uint32_t used;
+	uint8_t block[J1939_LOG_BLOCK_SIZE];
+};
+
+/** @brief Restrict the frames returned by j1939_log_next() */
+struct j1939_log_query {
+	/* time range [us], inclusive */
+	uint64_t t_start;
+	uint64_t t_end;
+	/* PGNs to return, all the PGNs if num_pgns is 0 */
+	const j1939_pgn_t *pgns;
+	size_t num_pgns;
+};
+
+struct j1939_log_reader {
+	const uint8_t *base;
+	size_t size;
+	/* first block of the reader (see j1939_log_reader_slice()) */
+	const uint8_t *blocks;
+	size_t nblocks;
+	bool mapped;
+	struct j1939_log_query query;
+	/* bitmap of the PGNs in the query */
+	uint8_t pgn_map[J1939_LOG_PGN_MAP_BITS / 8u];
+	size_t block;
+	const uint8_t *rec;
+	const uint8_t *rec_end;
+	uint32_t rec_left;
+	uint64_t time;
+};
+
+/**
+ * @brief Create (or truncate) a log file
+ *
+ * @param w writer
+ * @param path file name
+ * @return 0 on success, -J1939_EIO otherwise
+ */
+int j1939_log_open(struct j1939_log_writer *w, const char *path);
+
+/**
+ * @brief Append a frame to the log
+ *
+ * @param w writer
+ * @param time timestamp [us], must not decrease between calls
+ * @param id CAN identifier
+ * @param flags J1939_LOG_FLAG_*
+ * @param data payload
+ * @param len payload length (0..8)
+ * @return 0 on success, a negative value otherwise
+ */
+int j1939_log_append(struct j1939_log_writer *w, uint64_t time, uint32_t id,
+		     uint8_t flags, const uint8_t *data, uint8_t len);
+
+/**
+ * @brief Write the current (partial) block to the file
+ *
+ * Frames appended later are added to the same block, that is rewritten
+ * on the next flush.
+ */
+int j1939_log_flush(struct j1939_log_writer *w);
+
+int j1939_log_close(struct j1939_log_writer *w);
+
+/**
+ * @brief Log every frame received/sent through j1939_receive()/j1939_send()
+ *
+ * Frames are timestamped with the system real time clock.
+ *
+ * @param w writer, NULL to stop logging
+ */
+void j1939_log_attach(struct j1939_log_writer *w);
+
+/**
+ * @brief Map a log file for reading
+ *
+ * @param r reader
+ * @param path file name
+ * @return 0 on success, -J1939_EIO or -J1939_EARGS for invalid files
+ */
+int j1939_log_reader_open(struct j1939_log_reader *r, const char *path);
+
+/**
+ * @brief Map a log already in memory
+ */
+int j1939_log_reader_init(struct j1939_log_reader *r, const uint8_t *base,
+			  const size_t size);
+
+void j1939_log_reader_close(struct j1939_log_reader *r);
+
+/**
+ * @brief Create a reader limited to a range of blocks
+ *
+ * Slices share the mapping of the parent reader, that must outlive them.
+ * They can be used concurrently from different threads.
+ *
+ * @param slice reader to initialize
+ * @param r parent reader
+ * @param first first block
+ * @param num number of blocks
+ * @return 0 on success, -J1939_EARGS if the range is not in the log
+ */
+int j1939_log_reader_slice(struct j1939_log_reader *slice,
+			   const struct j1939_log_reader *r, const size_t first,
+			   const size_t num);
+
+/**
+ * @brief Restart reading from the first frame matching the query
+ *
+ * Blocks are located by binary search on their time span.
+ *
+ * @param r reader
+ * @param q query, NULL to read the whole log
+ */
+void j1939_log_seek(struct j1939_log_reader *r,
+		    const struct j1939_log_query *q);
+
+/**
+ * @brief Get the next frame matching the query
+ *
+ * @return 1 if a frame is returned, 0 at the end of the log/time range
+ */
+int j1939_log_next(struct j1939_log_reader *r, struct j1939_log_frame *f);
+
+#endif /* __J1939_LOG_H__ */
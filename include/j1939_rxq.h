@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_RXQ_H__
+#define __J1939_RXQ_H__
+
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Interrupt driven reception
+ *
+ * The CAN RX interrupt copies the frame from the controller mailbox with
+ * j1939_rxq_push_isr(), in constant time and without locks, and a task
+ * dispatches the queued frames to the PGN pool with j1939_process().
+ *
+ * The queue is a single-producer, single-consumer ring of J1939_RXQ_SIZE
+ * frames (a power of two): only one interrupt (or thread) may push and
+ * only one task may process. Frames arriving while it is full are dropped
+ * and counted.
+ */
+
+struct j1939_rxq_stats {
+	/* frames queued */
+	uint32_t frames;
+	/* frames dropped because the queue was full */
+	uint32_t overruns;
+	/* max number of frames waiting at the same time */
+	uint32_t high_water;
+};
+
+/**
+ * @brief Queue a received frame, from the CAN RX interrupt
+ *
+ * @param id CAN identifier
+ * @param data payload
+ * @param len payload length (0..8)
+ * @return 0 on success, -J1939_EBUSY if the queue is full
+ */
+int j1939_rxq_push_isr(const uint32_t id, const uint8_t *data,
+		       const uint8_t len);
+
+/**
+ * @brief Dispatch the queued frames, from a task
+ *
+ * Frames are dispatched as pgn_pool_receive() does, in arrival order.
+ *
+ * @param max max number of frames to dispatch, 0 for all the frames
+ * queued
+ * @return number of frames dispatched
+ */
+uint32_t j1939_process(const uint32_t max);
+
+/** @brief Number of frames waiting for j1939_process() */
+uint32_t j1939_rxq_pending(void);
+
+/** @brief Get the queue statistics */
+void j1939_rxq_get_stats(struct j1939_rxq_stats *stats);
+
+#endif /* __J1939_RXQ_H__ */
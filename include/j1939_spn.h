@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_SPN_H__
+#define __J1939_SPN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Suspect Parameter Number (SPN) decoding according to SAE J1939-71
+ *
+ * Every SPN is described by its position inside the PGN payload, its length
+ * in bits and the linear conversion from raw to engineering units:
+ *
+ *     value = raw * scale + offset
+ *
+ * Raw values above the valid range are not data but indicators, the ones
+ * between the valid range and the error indicator are reserved and
+ * reported as errors as well:
+ *
+ * | Length | Valid          | Error (not valid)  | Not available      |
+ * |--------|----------------|--------------------|--------------------|
+ * |  2 bit | 0..1           | 2                  | 3                  |
+ * |  4 bit | 0..0xD         | 0xE                | 0xF                |
+ * |  8 bit | 0..0xFA        | 0xFE               | 0xFF               |
+ * | 16 bit | 0..0xFAFF      | 0xFE00..0xFEFF     | 0xFF00..0xFFFF     |
+ * | 32 bit | 0..0xFAFFFFFF  | 0xFE000000..       | 0xFF000000..       |
+ */
+
+#define J1939_SPN_MAX_BITS 32u
+
+/** @brief Signal status, ordered so that it can be computed branchless */
+enum j1939_spn_status {
+	J1939_SPN_VALID = 0,
+	J1939_SPN_ERROR = 1,
+	J1939_SPN_NOT_AVAILABLE = 2,
+};
+
+/** @brief Bit position from the SAE "byte.bit" notation (both 1-based) */
+#define J1939_SPN_POS(_byte, _bit) ((((_byte) - 1u) * 8u) + ((_bit) - 1u))
+
+/** @brief Lowest raw value flagged as "not available" (J1930_NA_*) */
+#define J1939_SPN_NA(_len)                                                     \
+	((_len) >= 8u ? (0xFFu << ((_len) - 8u)) :                             \
+	 (_len) > 1u ? ((1u << (_len)) - 1u) : 0xFFFFFFFFu)
+
+/** @brief Highest valid raw value */
+#define J1939_SPN_MAX(_len)                                                    \
+	((_len) >= 8u ? (0xFBu << ((_len) - 8u)) - 1u :                        \
+	 (_len) > 1u ? ((1u << (_len)) - 3u) : 1u)
+
+/** @brief Lowest raw value flagged as "error" (J1930_NV_*) */
+#define J1939_SPN_NV(_len)                                                     \
+	((_len) >= 8u ? (0xFEu << ((_len) - 8u)) :                             \
+	 (_len) > 1u ? ((1u << (_len)) - 2u) : 0xFFFFFFFFu)
+
+struct j1939_spn_def {
+	uint32_t spn;
+	/* zero based bit offset inside the little-endian payload */
+	uint16_t start_bit;
+	/* length in bits, 1..J1939_SPN_MAX_BITS */
+	uint8_t length;
+	/* raw > max (reserved or error) is reported as J1939_SPN_ERROR */
+	uint32_t max;
+	/* raw >= na is reported as J1939_SPN_NOT_AVAILABLE */
+	uint32_t na;
+	float scale;
+	float offset;
+};
+
+/**
+ * @brief Initialize an SPN definition using the standard NA/error ranges
+ *
+ * @param _spn SPN number
+ * @param _start zero based start bit (see J1939_SPN_POS())
+ * @param _len length in bits
+ * @param _scale resolution per bit
+ * @param _offset value offset
+ */
+#define J1939_SPN_DEF(_spn, _start, _len, _scale, _offset)                     \
+	{                                                                      \
+		.spn = (_spn), .start_bit = (_start), .length = (_len),        \
+		.max = J1939_SPN_MAX(_len), .na = J1939_SPN_NA(_len),          \
+		.scale = (_scale), .offset = (_offset),                        \
+	}
+
+/** @brief All the SPNs carried by a single PGN */
+struct j1939_spn_pgn {
+	j1939_pgn_t pgn;
+	/* expected payload length in bytes */
+	uint16_t len;
+	const struct j1939_spn_def *spns;
+	size_t num_spns;
+};
+
+/**
+ * @brief Lookup a PGN inside a definition table
+ *
+ * @param table definitions sorted by ascending PGN
+ * @param num number of entries in the table
+ * @param pgn PGN to look for
+ * @return the PGN definition or NULL if the PGN is unknown
+ */
+const struct j1939_spn_pgn *j1939_spn_find(const struct j1939_spn_pgn *table,
+					   const size_t num,
+					   const j1939_pgn_t pgn);
+
+/**
+ * @brief Extract the raw value of a single SPN
+ *
+ * @param def SPN definition
+ * @param data PGN payload
+ * @param len payload length (in bytes)
+ * @param raw extracted raw value
+ * @return -J1939_EWRONG_DATA_LEN if the SPN lies outside the payload,
+ *         0 otherwise
+ */
+int j1939_spn_raw(const struct j1939_spn_def *def, const uint8_t *data,
+		  const uint32_t len, uint32_t *raw);
+
+/**
+ * @brief Decode all the SPNs of a PGN in a single pass
+ *
+ * Signals reported as error or not available get NAN as value.
+ *
+ * @param pgn PGN definition
+ * @param data PGN payload
+ * @param len payload length (in bytes)
+ * @param values output array, one element per SPN in the definition
+ * @param status output array (may be NULL), one element per SPN
+ * @return number of decoded SPNs, -J1939_EARGS or -J1939_EWRONG_DATA_LEN
+ *         in case of error
+ */
+int j1939_spn_decode(const struct j1939_spn_pgn *pgn, const uint8_t *data,
+		     const uint32_t len, float *values, uint8_t *status);
+
+/**
+ * @brief Decode a batch of single frame PGNs into columnar arrays
+ *
+ * Every column holds the values of one SPN for all the frames, so that
+ * consumers can process them with vector instructions. The inner loop is
+ * branch free and auto-vectorizable.
+ *
+ * @param pgn PGN definition (must fit in 8 bytes)
+ * @param frames array of nframes payloads of 8 bytes each
+ * @param nframes number of frames
+ * @param values one column of nframes elements per SPN
+ * @param status one column of nframes elements per SPN (may be NULL)
+ * @return number of decoded frames, -J1939_EARGS in case of error
+ */
+int j1939_spn_decode_batch(const struct j1939_spn_pgn *pgn,
+			   const uint8_t (*frames)[8], const size_t nframes,
+			   float *const *values, uint8_t *const *status);
+
+#endif /* __J1939_SPN_H__ */
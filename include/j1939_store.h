@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_STORE_H__
+#define __J1939_STORE_H__
+
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Latest value store
+ *
+ * The last payload received for every source of the tracked PGNs is kept
+ * by the library, updated by the thread dispatching the frames (e.g.
+ * calling pgn_pool_receive()). Any number of threads can read it at the
+ * same time: every entry is protected by a sequence lock, so readers never
+ * block the receiving thread, they retry if an update happened while they
+ * were copying the entry.
+ *
+ * The store holds up to J1939_STORE_SIZE PGN/source pairs and is shared by
+ * all the threads, also when the library is built with
+ * J1939_THREAD_LOCAL_STATE: only one thread must dispatch tracked PGNs.
+ */
+
+struct j1939_store_value {
+	uint8_t data[8];
+	uint8_t len;
+	/* j1939_get_time() at reception [msec] */
+	uint32_t time;
+	/* time elapsed since reception [msec] */
+	uint32_t age;
+};
+
+/**
+ * @brief Keep the latest value of a PGN
+ *
+ * Must be called before dispatching frames, from the receiving thread.
+ *
+ * @return 0 on success, -J1939_ENO_RESOURCE if PGN_POOL_SIZE PGNs are
+ * already tracked
+ */
+int j1939_store_track(const j1939_pgn_t pgn);
+
+/**
+ * @brief Read the latest value of a PGN sent by a source
+ *
+ * Lock-free, may be called from any thread.
+ *
+ * @return 0 on success, -J1939_ENODATA if nothing has been received yet
+ */
+int j1939_store_read(const j1939_pgn_t pgn, const uint8_t src,
+		     struct j1939_store_value *value);
+
+/** @brief Update the store, called by the PGN dispatcher */
+void j1939_store_update(const j1939_pgn_t pgn, const uint8_t src,
+			const uint8_t *data, const uint8_t len);
+
+#endif /* __J1939_STORE_H__ */
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef __J1939_TXQ_H__
+#define __J1939_TXQ_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "j1939.h"
+
+/**
+ * @brief Multi-producer, single-consumer transmit queue
+ *
+ * Any number of threads (TP senders, the receiving thread answering with
+ * CTS/EOM ACK) queue frames without locks and a single writer drains them
+ * to the CAN interface in batches. Frames leave in the order their
+ * producers reserved a slot.
+ *
+ * The queue is a ring of a power of two slots, every slot carries a
+ * sequence number telling the producers if it is free and the writer if
+ * it has been filled (D. Vyukov's bounded queue).
+ */
+
+struct j1939_txq_frame {
+	/* sequence number, for the queue only */
+	int seq;
+	uint32_t id;
+	uint8_t len;
+	uint8_t data[8];
+};
+
+struct j1939_txq {
+	struct j1939_txq_frame *slots;
+	uint32_t mask;
+	/* next slot to fill, shared by the producers */
+	int head;
+	/* next slot to send, owned by the writer */
+	int tail;
+	/* bumped on every frame queued while the writer waits */
+	int wake;
+	int waiting;
+};
+
+/**
+ * @brief Initialize a queue
+ *
+ * @param q queue
+ * @param slots array of num_slots frames
+ * @param num_slots size of the ring, a power of two
+ * @return 0 on success, -J1939_EARGS otherwise
+ */
+int j1939_txq_init(struct j1939_txq *q, struct j1939_txq_frame *slots,
+		   const uint32_t num_slots);
+
+/**
+ * @brief Queue a frame, from any thread
+ *
+ * @return len on success, -J1939_EBUSY if the queue is full
+ */
+int j1939_txq_push(struct j1939_txq *q, const uint32_t id,
+		   const uint8_t *data, const uint8_t len);
+
+/**
+ * @brief Wake the writer up without queuing a frame, from any thread
+ *
+ * E.g. when the writer has other work than the queue.
+ */
+void j1939_txq_kick(struct j1939_txq *q);
+
+/**
+ * @brief Take the frames queued so far, from the writer thread only
+ *
+ * @param q queue
+ * @param frames array of max frames, in queue order on return
+ * @param max max number of frames
+ * @return number of frames
+ */
+size_t j1939_txq_pop(struct j1939_txq *q, struct j1939_txq_frame *frames,
+		     const size_t max);
+
+/**
+ * @brief Wait for frames, from the writer thread only
+ *
+ * Sleeps with j1939_wait() if the queue is empty.
+ *
+ * @param q queue
+ * @param timeout max wait [msec]
+ */
+void j1939_txq_wait(struct j1939_txq *q, const uint32_t timeout);
+
+#endif /* __J1939_TXQ_H__ */
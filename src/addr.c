@@ -0,0 +1,319 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Address claim state and address table
+ *
+ * Snapshot layout, multi-byte fields little-endian:
+ *
+ * | "J1AS" | version | our address | state | entries | our NAME |
+ * |   4    |    1    |      1      |   1   |    1    |    8     |
+ *
+ * followed by entries x | address (1) | NAME (8) | and a CRC-32 of all the
+ * previous bytes.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "compiler.h"
+#include "config.h"
+#include "j1939.h"
+#include "j1939_addr.h"
+#include "j1939_time.h"
+#include "pgn.h"
+#include "pgn_pool.h"
+
+#define SNAPSHOT_MAGIC "J1AS"
+#define SNAPSHOT_VERSION 1u
+#define NUM_ADDR 254u
+
+static __j1939_state uint64_t names[NUM_ADDR];
+static __j1939_state uint32_t known[(NUM_ADDR + 31u) / 32u];
+
+static __j1939_state struct {
+	enum j1939_addr_state state;
+	uint8_t addr;
+	ecu_name_t name;
+	uint32_t claim_time;
+} own;
+
+/* Address Claimed handler of the application */
+static __j1939_state pgn_callback_t user_ac_cb;
+
+/* j1939_setup() and j1939_addr_save() only, not worth their stack */
+static __j1939_state uint8_t snapshot[J1939_ADDR_SNAPSHOT_MAX];
+
+__weak int j1939_nv_read(uint8_t *buf, const size_t size)
+{
+	return -J1939_ENOTSUP;
+}
+
+__weak int j1939_nv_write(const uint8_t *buf, const size_t len)
+{
+	return -J1939_ENOTSUP;
+}
+
+static inline bool is_known(const uint8_t addr)
+{
+	return (known[addr / 32u] & (1u << (addr % 32u))) != 0;
+}
+
+static inline void set_known(const uint8_t addr, const bool set)
+{
+	if (set) {
+		known[addr / 32u] |= 1u << (addr % 32u);
+	} else {
+		known[addr / 32u] &= ~(1u << (addr % 32u));
+	}
+}
+
+static void forget_name(const uint64_t name)
+{
+	for (uint32_t a = 0; a < NUM_ADDR; a++) {
+		if (is_known(a) && names[a] == name) {
+			set_known(a, false);
+		}
+	}
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+	for (size_t i = 0; i < 8; i++, v >>= 8) {
+		p[i] = v & 0xFFu;
+	}
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	uint64_t v = 0;
+
+	for (size_t i = 8; i > 0; i--) {
+		v = (v << 8) | p[i - 1];
+	}
+	return v;
+}
+
+/* J1939-81: NAMEs are sent least significant byte first */
+static uint64_t get_name(const uint8_t *data)
+{
+	return get_le64(data);
+}
+
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFFu;
+
+	while (len--) {
+		crc ^= *p++;
+		for (size_t i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+		}
+	}
+	return ~crc;
+}
+
+static void defend(void)
+{
+	j1939_address_claimed(own.addr, own.name);
+}
+
+static int address_claimed(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+			   uint8_t dest, uint8_t *data, uint8_t len)
+{
+	uint64_t name;
+
+	if (len < 8) {
+		goto forward;
+	}
+	name = get_name(data);
+
+	/* the NAME moved, or could not claim any address */
+	forget_name(name);
+	if (src >= NUM_ADDR) {
+		goto forward;
+	}
+	names[src] = name;
+	set_known(src, true);
+
+	if ((own.state == J1939_ADDR_CLAIMING ||
+	     own.state == J1939_ADDR_CLAIMED) &&
+	    src == own.addr && name != own.name.value) {
+		/* the lowest NAME wins the address */
+		if (name < own.name.value) {
+			own.state = J1939_ADDR_LOST;
+		} else {
+			defend();
+		}
+	}
+forward:
+	if (user_ac_cb) {
+		return user_ac_cb(pgn, priority, src, dest, data, len);
+	}
+	return 0;
+}
+
+int j1939_addr_init(void)
+{
+	int len;
+	int ret;
+
+	memset(known, 0, sizeof(known));
+	memset(&own, 0, sizeof(own));
+	own.state = J1939_ADDR_NONE;
+	own.addr = ADDRESS_NOT_CLAIMED;
+	user_ac_cb = NULL;
+
+	ret = pgn_register(AC, 0, address_claimed);
+	if (ret < 0) {
+		return ret;
+	}
+
+	len = j1939_nv_read(snapshot, sizeof(snapshot));
+	if (len > 0) {
+		j1939_addr_restore(snapshot, (size_t)len);
+	}
+	return 0;
+}
+
+void j1939_addr_register(pgn_callback_t cb)
+{
+	user_ac_cb = cb;
+}
+
+void j1939_addr_claim_update(const uint8_t addr, const ecu_name_t name,
+			     const enum j1939_addr_state state)
+{
+	/* announcing an address already claimed does not restart the claim */
+	if (state == J1939_ADDR_CLAIMED && own.state == J1939_ADDR_CLAIMING &&
+	    own.addr == addr && own.name.value == name.value) {
+		return;
+	}
+	own.addr = addr;
+	own.name = name;
+	own.state = state;
+	own.claim_time = j1939_get_time();
+}
+
+enum j1939_addr_state j1939_addr_get(uint8_t *addr, ecu_name_t *name)
+{
+	if (own.state == J1939_ADDR_CLAIMING &&
+	    elapsed(own.claim_time, J1939_ADDR_CLAIM_TIME)) {
+		own.state = J1939_ADDR_CLAIMED;
+	}
+	if (addr) {
+		*addr = own.addr;
+	}
+	if (name) {
+		*name = own.name;
+	}
+	return own.state;
+}
+
+int j1939_addr_lookup(const ecu_name_t name)
+{
+	for (uint32_t a = 0; a < NUM_ADDR; a++) {
+		if (is_known(a) && names[a] == name.value) {
+			return (int)a;
+		}
+	}
+	return -J1939_ENODATA;
+}
+
+int j1939_addr_name(const uint8_t addr, ecu_name_t *name)
+{
+	if (addr >= NUM_ADDR || !is_known(addr)) {
+		return -J1939_ENODATA;
+	}
+	if (name) {
+		name->value = names[addr];
+	}
+	return 0;
+}
+
+size_t j1939_addr_snapshot(uint8_t *buf, const size_t size)
+{
+	const bool claimed = j1939_addr_get(NULL, NULL) == J1939_ADDR_CLAIMED;
+	size_t n = J1939_ADDR_SNAPSHOT_HDR;
+	uint8_t entries = 0;
+	uint32_t crc;
+
+	if (IS_NULL(buf) || size < J1939_ADDR_SNAPSHOT_HDR + 4u) {
+		return 0;
+	}
+
+	for (uint32_t a = 0; a < NUM_ADDR; a++) {
+		if (!is_known(a) || (claimed && a == own.addr)) {
+			continue;
+		}
+		if (n + J1939_ADDR_SNAPSHOT_ENTRY + 4u > size) {
+			return 0;
+		}
+		buf[n] = (uint8_t)a;
+		put_le64(&buf[n + 1], names[a]);
+		n += J1939_ADDR_SNAPSHOT_ENTRY;
+		entries++;
+	}
+
+	memcpy(buf, SNAPSHOT_MAGIC, 4);
+	buf[4] = SNAPSHOT_VERSION;
+	buf[5] = claimed ? own.addr : ADDRESS_NOT_CLAIMED;
+	buf[6] = claimed ? J1939_ADDR_CLAIMED : J1939_ADDR_NONE;
+	buf[7] = entries;
+	put_le64(&buf[8], claimed ? own.name.value : 0);
+
+	crc = crc32(buf, n);
+	for (size_t i = 0; i < 4; i++) {
+		buf[n++] = (crc >> (8 * i)) & 0xFFu;
+	}
+	return n;
+}
+
+int j1939_addr_restore(const uint8_t *buf, const size_t len)
+{
+	size_t n;
+	uint32_t crc = 0;
+
+	if (IS_NULL(buf) || len < J1939_ADDR_SNAPSHOT_HDR + 4u ||
+	    memcmp(buf, SNAPSHOT_MAGIC, 4) != 0 ||
+	    buf[4] != SNAPSHOT_VERSION) {
+		return -J1939_EARGS;
+	}
+	n = J1939_ADDR_SNAPSHOT_HDR + buf[7] * J1939_ADDR_SNAPSHOT_ENTRY;
+	if (len < n + 4u) {
+		return -J1939_EARGS;
+	}
+	for (size_t i = 0; i < 4; i++) {
+		crc |= (uint32_t)buf[n + i] << (8 * i);
+	}
+	if (crc != crc32(buf, n)) {
+		return -J1939_EARGS;
+	}
+
+	memset(known, 0, sizeof(known));
+	for (size_t off = J1939_ADDR_SNAPSHOT_HDR; off < n;
+	     off += J1939_ADDR_SNAPSHOT_ENTRY) {
+		if (buf[off] < NUM_ADDR) {
+			names[buf[off]] = get_le64(&buf[off + 1]);
+			set_known(buf[off], true);
+		}
+	}
+
+	if (buf[6] == J1939_ADDR_CLAIMED && buf[5] < NUM_ADDR) {
+		own.addr = buf[5];
+		own.name.value = get_le64(&buf[8]);
+		own.state = J1939_ADDR_CLAIMED;
+		own.claim_time = j1939_get_time();
+	}
+	return 0;
+}
+
+int j1939_addr_save(void)
+{
+	const size_t len = j1939_addr_snapshot(snapshot, sizeof(snapshot));
+
+	if (len == 0) {
+		return -J1939_EARGS;
+	}
+	return j1939_nv_write(snapshot, len);
+}
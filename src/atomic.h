@@ -23,6 +23,22 @@ static inline atomic_t atomic_or(atomic_t *target, atomic_t value)
 	return __atomic_fetch_or(target, value, __ATOMIC_SEQ_CST);
 }
 
+static inline atomic_t atomic_inc(atomic_t *target)
+{
+	return __atomic_fetch_add(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_t atomic_add(atomic_t *target, atomic_t value)
+{
+	return __atomic_fetch_add(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_cas(atomic_t *target, atomic_t old, atomic_t value)
+{
+	return __atomic_compare_exchange_n(target, &old, value, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
 static inline atomic_t atomic_and(atomic_t *target, atomic_t value)
 {
 	return __atomic_fetch_and(target, value, __ATOMIC_SEQ_CST);
@@ -33,6 +49,31 @@ static inline void atomic_set(atomic_t *target, atomic_t x)
 	__atomic_store_n(target, x, __ATOMIC_SEQ_CST);
 }
 
+static inline atomic_t atomic_get_acquire(const atomic_t *target)
+{
+	return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+static inline atomic_t atomic_get_relaxed(const atomic_t *target)
+{
+	return __atomic_load_n(target, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_set_release(atomic_t *target, atomic_t x)
+{
+	__atomic_store_n(target, x, __ATOMIC_RELEASE);
+}
+
+static inline void atomic_fence_acquire(void)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_fence_release(void)
+{
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
 static inline bool atomic_test_and_set_bit(atomic_t *target, int bit)
 {
 	atomic_t mask = ATOMIC_MASK(bit);
@@ -53,8 +94,16 @@ static inline void atomic_clear_bit(atomic_t *target, int bit)
 #else
 extern atomic_t atomic_get(const atomic_t *target);
 extern atomic_t atomic_or(atomic_t *target, atomic_t value);
+extern atomic_t atomic_inc(atomic_t *target);
+extern atomic_t atomic_add(atomic_t *target, atomic_t value);
+extern bool atomic_cas(atomic_t *target, atomic_t old, atomic_t value);
 extern atomic_t atomic_and(atomic_t *target, atomic_t value);
 extern void atomic_set(atomic_t *target, atomic_t x);
+extern atomic_t atomic_get_acquire(const atomic_t *target);
+extern atomic_t atomic_get_relaxed(const atomic_t *target);
+extern void atomic_set_release(atomic_t *target, atomic_t x);
+extern void atomic_fence_acquire(void);
+extern void atomic_fence_release(void);
 extern bool atomic_test_and_set_bit(atomic_t *target, int bit);
 extern void atomic_clear_bit(atomic_t *target, int bit);
 #endif
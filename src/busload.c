@@ -0,0 +1,280 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Bus load monitor
+ *
+ * The bits of every frame are added to the bucket of the current time
+ * slot (epoch = time / bucket length), for the bus and for the PGN/source
+ * pair of the frame. Every counter remembers the epoch of its last update:
+ * buckets of the slots elapsed since then are cleared lazily, by the next
+ * update, and skipped by the readers.
+ *
+ * PGN/source entries are allocated in an open addressing table and never
+ * freed, keys are published with a compare and swap so that any thread
+ * can account frames.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "atomic.h"
+#include "compiler.h"
+#include "config.h"
+#include "j1939.h"
+#include "j1939_busload.h"
+
+#if !defined(J1939_BUSLOAD_ENTRIES)
+#define J1939_BUSLOAD_ENTRIES 64
+#endif
+
+#define CRC15_POLY 0x4599u
+
+struct load_counter {
+	atomic_t epoch;
+	atomic_t bits[J1939_BUSLOAD_BUCKETS];
+};
+
+struct load_entry {
+	/* PGN and source + 1, 0 if free */
+	atomic_t key;
+	struct load_counter load;
+};
+
+static struct load_counter bus;
+static struct load_entry entries[J1939_BUSLOAD_ENTRIES];
+static uint32_t bus_bitrate;
+static uint32_t bucket_ms;
+static uint32_t start_time;
+static bool worst;
+
+struct bit_stream {
+	uint16_t crc;
+	uint8_t last;
+	uint8_t run;
+	uint16_t stuff;
+};
+
+static inline void put_bit(struct bit_stream *s, const uint8_t bit)
+{
+	if (bit == s->last) {
+		s->run++;
+	} else {
+		s->last = bit;
+		s->run = 1;
+	}
+	/* after 5 equal bits the transmitter inserts a complement bit */
+	if (s->run == 5u) {
+		s->stuff++;
+		s->last = !bit;
+		s->run = 1;
+	}
+}
+
+static inline void put_bits_crc(struct bit_stream *s, const uint32_t value,
+				uint8_t n)
+{
+	while (n--) {
+		const uint8_t bit = (value >> n) & 1u;
+		const uint8_t crc_next = bit ^ ((s->crc >> 14) & 1u);
+
+		s->crc = (s->crc << 1) & 0x7FFFu;
+		if (crc_next) {
+			s->crc ^= CRC15_POLY;
+		}
+		put_bit(s, bit);
+	}
+}
+
+uint16_t j1939_frame_bits(const uint32_t id, const uint8_t *data,
+			  const uint8_t len)
+{
+	struct bit_stream s = { .last = 0xFFu };
+	const uint8_t dlc = len > 8u ? 8u : len;
+
+	/* SOF, base ID, SRR, IDE, extended ID, RTR, r1, r0, DLC */
+	put_bits_crc(&s, 0, 1);
+	put_bits_crc(&s, (id >> 18) & 0x7FFu, 11);
+	put_bits_crc(&s, 0x3u, 2);
+	put_bits_crc(&s, id & 0x3FFFFu, 18);
+	put_bits_crc(&s, 0, 3);
+	put_bits_crc(&s, dlc, 4);
+	for (uint8_t i = 0; i < dlc; i++) {
+		put_bits_crc(&s, data[i], 8);
+	}
+
+	/* the CRC field is stuffed too */
+	for (int8_t i = 14; i >= 0; i--) {
+		put_bit(&s, (s.crc >> i) & 1u);
+	}
+
+	return J1939_FRAME_STUFFED_BITS(dlc) + s.stuff + J1939_FRAME_TAIL_BITS;
+}
+
+uint16_t j1939_frame_bits_worst(const uint8_t len)
+{
+	const uint16_t bits = J1939_FRAME_STUFFED_BITS(len > 8u ? 8u : len);
+
+	return bits + (bits - 1u) / 4u + J1939_FRAME_TAIL_BITS;
+}
+
+static void counter_add(struct load_counter *c, const uint32_t epoch,
+			const uint16_t bits)
+{
+	const uint32_t last = (uint32_t)atomic_get(&c->epoch);
+
+	/* first update in this slot: clear the slots elapsed since the last */
+	if (last != epoch && atomic_cas(&c->epoch, (atomic_t)last,
+					(atomic_t)epoch)) {
+		uint32_t n = epoch - last;
+
+		if (n > J1939_BUSLOAD_BUCKETS) {
+			n = J1939_BUSLOAD_BUCKETS;
+		}
+		while (n--) {
+			atomic_set(&c->bits[(epoch - n) %
+					    J1939_BUSLOAD_BUCKETS], 0);
+		}
+	}
+	atomic_add(&c->bits[epoch % J1939_BUSLOAD_BUCKETS], bits);
+}
+
+/* Bits in the window ending with the current slot */
+static uint64_t counter_sum(const struct load_counter *c, const uint32_t epoch)
+{
+	const uint32_t last = (uint32_t)atomic_get(&c->epoch);
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < J1939_BUSLOAD_BUCKETS; i++) {
+		const uint32_t e = epoch - i;
+
+		/* slots after the last update are empty */
+		if (e <= last && last - e < J1939_BUSLOAD_BUCKETS) {
+			sum += (uint32_t)atomic_get(
+				&c->bits[e % J1939_BUSLOAD_BUCKETS]);
+		}
+	}
+	return sum;
+}
+
+static uint32_t counter_load(const struct load_counter *c)
+{
+	const uint32_t now = j1939_get_time();
+	const uint32_t epoch = now / bucket_ms;
+	uint64_t span;
+
+	if (bus_bitrate == 0) {
+		return 0;
+	}
+
+	/* full buckets plus the current one, not before the start */
+	span = (uint64_t)(J1939_BUSLOAD_BUCKETS - 1u) * bucket_ms +
+	       now % bucket_ms;
+	if (span > now - start_time) {
+		span = now - start_time;
+	}
+	if (span == 0) {
+		span = 1;
+	}
+
+	/* bits / (bitrate * span / 1000) in 0.01 % */
+	return counter_sum(c, epoch) * 10000000ull /
+	       ((uint64_t)bus_bitrate * span);
+}
+
+static inline atomic_t entry_key(const j1939_pgn_t pgn, const uint8_t src)
+{
+	return (atomic_t)(((pgn & 0x3FFFFu) | ((uint32_t)src << 18)) + 1u);
+}
+
+static struct load_entry *lookup(const atomic_t key, const bool alloc)
+{
+	size_t i = (uint32_t)key % J1939_BUSLOAD_ENTRIES;
+
+	for (size_t n = 0; n < J1939_BUSLOAD_ENTRIES; n++) {
+		atomic_t k = atomic_get(&entries[i].key);
+
+		if (k == key) {
+			return &entries[i];
+		}
+		if (k == 0) {
+			if (!alloc) {
+				return NULL;
+			}
+			if (atomic_cas(&entries[i].key, 0, key)) {
+				return &entries[i];
+			}
+			/* taken by another thread, maybe for the same key */
+			if (atomic_get(&entries[i].key) == key) {
+				return &entries[i];
+			}
+		}
+		i = (i + 1) % J1939_BUSLOAD_ENTRIES;
+	}
+	return NULL;
+}
+
+int j1939_busload_setup(const uint32_t bitrate, const uint32_t window_ms,
+			const bool worst_case)
+{
+	if (unlikely(bitrate && window_ms < J1939_BUSLOAD_BUCKETS)) {
+		return -J1939_EARGS;
+	}
+
+	/* stop accounting before clearing the counters */
+	bus_bitrate = 0;
+	memset(&bus, 0, sizeof(bus));
+	memset(entries, 0, sizeof(entries));
+	if (bitrate == 0) {
+		return 0;
+	}
+
+	bucket_ms = window_ms / J1939_BUSLOAD_BUCKETS;
+	worst = worst_case;
+	start_time = j1939_get_time();
+	bus.epoch = start_time / bucket_ms;
+	bus_bitrate = bitrate;
+	return 0;
+}
+
+void j1939_busload_frame(const uint32_t id, const uint8_t *data,
+			 const uint8_t len)
+{
+	struct load_entry *e;
+	j1939_pgn_t pgn;
+	uint8_t priority, src, dst;
+	uint32_t epoch;
+	uint16_t bits;
+
+	if (bus_bitrate == 0) {
+		return;
+	}
+
+	bits = worst ? j1939_frame_bits_worst(len) :
+		       j1939_frame_bits(id, data, len);
+	epoch = j1939_get_time() / bucket_ms;
+	counter_add(&bus, epoch, bits);
+
+	j1939_id2pgn(id, &pgn, &priority, &src, &dst);
+	e = lookup(entry_key(pgn, src), true);
+	if (e) {
+		counter_add(&e->load, epoch, bits);
+	}
+}
+
+uint32_t j1939_busload(void)
+{
+	return counter_load(&bus);
+}
+
+int j1939_busload_pgn(const j1939_pgn_t pgn, const uint8_t src,
+		      uint32_t *load)
+{
+	const struct load_entry *e = lookup(entry_key(pgn, src), false);
+
+	if (e == NULL || IS_NULL(load)) {
+		return -J1939_ENODATA;
+	}
+	*load = counter_load(&e->load);
+	return 0;
+}
@@ -10,6 +10,7 @@
 #define __weak		__attribute__((weak))
 #define __naked		__attribute__((naked))
 #define __noreturn	__attribute__((noreturn))
+#define __packed	__attribute__((packed))
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
 
@@ -19,12 +20,24 @@
 #define __weak
 #define __naked
 #define __noreturn
+#define __packed
 #define likely(x) (x)
 #define unlikely(x) (x)
 
 #endif /* __GNUC__ */
 
 
+/*
+ * Library state (PGN pool, sessions, callbacks) is shared by all the
+ * threads unless the library is built with J1939_THREAD_LOCAL_STATE: then
+ * every thread has its own instance and must call j1939_setup().
+ */
+#if defined(J1939_THREAD_LOCAL_STATE)
+#define __j1939_state	__thread
+#else
+#define __j1939_state
+#endif
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 #ifdef MISRAC
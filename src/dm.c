@@ -0,0 +1,431 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * DM1/DM2 diagnostic messages
+ *
+ * DTCs are packed in 32-bit words sorted by SPN and FMI (the low 24 bits),
+ * with the occurrence count in the high byte:
+ *
+ * |  31 | 30..24 | 23..5 | 4..0 |
+ * | CM  |   OC   |  SPN  | FMI  |
+ *
+ * Multi-packet messages are received through BAM: the library has no BAM
+ * receiver, so TP.CM/TP.DT frames sent to the global address are picked up
+ * with PGN subscriptions and reassembled here, for DM1/DM2 only.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "j1939.h"
+#include "j1939_dm.h"
+#include "compiler.h"
+#include "config.h"
+#include "pgn.h"
+#include "pgn_pool.h"
+
+#if !defined(J1939_DM_SOURCES)
+#define J1939_DM_SOURCES 32
+#endif
+
+#if J1939_DM_SOURCES > 255
+#error "J1939_DM_SOURCES above 255, source_slot[] holds 8-bit indexes + 1"
+#endif
+
+#if !defined(J1939_DM_DTCS)
+#define J1939_DM_DTCS 32
+#endif
+
+#if !defined(J1939_DM_BAM_SESSIONS)
+#define J1939_DM_BAM_SESSIONS 4
+#endif
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+#define DM_MSG_SIZE (2u + 4u * J1939_DM_DTCS)
+#define DM_PRIORITY J1939_PRIORITY_DEFAULT
+
+#define CONN_MODE_BAM 0x20u
+
+#define DTC_KEY(_d) ((_d) & 0x00FFFFFFu)
+#define DTC_SPN(_d) (((_d) >> 5) & 0x7FFFFu)
+#define DTC_FMI(_d) ((_d) & 0x1Fu)
+#define DTC_OC(_d) (((_d) >> 24) & 0x7Fu)
+
+enum { LIST_DM1, LIST_DM2, NUM_LISTS };
+
+struct dm_list {
+	bool valid;
+	uint16_t lamps;
+	uint16_t num;
+	uint32_t dtcs[J1939_DM_DTCS];
+};
+
+struct dm_source {
+	struct dm_list lists[NUM_LISTS];
+};
+
+struct bam_rx {
+	bool active;
+	uint8_t src;
+	j1939_pgn_t pgn;
+	uint16_t size;
+	uint8_t num_packets;
+	uint8_t next_seq;
+	uint32_t time;
+	uint8_t buf[DM_MSG_SIZE];
+};
+
+static __j1939_state j1939_dm_cb_t dm_cb;
+/* source address to sources[] index + 1, 0 if not allocated */
+static __j1939_state uint8_t source_slot[256];
+static __j1939_state struct dm_source sources[J1939_DM_SOURCES];
+static __j1939_state size_t num_sources;
+static __j1939_state struct bam_rx bams[J1939_DM_BAM_SESSIONS];
+static __j1939_state uint32_t scratch[J1939_DM_DTCS];
+
+static inline uint32_t dtc_pack(const struct j1939_dtc *dtc)
+{
+	return ((dtc->spn & 0x7FFFFu) << 5) | (dtc->fmi & 0x1Fu) |
+	       ((uint32_t)(dtc->oc & 0x7Fu) << 24);
+}
+
+static inline void dtc_unpack(const uint32_t d, struct j1939_dtc *dtc)
+{
+	dtc->spn = DTC_SPN(d);
+	dtc->fmi = DTC_FMI(d);
+	dtc->oc = DTC_OC(d);
+}
+
+/* SPN conversion method 4: SPN LSB first, 3 MSBs with the FMI */
+static inline uint32_t dtc_decode(const uint8_t *p)
+{
+	const uint32_t spn = p[0] | (p[1] << 8) | ((uint32_t)(p[2] >> 5) << 16);
+
+	return (spn << 5) | (p[2] & 0x1Fu) | ((uint32_t)(p[3] & 0x7Fu) << 24);
+}
+
+static inline void dtc_encode(const uint32_t d, uint8_t *p)
+{
+	p[0] = DTC_SPN(d) & 0xFFu;
+	p[1] = (DTC_SPN(d) >> 8) & 0xFFu;
+	p[2] = ((DTC_SPN(d) >> 16) << 5) | DTC_FMI(d);
+	p[3] = DTC_OC(d);
+}
+
+static struct dm_list *get_list(const j1939_pgn_t pgn, const uint8_t src,
+				const bool alloc)
+{
+	const int l = (pgn == DM1) ? LIST_DM1 : LIST_DM2;
+	uint8_t slot = source_slot[src];
+
+	if (slot == 0) {
+		if (!alloc || num_sources == J1939_DM_SOURCES) {
+			return NULL;
+		}
+		slot = ++num_sources;
+		source_slot[src] = slot;
+	}
+	return &sources[slot - 1].lists[l];
+}
+
+static void notify(const j1939_pgn_t pgn, const uint8_t src,
+		   const enum j1939_dm_event_type type, const uint32_t dtc,
+		   const uint16_t lamps)
+{
+	struct j1939_dm_event ev = {
+		.pgn = pgn,
+		.src = src,
+		.type = type,
+		.lamps = lamps,
+	};
+
+	if (dm_cb) {
+		dtc_unpack(dtc, &ev.dtc);
+		dm_cb(&ev);
+	}
+}
+
+/* Sort by key and drop duplicates, lists are short and mostly sorted */
+static size_t sort_dtcs(uint32_t *d, size_t n)
+{
+	size_t out = 0;
+
+	for (size_t i = 1; i < n; i++) {
+		uint32_t v = d[i];
+		size_t j = i;
+		while (j > 0 && DTC_KEY(d[j - 1]) > DTC_KEY(v)) {
+			d[j] = d[j - 1];
+			j--;
+		}
+		d[j] = v;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (out == 0 || DTC_KEY(d[out - 1]) != DTC_KEY(d[i])) {
+			d[out++] = d[i];
+		}
+	}
+	return out;
+}
+
+static void process(const j1939_pgn_t pgn, const uint8_t src,
+		    const uint8_t *data, const uint16_t len)
+{
+	struct dm_list *list;
+	const uint16_t lamps = data[0] | (data[1] << 8);
+	size_t n = 0, i = 0, j = 0;
+
+	list = get_list(pgn, src, true);
+	if (list == NULL) {
+		return;
+	}
+
+	for (uint16_t off = 2; off + 4u <= len && n < J1939_DM_DTCS;
+	     off += 4) {
+		uint32_t d = dtc_decode(&data[off]);
+		/* "no DTC" (all zeros) and padding */
+		if (DTC_KEY(d) == 0 || DTC_KEY(d) == 0x00FFFFFFu) {
+			continue;
+		}
+		scratch[n++] = d;
+	}
+	n = sort_dtcs(scratch, n);
+
+	if (!list->valid || list->lamps != lamps) {
+		notify(pgn, src, J1939_DM_LAMPS_CHANGED, 0, lamps);
+	}
+
+	/* merge the old and new sorted lists */
+	while (i < list->num || j < n) {
+		if (j == n || (i < list->num &&
+			       DTC_KEY(list->dtcs[i]) < DTC_KEY(scratch[j]))) {
+			notify(pgn, src, J1939_DM_DTC_CLEARED, list->dtcs[i],
+			       lamps);
+			i++;
+		} else if (i == list->num ||
+			   DTC_KEY(list->dtcs[i]) > DTC_KEY(scratch[j])) {
+			notify(pgn, src, J1939_DM_DTC_ADDED, scratch[j], lamps);
+			j++;
+		} else {
+			if (list->dtcs[i] != scratch[j]) {
+				notify(pgn, src, J1939_DM_DTC_CHANGED,
+				       scratch[j], lamps);
+			}
+			i++;
+			j++;
+		}
+	}
+
+	memcpy(list->dtcs, scratch, n * sizeof(scratch[0]));
+	list->num = n;
+	list->lamps = lamps;
+	list->valid = true;
+}
+
+static int dm_received(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		       uint8_t dest, uint8_t *data, uint8_t len)
+{
+	if (len >= 2) {
+		process(pgn, src, data, len);
+	}
+	return len;
+}
+
+static struct bam_rx *bam_search(const uint8_t src)
+{
+	for (size_t i = 0; i < J1939_DM_BAM_SESSIONS; i++) {
+		if (bams[i].active && bams[i].src == src) {
+			return &bams[i];
+		}
+	}
+	return NULL;
+}
+
+static int bam_cm(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		  uint8_t dest, uint8_t *data, uint8_t len)
+{
+	struct bam_rx *bam = bam_search(src);
+	const uint32_t now = j1939_get_time();
+	j1939_pgn_t bam_pgn;
+	uint16_t size;
+
+	if (len < 8) {
+		return 0;
+	}
+
+	/* a new BAM or an abort ends the previous one */
+	if (bam) {
+		bam->active = false;
+	}
+	if (data[0] != CONN_MODE_BAM) {
+		return 0;
+	}
+
+	bam_pgn = data[5] | (data[6] << 8) | ((j1939_pgn_t)data[7] << 16);
+	size = data[1] | (data[2] << 8);
+	if (bam_pgn != DM1 && bam_pgn != DM2) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < J1939_DM_BAM_SESSIONS && bam == NULL; i++) {
+		if (!bams[i].active || now - bams[i].time > T1) {
+			bam = &bams[i];
+		}
+	}
+	if (bam == NULL) {
+		return 0;
+	}
+
+	bam->active = true;
+	bam->src = src;
+	bam->pgn = bam_pgn;
+	/* DTCs not fitting in the buffer are dropped */
+	bam->size = MIN(size, DM_MSG_SIZE);
+	bam->num_packets = data[3];
+	bam->next_seq = 1;
+	bam->time = now;
+	return 0;
+}
+
+static int bam_dt(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		  uint8_t dest, uint8_t *data, uint8_t len)
+{
+	struct bam_rx *bam = bam_search(src);
+	const uint32_t now = j1939_get_time();
+	size_t off, n;
+
+	if (bam == NULL || len < 2) {
+		return 0;
+	}
+	if (data[0] != bam->next_seq || now - bam->time > T1) {
+		bam->active = false;
+		return 0;
+	}
+
+	off = (size_t)(bam->next_seq - 1) * 7u;
+	if (off < bam->size) {
+		n = MIN((size_t)bam->size - off, (size_t)(len - 1));
+		memcpy(&bam->buf[off], &data[1], n);
+	}
+	bam->time = now;
+
+	if (bam->next_seq++ == bam->num_packets) {
+		bam->active = false;
+		process(bam->pgn, src, bam->buf, bam->size);
+	}
+	return 0;
+}
+
+int j1939_dm_setup(j1939_dm_cb_t cb)
+{
+	const struct pgn_subscription cm = {
+		.pgn = TP_CM,
+		.pgn_mask = PGN_MASK,
+		.dst = ADDRESS_GLOBAL,
+		.dst_mask = 0xFFu,
+		.cb = bam_cm,
+	};
+	const struct pgn_subscription dt = {
+		.pgn = TP_DT,
+		.pgn_mask = PGN_MASK,
+		.dst = ADDRESS_GLOBAL,
+		.dst_mask = 0xFFu,
+		.cb = bam_dt,
+	};
+	int ret;
+
+	dm_cb = cb;
+	memset(source_slot, 0, sizeof(source_slot));
+	memset(sources, 0, sizeof(sources));
+	memset(bams, 0, sizeof(bams));
+	num_sources = 0;
+
+	ret = pgn_register(DM1, 0, dm_received);
+	if (ret >= 0) {
+		ret = pgn_register(DM2, 0, dm_received);
+	}
+	if (ret >= 0) {
+		ret = pgn_subscribe(&cm);
+	}
+	if (ret >= 0) {
+		ret = pgn_subscribe(&dt);
+	}
+	return ret < 0 ? ret : 0;
+}
+
+int j1939_dm_get(const j1939_pgn_t pgn, const uint8_t src,
+		 struct j1939_dtc *dtcs, const size_t max_dtcs,
+		 uint16_t *lamps)
+{
+	const struct dm_list *list = get_list(pgn, src, false);
+	size_t n;
+
+	if (list == NULL || !list->valid) {
+		return -J1939_ENODATA;
+	}
+
+	n = MIN((size_t)list->num, max_dtcs);
+	for (size_t i = 0; i < n; i++) {
+		dtc_unpack(list->dtcs[i], &dtcs[i]);
+	}
+	if (lamps) {
+		*lamps = list->lamps;
+	}
+	return n;
+}
+
+bool j1939_dm_is_active(const uint8_t src, const uint32_t spn,
+			const uint8_t fmi)
+{
+	const struct dm_list *list = get_list(DM1, src, false);
+	const struct j1939_dtc dtc = { .spn = spn, .fmi = fmi };
+	const uint32_t key = DTC_KEY(dtc_pack(&dtc));
+	size_t lo = 0, hi;
+
+	if (list == NULL) {
+		return false;
+	}
+
+	hi = list->num;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (DTC_KEY(list->dtcs[mid]) < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo < list->num && DTC_KEY(list->dtcs[lo]) == key;
+}
+
+int j1939_dm1_send(const uint8_t src, const uint16_t lamps,
+		   const struct j1939_dtc *dtcs, const size_t num_dtcs)
+{
+	/* on the stack: senders of several sources may run concurrently */
+	uint8_t tx_buf[DM_MSG_SIZE];
+	uint16_t len = 2;
+
+	if (unlikely(num_dtcs > J1939_DM_DTCS || (num_dtcs && !dtcs))) {
+		return -J1939_EARGS;
+	}
+
+	tx_buf[0] = lamps & 0xFFu;
+	tx_buf[1] = lamps >> 8;
+	for (size_t i = 0; i < num_dtcs; i++) {
+		dtc_encode(dtc_pack(&dtcs[i]), &tx_buf[len]);
+		len += 4;
+	}
+
+	if (len <= 8) {
+		/* no DTC: SPN 0, FMI 0, OC 0 */
+		if (num_dtcs == 0) {
+			memset(&tx_buf[2], 0, 4);
+		}
+		tx_buf[6] = 0xFFu;
+		tx_buf[7] = 0xFFu;
+		return j1939_send(DM1, DM_PRIORITY, src, ADDRESS_GLOBAL, tx_buf,
+				  8);
+	}
+	return j1939_tp_bam(DM1, DM_PRIORITY, src, tx_buf, len);
+}
@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * NMEA 2000 Fast Packet
+ *
+ * Reassembly contexts come from a fixed pool and are matched by source,
+ * PGN and sequence counter, so messages from different sources (or
+ * consecutive messages from the same source) may be interleaved. A
+ * context is released when its message is complete, when a frame is
+ * missing or when T1 has elapsed since its last frame.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "j1939.h"
+#include "j1939_fp.h"
+#include "j1939_time.h"
+#include "compiler.h"
+#include "config.h"
+#include "pgn_pool.h"
+
+#if !defined(J1939_FP_SESSIONS)
+#define J1939_FP_SESSIONS 8
+#endif
+
+#if !defined(J1939_FP_PGNS)
+#define J1939_FP_PGNS 16
+#endif
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+#define FP_SEQ(_b) ((_b) >> 5)
+#define FP_FRAME(_b) ((_b) & 0x1Fu)
+#define FP_FIRST_LEN 6u
+#define FP_NEXT_LEN 7u
+
+struct fp_rx {
+	bool active;
+	uint8_t src;
+	uint8_t dst;
+	uint8_t priority;
+	uint8_t seq;
+	uint8_t next_frame;
+	uint8_t size;
+	uint8_t received;
+	j1939_pgn_t pgn;
+	pgn_callback_t cb;
+	uint32_t time;
+	uint8_t buf[J1939_FP_MAX_DATA_LEN];
+};
+
+struct fp_pgn {
+	j1939_pgn_t pgn;
+	pgn_callback_t cb;
+};
+
+static __j1939_state struct fp_rx contexts[J1939_FP_SESSIONS];
+static __j1939_state struct fp_pgn pgns[J1939_FP_PGNS];
+static __j1939_state size_t num_pgns;
+static __j1939_state struct j1939_fp_stats stats;
+/* sequence counter of the next message sent by every source */
+static __j1939_state uint8_t tx_seq[256];
+
+static pgn_callback_t fp_lookup(const j1939_pgn_t pgn)
+{
+	for (size_t i = 0; i < num_pgns; i++) {
+		if (pgns[i].pgn == pgn) {
+			return pgns[i].cb;
+		}
+	}
+	return NULL;
+}
+
+static struct fp_rx *fp_search(const j1939_pgn_t pgn, const uint8_t src,
+			       const uint8_t seq)
+{
+	for (size_t i = 0; i < J1939_FP_SESSIONS; i++) {
+		struct fp_rx *ctx = &contexts[i];
+
+		if (ctx->active && ctx->src == src && ctx->pgn == pgn &&
+		    ctx->seq == seq) {
+			return ctx;
+		}
+	}
+	return NULL;
+}
+
+/* Free context, expired contexts are released on the way */
+static struct fp_rx *fp_alloc(void)
+{
+	struct fp_rx *ret = NULL;
+
+	for (size_t i = 0; i < J1939_FP_SESSIONS; i++) {
+		struct fp_rx *ctx = &contexts[i];
+
+		if (ctx->active && elapsed(ctx->time, T1)) {
+			ctx->active = false;
+			stats.timeouts++;
+		}
+		if (!ctx->active && ret == NULL) {
+			ret = ctx;
+		}
+	}
+	return ret;
+}
+
+static int fp_deliver(struct fp_rx *ctx)
+{
+	ctx->active = false;
+	stats.messages++;
+	return ctx->cb(ctx->pgn, ctx->priority, ctx->src, ctx->dst, ctx->buf,
+		       ctx->size);
+}
+
+static int fp_first(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		    uint8_t dest, uint8_t *data, uint8_t len)
+{
+	const uint8_t seq = FP_SEQ(data[0]);
+	struct fp_rx *ctx = fp_search(pgn, src, seq);
+
+	/* the previous message with this sequence counter is incomplete */
+	if (ctx) {
+		ctx->active = false;
+		stats.lost++;
+	}
+
+	if (len < 2 || data[1] == 0 || data[1] > J1939_FP_MAX_DATA_LEN) {
+		return -J1939_EWRONG_DATA_LEN;
+	}
+
+	ctx = fp_alloc();
+	if (ctx == NULL) {
+		stats.overruns++;
+		return 0;
+	}
+
+	ctx->cb = fp_lookup(pgn);
+	if (ctx->cb == NULL) {
+		return 0;
+	}
+	ctx->active = true;
+	ctx->src = src;
+	ctx->dst = dest;
+	ctx->priority = priority;
+	ctx->seq = seq;
+	ctx->pgn = pgn;
+	ctx->size = data[1];
+	ctx->received = MIN(ctx->size, MIN(FP_FIRST_LEN, len - 2u));
+	ctx->next_frame = 1;
+	ctx->time = j1939_get_time();
+	memcpy(ctx->buf, &data[2], ctx->received);
+
+	if (ctx->received == ctx->size) {
+		return fp_deliver(ctx);
+	}
+	return 0;
+}
+
+static int fp_received(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+		       uint8_t dest, uint8_t *data, uint8_t len)
+{
+	struct fp_rx *ctx;
+	uint8_t n;
+
+	if (unlikely(len < 1)) {
+		return 0;
+	}
+	if (FP_FRAME(data[0]) == 0) {
+		return fp_first(pgn, priority, src, dest, data, len);
+	}
+
+	/* frames of a message whose first frame has been missed are dropped */
+	ctx = fp_search(pgn, src, FP_SEQ(data[0]));
+	if (ctx == NULL) {
+		return 0;
+	}
+
+	if (elapsed(ctx->time, T1)) {
+		ctx->active = false;
+		stats.timeouts++;
+		return 0;
+	}
+	if (FP_FRAME(data[0]) != ctx->next_frame) {
+		ctx->active = false;
+		stats.lost++;
+		return 0;
+	}
+
+	n = MIN(ctx->size - ctx->received, MIN(FP_NEXT_LEN, len - 1u));
+	memcpy(&ctx->buf[ctx->received], &data[1], n);
+	ctx->received += n;
+	ctx->next_frame++;
+	ctx->time = j1939_get_time();
+
+	if (ctx->received == ctx->size) {
+		return fp_deliver(ctx);
+	}
+	return 0;
+}
+
+void j1939_fp_setup(void)
+{
+	memset(contexts, 0, sizeof(contexts));
+	memset(pgns, 0, sizeof(pgns));
+	memset(&stats, 0, sizeof(stats));
+	memset(tx_seq, 0, sizeof(tx_seq));
+	num_pgns = 0;
+}
+
+int j1939_fp_register(const j1939_pgn_t pgn, pgn_callback_t cb)
+{
+	int ret;
+
+	if (unlikely(cb == NULL)) {
+		return -J1939_EARGS;
+	}
+	if (fp_lookup(pgn) || num_pgns == J1939_FP_PGNS) {
+		return -ERR_TOO_MANY_PGN;
+	}
+
+	ret = pgn_register(pgn, 0, fp_received);
+	if (ret < 0) {
+		return ret;
+	}
+	pgns[num_pgns].pgn = pgn;
+	pgns[num_pgns].cb = cb;
+	num_pgns++;
+	return 0;
+}
+
+int j1939_fp_deregister(const j1939_pgn_t pgn)
+{
+	for (size_t i = 0; i < num_pgns; i++) {
+		if (pgns[i].pgn != pgn) {
+			continue;
+		}
+		pgns[i] = pgns[--num_pgns];
+		for (size_t j = 0; j < J1939_FP_SESSIONS; j++) {
+			if (contexts[j].pgn == pgn) {
+				contexts[j].active = false;
+			}
+		}
+		return pgn_deregister(pgn, 0);
+	}
+	return -ERR_PGN_UNKNOWN;
+}
+
+int j1939_fp_send(const j1939_pgn_t pgn, const uint8_t priority,
+		  const uint8_t src, const uint8_t dst, const uint8_t *data,
+		  const uint8_t len)
+{
+	const uint8_t seq = tx_seq[src];
+	uint8_t frame[8];
+	uint8_t off = 0, n;
+	int ret;
+
+	if (unlikely(!data || len == 0 || len > J1939_FP_MAX_DATA_LEN)) {
+		return -J1939_EWRONG_DATA_LEN;
+	}
+	tx_seq[src] = (seq + 1u) & 0x7u;
+
+	for (uint8_t i = 0; off < len; i++) {
+		frame[0] = (seq << 5) | i;
+		if (i == 0) {
+			frame[1] = len;
+			n = MIN(FP_FIRST_LEN, len);
+			memcpy(&frame[2], data, n);
+			memset(&frame[2 + n], J1930_NA_8, FP_FIRST_LEN - n);
+		} else {
+			n = MIN(FP_NEXT_LEN, len - off);
+			memcpy(&frame[1], &data[off], n);
+			memset(&frame[1 + n], J1930_NA_8, FP_NEXT_LEN - n);
+		}
+		off += n;
+
+		ret = j1939_send(pgn, priority, src, dst, frame, sizeof(frame));
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void j1939_fp_get_stats(struct j1939_fp_stats *s)
+{
+	*s = stats;
+}
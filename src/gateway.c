@@ -0,0 +1,405 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Bus to bus gateway
+ *
+ * Every route is compiled into a rule on the raw CAN identifier:
+ *
+ *   match:      (id & mask) == value
+ *   forwarded:  (id & keep) | set
+ *
+ * Rules are grouped by input bus, in routing table order, so forwarding a
+ * frame is a linear scan of the rules of its bus.
+ *
+ * TP connections matching a J1939_GW_ROUTE_TP route are tracked in a
+ * small table, keyed by input bus, source and destination address.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "compiler.h"
+#include "config.h"
+#include "j1939.h"
+#include "j1939_gw.h"
+#include "j1939_time.h"
+#include "pgn.h"
+
+#if !defined(J1939_GW_ROUTES)
+#define J1939_GW_ROUTES 32
+#endif
+
+#if !defined(J1939_GW_TP_SESSIONS)
+#define J1939_GW_TP_SESSIONS 8
+#endif
+
+#define ID_MASK 0x1FFFFFFFu
+#define ID_SRC(_id) ((_id) & 0xFFu)
+#define ID_PS(_id) (((_id) >> 8) & 0xFFu)
+#define ID_PF(_id) (((_id) >> 16) & 0xFFu)
+
+#define CONN_MODE_RTS 0x10u
+#define CONN_MODE_EOM_ACK 0x13u
+#define CONN_MODE_BAM 0x20u
+#define CONN_MODE_ABORT 0xFFu
+
+struct gw_rule {
+	uint32_t value;
+	uint32_t mask;
+	uint32_t keep;
+	uint32_t set;
+	uint32_t out_buses;
+	/* index in the routing table */
+	uint16_t route;
+	uint8_t flags;
+};
+
+struct gw_tp {
+	bool active;
+	uint8_t in_bus;
+	uint8_t src;
+	uint8_t dst;
+	/* packets of a BAM, 0 for RTS/CTS */
+	uint8_t bam_packets;
+	uint16_t route;
+	uint32_t out_buses;
+	uint32_t time;
+};
+
+static __j1939_state j1939_gw_send_t gw_buses[J1939_GW_MAX_BUSES];
+static __j1939_state size_t gw_num_buses;
+static __j1939_state struct gw_rule rules[J1939_GW_ROUTES];
+/* rules of bus n: rules[first[n]] .. rules[first[n + 1] - 1] */
+static __j1939_state uint16_t first[J1939_GW_MAX_BUSES + 1];
+/* bit n set if bus n is an input or output of J1939_GW_ROUTE_TP rules */
+static __j1939_state uint32_t tp_buses;
+static __j1939_state struct gw_tp tp_sessions[J1939_GW_TP_SESSIONS];
+static __j1939_state struct j1939_gw_route_stats stats[J1939_GW_ROUTES];
+static __j1939_state uint32_t unrouted;
+
+__weak uint32_t j1939_get_time_us(void)
+{
+	return j1939_get_time() * 1000u;
+}
+
+/*
+ * True if every PGN the route matches is PDU1 (PF < 240): one of the 4
+ * upper PF bits is matched against 0.
+ */
+static inline bool pdu1_only(const struct j1939_gw_route *r)
+{
+	return (PGN_FORMAT(r->pgn_mask) & 0xF0u & ~PGN_FORMAT(r->pgn)) != 0;
+}
+
+static int compile(const struct j1939_gw_route *r, struct gw_rule *rule)
+{
+	const uint32_t pgn_mask = r->pgn_mask & PGN_MASK;
+
+	/*
+	 * The destination is the PDU specific byte of PDU1 PGNs, of PDU2 PGNs
+	 * it is the group extension: matching or translating it there would
+	 * forward a different PGN.
+	 */
+	if (r->dst_mask && ((pgn_mask & 0xFFu) || !pdu1_only(r))) {
+		return -J1939_EARGS;
+	}
+	if (r->new_dst != J1939_GW_KEEP_ADDR && !pdu1_only(r)) {
+		return -J1939_EARGS;
+	}
+	if ((r->new_src != J1939_GW_KEEP_ADDR && r->new_src > 0xFFu) ||
+	    (r->new_dst != J1939_GW_KEEP_ADDR && r->new_dst > 0xFFu)) {
+		return -J1939_EARGS;
+	}
+	if ((r->flags & J1939_GW_ROUTE_TP) &&
+	    (r->new_src != J1939_GW_KEEP_ADDR ||
+	     r->new_dst != J1939_GW_KEEP_ADDR)) {
+		return -J1939_EARGS;
+	}
+
+	rule->mask = (pgn_mask << 8) | ((uint32_t)r->dst_mask << 8) |
+		     r->src_mask;
+	rule->value = ((r->pgn & pgn_mask) << 8) |
+		      ((uint32_t)(r->dst & r->dst_mask) << 8) |
+		      (r->src & r->src_mask);
+
+	rule->keep = ID_MASK;
+	rule->set = 0;
+	if (r->new_src != J1939_GW_KEEP_ADDR) {
+		rule->keep &= ~0xFFu;
+		rule->set |= r->new_src;
+	}
+	if (r->new_dst != J1939_GW_KEEP_ADDR) {
+		rule->keep &= ~0xFF00u;
+		rule->set |= (uint32_t)r->new_dst << 8;
+	}
+
+	/* never back to the input bus */
+	rule->out_buses = r->out_buses & ~(1u << r->in_bus);
+	rule->flags = r->flags;
+	return 0;
+}
+
+int j1939_gw_setup(const j1939_gw_send_t *buses, const size_t num_buses,
+		   const struct j1939_gw_route *routes,
+		   const size_t num_routes)
+{
+	uint16_t count[J1939_GW_MAX_BUSES] = { 0 };
+	uint16_t pos[J1939_GW_MAX_BUSES];
+	struct gw_rule rule;
+	uint32_t valid_buses;
+	int ret;
+
+	if (unlikely(!buses || num_buses == 0 ||
+		     num_buses > J1939_GW_MAX_BUSES ||
+		     (num_routes && !routes))) {
+		return -J1939_EARGS;
+	}
+	if (num_routes > J1939_GW_ROUTES) {
+		return -J1939_ENO_RESOURCE;
+	}
+
+	valid_buses = (num_buses == 32u) ? 0xFFFFFFFFu :
+					   (1u << num_buses) - 1u;
+	for (size_t i = 0; i < num_routes; i++) {
+		if (routes[i].in_bus >= num_buses ||
+		    (routes[i].out_buses & ~valid_buses)) {
+			return -J1939_EARGS;
+		}
+		/* the live table is left alone unless every route is valid */
+		ret = compile(&routes[i], &rule);
+		if (ret < 0) {
+			return ret;
+		}
+		count[routes[i].in_bus]++;
+	}
+
+	/* counting sort by input bus, keeping the table order */
+	first[0] = 0;
+	for (size_t b = 0; b < J1939_GW_MAX_BUSES; b++) {
+		first[b + 1] = first[b] + count[b];
+		pos[b] = first[b];
+	}
+
+	tp_buses = 0;
+	for (size_t i = 0; i < num_routes; i++) {
+		struct gw_rule *r = &rules[pos[routes[i].in_bus]++];
+
+		compile(&routes[i], r);
+		r->route = i;
+		if (r->flags & J1939_GW_ROUTE_TP) {
+			tp_buses |= (1u << routes[i].in_bus) | r->out_buses;
+		}
+	}
+
+	memcpy(gw_buses, buses, num_buses * sizeof(*buses));
+	gw_num_buses = num_buses;
+	memset(tp_sessions, 0, sizeof(tp_sessions));
+	j1939_gw_reset_stats();
+	return 0;
+}
+
+static int send_out(const uint16_t route, uint32_t out_buses,
+		    const uint32_t id, uint8_t *data, const uint8_t len,
+		    const uint32_t rx_time)
+{
+	struct j1939_gw_route_stats *st = &stats[route];
+	uint32_t latency;
+	int ret = 0, sent = 0;
+
+	while (out_buses) {
+		const unsigned int bus = __builtin_ctz(out_buses);
+
+		out_buses &= out_buses - 1u;
+		if (gw_buses[bus](bus, id, data, len) < 0) {
+			st->dropped++;
+			ret = -J1939_EIO;
+		} else {
+			st->forwarded++;
+			sent++;
+		}
+	}
+
+	if (sent == 0) {
+		return ret;
+	}
+
+	latency = j1939_get_time_us() - rx_time;
+	if (latency < st->latency_min) {
+		st->latency_min = latency;
+	}
+	if (latency > st->latency_max) {
+		st->latency_max = latency;
+	}
+	st->latency_sum += latency;
+	st->latency_samples++;
+	return ret < 0 ? ret : sent;
+}
+
+static struct gw_tp *tp_open(const uint8_t bus, const uint8_t src,
+			     const uint8_t dst)
+{
+	struct gw_tp *free = NULL;
+
+	for (size_t i = 0; i < J1939_GW_TP_SESSIONS; i++) {
+		struct gw_tp *s = &tp_sessions[i];
+
+		if (s->active && s->in_bus == bus && s->src == src &&
+		    s->dst == dst) {
+			return s;
+		}
+		if (free == NULL && (!s->active || elapsed(s->time, T1))) {
+			free = s;
+		}
+	}
+	return free;
+}
+
+/* Connection of a TP frame, *reverse set if sent by the receiver */
+static struct gw_tp *tp_search(const uint8_t bus, const uint8_t src,
+			       const uint8_t dst, bool *reverse)
+{
+	for (size_t i = 0; i < J1939_GW_TP_SESSIONS; i++) {
+		struct gw_tp *s = &tp_sessions[i];
+
+		if (!s->active) {
+			continue;
+		}
+		if (s->in_bus == bus && s->src == src && s->dst == dst) {
+			*reverse = false;
+			return s;
+		}
+		if ((s->out_buses & (1u << bus)) && s->src == dst &&
+		    s->dst == src) {
+			*reverse = true;
+			return s;
+		}
+	}
+	return NULL;
+}
+
+/* Forward a TP frame, false if not part of a routed connection */
+static bool forward_tp(const uint8_t bus, const uint32_t id, uint8_t *data,
+		       const uint8_t len, const uint32_t rx_time, int *ret)
+{
+	const uint8_t src = ID_SRC(id), dst = ID_PS(id);
+	const bool cm = ID_PF(id) == PGN_FORMAT(TP_CM);
+	struct gw_tp *s;
+	bool reverse;
+
+	if (cm && len == 8 &&
+	    (data[0] == CONN_MODE_RTS || data[0] == CONN_MODE_BAM)) {
+		const j1939_pgn_t pgn = data[5] | (data[6] << 8) |
+					((j1939_pgn_t)data[7] << 16);
+		uint32_t vid = ((pgn & PGN_MASK) << 8) | src;
+
+		if (j1939_pdu_is_p2p(pgn)) {
+			vid |= (uint32_t)dst << 8;
+		}
+
+		for (size_t i = first[bus]; i < first[bus + 1]; i++) {
+			const struct gw_rule *rule = &rules[i];
+
+			if (!(rule->flags & J1939_GW_ROUTE_TP) ||
+			    (vid & rule->mask) != rule->value) {
+				continue;
+			}
+
+			s = tp_open(bus, src, dst);
+			if (s == NULL) {
+				stats[rule->route].dropped++;
+				*ret = -J1939_ENO_RESOURCE;
+				return true;
+			}
+			s->active = true;
+			s->in_bus = bus;
+			s->src = src;
+			s->dst = dst;
+			s->bam_packets =
+				(data[0] == CONN_MODE_BAM) ? data[3] : 0;
+			s->route = rule->route;
+			s->out_buses = rule->out_buses;
+			s->time = j1939_get_time();
+			*ret = send_out(s->route, s->out_buses, id, data, len,
+					rx_time);
+			return true;
+		}
+		return false;
+	}
+
+	s = tp_search(bus, src, dst, &reverse);
+	if (s == NULL) {
+		return false;
+	}
+
+	s->time = j1939_get_time();
+	*ret = send_out(s->route, reverse ? (1u << s->in_bus) : s->out_buses,
+		       id, data, len, rx_time);
+
+	/* the connection ends with the EOM ACK, an abort or the last BAM DT */
+	if ((cm && len > 0 &&
+	     (data[0] == CONN_MODE_EOM_ACK || data[0] == CONN_MODE_ABORT)) ||
+	    (!cm && s->bam_packets && len > 0 && data[0] == s->bam_packets)) {
+		s->active = false;
+	}
+	return true;
+}
+
+int j1939_gw_forward(const uint8_t bus, uint32_t id, uint8_t *data,
+		     const uint8_t len, uint32_t rx_time)
+{
+	int ret;
+
+	if (unlikely(bus >= gw_num_buses)) {
+		return -J1939_EARGS;
+	}
+
+	id &= ID_MASK;
+	if (rx_time == 0) {
+		rx_time = j1939_get_time_us();
+	}
+
+	if ((tp_buses & (1u << bus)) && (ID_PF(id) == PGN_FORMAT(TP_CM) ||
+					 ID_PF(id) == PGN_FORMAT(TP_DT))) {
+		if (forward_tp(bus, id, data, len, rx_time, &ret)) {
+			return ret;
+		}
+	}
+
+	for (size_t i = first[bus]; i < first[bus + 1]; i++) {
+		const struct gw_rule *rule = &rules[i];
+
+		if ((id & rule->mask) == rule->value &&
+		    !(rule->flags & J1939_GW_ROUTE_TP)) {
+			return send_out(rule->route, rule->out_buses,
+					(id & rule->keep) | rule->set, data,
+					len, rx_time);
+		}
+	}
+
+	unrouted++;
+	return 0;
+}
+
+int j1939_gw_get_stats(const size_t route, struct j1939_gw_route_stats *st)
+{
+	if (unlikely(route >= J1939_GW_ROUTES || !st)) {
+		return -J1939_EARGS;
+	}
+	*st = stats[route];
+	return 0;
+}
+
+uint32_t j1939_gw_unrouted(void)
+{
+	return unrouted;
+}
+
+void j1939_gw_reset_stats(void)
+{
+	memset(stats, 0, sizeof(stats));
+	for (size_t i = 0; i < J1939_GW_ROUTES; i++) {
+		stats[i].latency_min = UINT32_MAX;
+	}
+	unrouted = 0;
+}
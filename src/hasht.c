@@ -14,74 +14,128 @@ static inline uint32_t next_hash(struct hasht *ht, const uint32_t hash)
 	return (hash + 1u) % ht->max_size;
 }
 
+/*
+ * Keys often differ only above the low byte (PDU1 PGNs, multiplexer codes
+ * at bit 18): mix all the key bits into the low ones (MurmurHash3
+ * finalizer) so they all reach the slot whatever max_size.
+ */
 static inline uint32_t hash_code(struct hasht *ht, const uint32_t key)
 {
-	return key % ht->max_size;
+	uint32_t h = key;
+
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h % ht->max_size;
+}
+
+static inline bool slot_empty(const struct hasht_entry *e)
+{
+	return e->key == KEY_UNDEF_VAL;
 }
 
 void hasht_clear(struct hasht *ht)
 {
+	hasht_init(ht);
 	ht->size = 0;
 }
 
-int hasht_delete(struct hasht *ht, const uint32_t key)
+/*
+ * Linear probing: the keys hashing to a slot are found before the first
+ * empty slot after it. A deleted key is replaced by the next keys of the
+ * probe sequence that may move back (backward shift), so no tombstones
+ * are needed and lookups never go past an empty slot.
+ */
+static struct hasht_entry *find(struct hasht *ht, const uint32_t k)
 {
-	size_t nitems = ht->size;
-	const uint32_t k = KEY_MASK(key);
-	uint32_t hash = hash_code(ht, k);
-
-	if (ht->size > 0) {
-		while (nitems-- != 0) {
-			if (ht->items[hash].key == k) {
-				ht->items[hash].item = NULL;
-				ht->items[hash].key = KEY_UNDEF_VAL;
-				ht->size--;
-				return 0;
-			}
-			hash = next_hash(ht, hash);
+	uint32_t hash;
+
+	if (ht->max_size == 0) {
+		return NULL;
+	}
+	hash = hash_code(ht, k);
+
+	for (size_t n = 0; n < ht->max_size; n++) {
+		struct hasht_entry *e = &ht->items[hash];
+		if (e->key == k) {
+			return e;
+		}
+		if (slot_empty(e)) {
+			break;
 		}
+		hash = next_hash(ht, hash);
 	}
-	return -EHASHT_NFOUND;
+	return NULL;
 }
 
-struct hasht_entry *hasht_search(struct hasht *ht, const uint32_t key)
+int hasht_delete(struct hasht *ht, const uint32_t key)
 {
-	const uint32_t k = KEY_MASK(key);
-	uint32_t hash = hash_code(ht, k);
-	size_t nitems = ht->size;
-	while (nitems-- != 0) {
-		if (ht->items[hash].key == k) {
-			return &ht->items[hash];
+	struct hasht_entry *e = find(ht, KEY_MASK(key));
+	uint32_t hole, next;
+
+	if (e == NULL) {
+		return -EHASHT_NFOUND;
+	}
+
+	hole = e - ht->items;
+	next = hole;
+	for (size_t n = 1; n < ht->max_size; n++) {
+		uint32_t home;
+
+		next = next_hash(ht, next);
+		if (slot_empty(&ht->items[next])) {
+			break;
+		}
+		/* stays if its home slot is cyclically in (hole, next] */
+		home = hash_code(ht, ht->items[next].key);
+		if ((next > hole && (home <= hole || home > next)) ||
+		    (next < hole && home <= hole && home > next)) {
+			ht->items[hole] = ht->items[next];
+			hole = next;
 		}
-		hash = next_hash(ht, hash);
 	}
-	return NULL;
+	ht->items[hole].key = KEY_UNDEF_VAL;
+	ht->items[hole].item = 0;
+	ht->size--;
+	return 0;
 }
 
-int hasht_insert(struct hasht *ht, const uint32_t key, void *data)
+struct hasht_entry *hasht_search(struct hasht *ht, const uint32_t key)
+{
+	return find(ht, KEY_MASK(key));
+}
+
+int hasht_insert(struct hasht *ht, const uint32_t key, hasht_item_t data)
 {
 	const uint32_t k = KEY_MASK(key);
-	uint32_t hash = hash_code(ht, k);
+	uint32_t hash;
 
+	if (ht->max_size == 0) {
+		return -EHASHT_EMPTY;
+	}
 	if (ht->size == ht->max_size) {
 		return -EHASHT_FULL;
 	}
+	if (find(ht, k) != NULL) {
+		return -EHASHT_DUP;
+	}
 
-	if (hasht_search(ht, key) == NULL) {
-		while (ht->items[hash].item != NULL) {
-			hash = next_hash(ht, hash);
-		}
-		ht->items[hash].key = k;
-		ht->items[hash].item = data;
-		ht->size++;
-		return key;
+	hash = hash_code(ht, k);
+	while (!slot_empty(&ht->items[hash])) {
+		hash = next_hash(ht, hash);
 	}
-	return -EHASHT_DUP;
+	ht->items[hash].key = k;
+	ht->items[hash].item = data;
+	ht->size++;
+	return key;
 }
 
 void hasht_init(struct hasht *ht)
 {
 	for (size_t i = 0; i < ht->max_size; i++) {
 		ht->items[i].key = KEY_UNDEF_VAL;
+		ht->items[i].item = 0;
 	}
 }
@@ -3,6 +3,11 @@
 #ifndef __HASHT_H__
 #define __HASHT_H__
 
+#include <stddef.h>
+#include <stdint.h>
+#include "compiler.h"
+#include "config.h"
+
 #define EHASHT_EMPTY 1
 #define EHASHT_FULL 2
 #define EHASHT_NFOUND 3
@@ -13,18 +18,33 @@
 		.items = _items, .max_size = maxsize, .size = 0,               \
 	}
 
+/*
+ * The compact profile limits tables to 65535 entries and packs the entries.
+ * An entry holds an index into an array of the table user instead of a
+ * pointer: 5 bytes instead of 8 on 32-bit targets (16 on 64-bit ones).
+ */
+#if defined(J1939_COMPACT)
+typedef uint16_t hasht_size_t;
+typedef uint8_t hasht_item_t;
+#define __hasht_entry __packed
+#else
+typedef size_t hasht_size_t;
+typedef void *hasht_item_t;
+#define __hasht_entry
+#endif
+
 struct hasht_entry {
 	uint32_t key;
-	void *item;
-};
+	hasht_item_t item;
+} __hasht_entry;
 
 struct hasht {
 	struct hasht_entry *items;
-	size_t max_size;
-	size_t size;
+	hasht_size_t max_size;
+	hasht_size_t size;
 };
 
-int hasht_insert(struct hasht *ht, const uint32_t key, void *data);
+int hasht_insert(struct hasht *ht, const uint32_t key, hasht_item_t data);
 struct hasht_entry *hasht_search(struct hasht *ht, const uint32_t key);
 int hasht_delete(struct hasht *ht, const uint32_t key);
 void hasht_clear(struct hasht *ht);
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Batch CAN identifier decoding
+ *
+ * Every identifier is decoded as j1939_id2pgn() does, with a mask in
+ * place of the peer-to-peer branch:
+ *
+ *   p2p      = PDU format < 240 ? ~0 : 0
+ *   pgn      = (id >> 8) & 0x3FFFF & ~(p2p & 0xFF)
+ *   dst      = p2p ? PDU specific : ADDRESS_NULL
+ *
+ * On x86 the SSE2 and AVX2 kernels are built with target attributes and
+ * selected at the first call, so the library itself needs no -m flags.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "j1939.h"
+#include "compiler.h"
+#include "pgn.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define ID2PGN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*id2pgn_kernel_t)(const uint32_t *ids, uint32_t n,
+				j1939_pgn_t *pgn, uint8_t *priority,
+				uint8_t *src, uint8_t *dst);
+
+static void id2pgn_scalar(const uint32_t *ids, uint32_t n, j1939_pgn_t *pgn,
+			  uint8_t *priority, uint8_t *src, uint8_t *dst)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		const uint32_t id = ids[i];
+		const uint32_t p2p = -(uint32_t)(((id >> 16) & 0xFFu) < 240u);
+
+		pgn[i] = (id >> 8) & PGN_MASK & ~(p2p & 0xFFu);
+		priority[i] = (id >> 26) & 0x7u;
+		src[i] = id & 0xFFu;
+		dst[i] = (((id >> 8) & 0xFFu) & p2p) | (ADDRESS_NULL & ~p2p);
+	}
+}
+
+#if defined(ID2PGN_X86)
+/* 4 identifiers: PGN stored, the 8-bit fields returned as 32-bit lanes */
+__attribute__((target("sse2"))) static inline void
+sse2_decode(const __m128i id, j1939_pgn_t *pgn, __m128i *priority,
+	    __m128i *src, __m128i *dst)
+{
+	const __m128i byte = _mm_set1_epi32(0xFF);
+	const __m128i ps = _mm_and_si128(_mm_srli_epi32(id, 8), byte);
+	const __m128i pf = _mm_and_si128(_mm_srli_epi32(id, 16), byte);
+	const __m128i p2p = _mm_cmplt_epi32(pf, _mm_set1_epi32(240));
+	__m128i p;
+
+	p = _mm_and_si128(_mm_srli_epi32(id, 8), _mm_set1_epi32(PGN_MASK));
+	p = _mm_andnot_si128(_mm_and_si128(p2p, byte), p);
+	_mm_storeu_si128((__m128i *)pgn, p);
+
+	*priority = _mm_and_si128(_mm_srli_epi32(id, 26), _mm_set1_epi32(0x7));
+	*src = _mm_and_si128(id, byte);
+	*dst = _mm_or_si128(_mm_and_si128(p2p, ps),
+			    _mm_andnot_si128(p2p,
+					     _mm_set1_epi32(ADDRESS_NULL)));
+}
+
+/* 16 lanes of 0..255 into 16 bytes */
+__attribute__((target("sse2"))) static inline void
+sse2_store_u8(uint8_t *dst, const __m128i *v)
+{
+	const __m128i lo = _mm_packs_epi32(v[0], v[1]);
+	const __m128i hi = _mm_packs_epi32(v[2], v[3]);
+
+	_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+}
+
+__attribute__((target("sse2"))) static void
+id2pgn_sse2(const uint32_t *ids, uint32_t n, j1939_pgn_t *pgn,
+	    uint8_t *priority, uint8_t *src, uint8_t *dst)
+{
+	__m128i prio[4], sa[4], da[4];
+	uint32_t i = 0;
+
+	for (; i + 16u <= n; i += 16u) {
+		for (uint32_t k = 0; k < 4u; k++) {
+			const __m128i id = _mm_loadu_si128(
+				(const __m128i *)&ids[i + 4u * k]);
+
+			sse2_decode(id, &pgn[i + 4u * k], &prio[k], &sa[k],
+				    &da[k]);
+		}
+		sse2_store_u8(&priority[i], prio);
+		sse2_store_u8(&src[i], sa);
+		sse2_store_u8(&dst[i], da);
+	}
+	id2pgn_scalar(&ids[i], n - i, &pgn[i], &priority[i], &src[i], &dst[i]);
+}
+
+__attribute__((target("avx2"))) static inline void
+avx2_decode(const __m256i id, j1939_pgn_t *pgn, __m256i *priority,
+	    __m256i *src, __m256i *dst)
+{
+	const __m256i byte = _mm256_set1_epi32(0xFF);
+	const __m256i ps = _mm256_and_si256(_mm256_srli_epi32(id, 8), byte);
+	const __m256i pf = _mm256_and_si256(_mm256_srli_epi32(id, 16), byte);
+	const __m256i p2p = _mm256_cmpgt_epi32(_mm256_set1_epi32(240), pf);
+	__m256i p;
+
+	p = _mm256_and_si256(_mm256_srli_epi32(id, 8),
+			     _mm256_set1_epi32(PGN_MASK));
+	p = _mm256_andnot_si256(_mm256_and_si256(p2p, byte), p);
+	_mm256_storeu_si256((__m256i *)pgn, p);
+
+	*priority = _mm256_and_si256(_mm256_srli_epi32(id, 26),
+				     _mm256_set1_epi32(0x7));
+	*src = _mm256_and_si256(id, byte);
+	*dst = _mm256_blendv_epi8(_mm256_set1_epi32(ADDRESS_NULL), ps, p2p);
+}
+
+/* 32 lanes of 0..255 into 32 bytes, packs work within 128-bit halves */
+__attribute__((target("avx2"))) static inline void
+avx2_store_u8(uint8_t *dst, const __m256i *v)
+{
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	const __m256i lo = _mm256_packs_epi32(v[0], v[1]);
+	const __m256i hi = _mm256_packs_epi32(v[2], v[3]);
+	const __m256i b = _mm256_packus_epi16(lo, hi);
+
+	_mm256_storeu_si256((__m256i *)dst,
+			    _mm256_permutevar8x32_epi32(b, order));
+}
+
+__attribute__((target("avx2"))) static void
+id2pgn_avx2(const uint32_t *ids, uint32_t n, j1939_pgn_t *pgn,
+	    uint8_t *priority, uint8_t *src, uint8_t *dst)
+{
+	__m256i prio[4], sa[4], da[4];
+	uint32_t i = 0;
+
+	for (; i + 32u <= n; i += 32u) {
+		for (uint32_t k = 0; k < 4u; k++) {
+			const __m256i id = _mm256_loadu_si256(
+				(const __m256i *)&ids[i + 8u * k]);
+
+			avx2_decode(id, &pgn[i + 8u * k], &prio[k], &sa[k],
+				    &da[k]);
+		}
+		avx2_store_u8(&priority[i], prio);
+		avx2_store_u8(&src[i], sa);
+		avx2_store_u8(&dst[i], da);
+	}
+	id2pgn_scalar(&ids[i], n - i, &pgn[i], &priority[i], &src[i], &dst[i]);
+}
+#endif /* ID2PGN_X86 */
+
+static id2pgn_kernel_t select_kernel(void)
+{
+#if defined(ID2PGN_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return id2pgn_avx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return id2pgn_sse2;
+	}
+#endif
+	return id2pgn_scalar;
+}
+
+void j1939_id2pgn_batch(const uint32_t *ids, const uint32_t n,
+			j1939_pgn_t *pgn, uint8_t *priority, uint8_t *src,
+			uint8_t *dst)
+{
+	/* the same value is stored by every thread, no need to lock */
+	static id2pgn_kernel_t kernel;
+
+	if (unlikely(kernel == NULL)) {
+		kernel = select_kernel();
+	}
+	kernel(ids, n, pgn, priority, src, dst);
+}
@@ -0,0 +1,441 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * ISO 15765-2 (ISO-TP) over 29-bit J1939 identifiers
+ *
+ * The sender opens a J1939 session with its peer: the Flow Control
+ * handler stores the parameters in the session and wakes the sender up,
+ * as tp_cts_received() does for a CTS. Received messages are reassembled
+ * in a fixed pool of J1939_ISOTP_SESSIONS buffers.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "atomic.h"
+#include "compiler.h"
+#include "config.h"
+#include "j1939.h"
+#include "j1939_isotp.h"
+#include "j1939_time.h"
+#include "pgn_pool.h"
+#include "session.h"
+
+#if !defined(J1939_ISOTP_SESSIONS)
+#define J1939_ISOTP_SESSIONS 2
+#endif
+
+#if !defined(J1939_ISOTP_BINDINGS)
+#define J1939_ISOTP_BINDINGS 4
+#endif
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+#define DLC_MAX 8u
+#define ISOTP_PRIORITY J1939_PRIORITY_DEFAULT
+#define ISOTP_PADDING 0xCCu
+
+#define PCI_TYPE(_b) ((_b) >> 4)
+#define PCI_SF 0x0u
+#define PCI_FF 0x1u
+#define PCI_CF 0x2u
+#define PCI_FC 0x3u
+
+#define FS_CTS 0x0u
+#define FS_WAIT 0x1u
+#define FS_OVFLW 0x2u
+
+#define SF_MAX_LEN 7u
+#define FF_DATA_LEN 6u
+#define CF_DATA_LEN 7u
+
+/* ISO 15765-2 timeouts [msec] */
+#define N_BS 1000u
+#define N_CR 1000u
+/* max number of consecutive FC.WAIT */
+#define N_WFT_MAX 10u
+
+struct isotp_rx {
+	bool active;
+	uint8_t src;
+	uint8_t dst;
+	uint8_t next_sn;
+	uint8_t block;
+	uint16_t size;
+	uint16_t received;
+	uint32_t time;
+	j1939_isotp_cb_t cb;
+	uint8_t buf[J1939_ISOTP_MAX_DATA_LEN];
+};
+
+struct isotp_binding {
+	uint8_t addr;
+	j1939_isotp_cb_t cb;
+};
+
+static __j1939_state struct j1939_isotp_config config;
+static __j1939_state struct isotp_rx rx[J1939_ISOTP_SESSIONS];
+static __j1939_state struct isotp_binding bindings[J1939_ISOTP_BINDINGS];
+static __j1939_state size_t num_bindings;
+
+static int send_frame(const j1939_pgn_t pgn, const uint8_t src,
+		      const uint8_t dst, uint8_t *frame, const uint8_t len)
+{
+	memset(&frame[len], ISOTP_PADDING, DLC_MAX - len);
+	return j1939_send(pgn, ISOTP_PRIORITY, src, dst, frame, DLC_MAX);
+}
+
+static int send_fc(const uint8_t src, const uint8_t dst, const uint8_t status)
+{
+	uint8_t frame[DLC_MAX] = {
+		(PCI_FC << 4) | status,
+		config.block_size,
+		config.st_min,
+	};
+
+	return send_frame(J1939_ISOTP_PGN_PHYS, src, dst, frame, 3);
+}
+
+static j1939_isotp_cb_t binding_search(const uint8_t addr)
+{
+	for (size_t i = 0; i < num_bindings; i++) {
+		if (bindings[i].addr == addr) {
+			return bindings[i].cb;
+		}
+	}
+	return NULL;
+}
+
+static struct isotp_rx *rx_search(const uint8_t src, const uint8_t dst)
+{
+	for (size_t i = 0; i < J1939_ISOTP_SESSIONS; i++) {
+		if (rx[i].active && rx[i].src == src && rx[i].dst == dst) {
+			return &rx[i];
+		}
+	}
+	return NULL;
+}
+
+static struct isotp_rx *rx_alloc(void)
+{
+	for (size_t i = 0; i < J1939_ISOTP_SESSIONS; i++) {
+		if (!rx[i].active || elapsed(rx[i].time, N_CR)) {
+			return &rx[i];
+		}
+	}
+	return NULL;
+}
+
+static void rcv_single(const j1939_pgn_t pgn, const uint8_t src,
+		       const uint8_t dst, const uint8_t *data,
+		       const uint8_t len)
+{
+	const uint8_t size = data[0] & 0x0Fu;
+	j1939_isotp_cb_t cb;
+
+	if (size == 0 || size > len - 1u) {
+		return;
+	}
+
+	if (pgn == J1939_ISOTP_PGN_FUNC) {
+		for (size_t i = 0; i < num_bindings; i++) {
+			bindings[i].cb(pgn, src, dst, &data[1], size);
+		}
+		return;
+	}
+
+	cb = binding_search(dst);
+	if (cb) {
+		cb(pgn, src, dst, &data[1], size);
+	}
+}
+
+static void rcv_first(const uint8_t src, const uint8_t dst,
+		      const uint8_t *data, const uint8_t len)
+{
+	const uint16_t size = ((data[0] & 0x0Fu) << 8) | data[1];
+	j1939_isotp_cb_t cb = binding_search(dst);
+	struct isotp_rx *ctx;
+
+	if (cb == NULL || len < DLC_MAX || size <= SF_MAX_LEN) {
+		return;
+	}
+
+	/* a new First Frame restarts the reception */
+	ctx = rx_search(src, dst);
+	if (ctx == NULL) {
+		ctx = rx_alloc();
+	}
+	if (ctx == NULL) {
+		send_fc(dst, src, FS_OVFLW);
+		return;
+	}
+
+	ctx->active = true;
+	ctx->src = src;
+	ctx->dst = dst;
+	ctx->cb = cb;
+	ctx->size = size;
+	ctx->received = FF_DATA_LEN;
+	ctx->next_sn = 1;
+	ctx->block = 0;
+	ctx->time = j1939_get_time();
+	memcpy(ctx->buf, &data[2], FF_DATA_LEN);
+
+	send_fc(dst, src, FS_CTS);
+}
+
+static void rcv_consecutive(const uint8_t src, const uint8_t dst,
+			    const uint8_t *data, const uint8_t len)
+{
+	struct isotp_rx *ctx = rx_search(src, dst);
+	uint16_t n;
+
+	if (ctx == NULL) {
+		return;
+	}
+	if (elapsed(ctx->time, N_CR) ||
+	    (data[0] & 0x0Fu) != (ctx->next_sn & 0x0Fu)) {
+		ctx->active = false;
+		return;
+	}
+
+	n = MIN((uint16_t)(ctx->size - ctx->received),
+		(uint16_t)MIN(CF_DATA_LEN, len - 1u));
+	memcpy(&ctx->buf[ctx->received], &data[1], n);
+	ctx->received += n;
+	ctx->next_sn++;
+	ctx->time = j1939_get_time();
+
+	if (ctx->received == ctx->size) {
+		ctx->active = false;
+		ctx->cb(J1939_ISOTP_PGN_PHYS, src, dst, ctx->buf, ctx->size);
+		return;
+	}
+
+	if (config.block_size && ++ctx->block == config.block_size) {
+		ctx->block = 0;
+		send_fc(dst, src, FS_CTS);
+	}
+}
+
+static void rcv_flow_control(const uint8_t src, const uint8_t dst,
+			     const uint8_t *data, const uint8_t len)
+{
+	struct j1939_session *sess = j1939_session_search_addr(dst, src);
+
+	if (sess == NULL || !sess->isotp || len < 3) {
+		return;
+	}
+
+	sess->fc_status = data[0] & 0x0Fu;
+	sess->fc_block_size = data[1];
+	sess->fc_st_min = data[2];
+	atomic_set(&sess->cts_done, 1);
+	j1939_session_notify(sess);
+}
+
+static int isotp_received(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
+			  uint8_t dest, uint8_t *data, uint8_t len)
+{
+	if (unlikely(len < 1)) {
+		return 0;
+	}
+
+	switch (PCI_TYPE(data[0])) {
+	case PCI_SF:
+		rcv_single(pgn, src, dest, data, len);
+		break;
+	case PCI_FF:
+		if (pgn == J1939_ISOTP_PGN_PHYS) {
+			rcv_first(src, dest, data, len);
+		}
+		break;
+	case PCI_CF:
+		if (pgn == J1939_ISOTP_PGN_PHYS) {
+			rcv_consecutive(src, dest, data, len);
+		}
+		break;
+	case PCI_FC:
+		if (pgn == J1939_ISOTP_PGN_PHYS) {
+			rcv_flow_control(src, dest, data, len);
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/* STmin [msec], sub-millisecond values are rounded up */
+static uint32_t st_min_ms(const uint8_t st_min)
+{
+	if (st_min <= 0x7Fu) {
+		return st_min;
+	}
+	if (st_min >= 0xF1u && st_min <= 0xF9u) {
+		return 1;
+	}
+	/* reserved values: the longest STmin */
+	return 0x7Fu;
+}
+
+/* Wait for a Flow Control, return its status or -J1939_ETIMEOUT */
+static int wait_fc(struct j1939_session *sess)
+{
+	int ret;
+
+	sess->timeout = j1939_get_time();
+	for (;;) {
+		/* read before the flag, not to miss a wakeup */
+		const atomic_t wake = atomic_get(&sess->wake);
+
+		if (atomic_get(&sess->cts_done) || elapsed(sess->timeout, N_BS)) {
+			break;
+		}
+		wait_until(&sess->wake, wake, sess->timeout, N_BS);
+	}
+
+	ret = atomic_get(&sess->cts_done) ? sess->fc_status : -J1939_ETIMEOUT;
+	atomic_set(&sess->cts_done, 0);
+	return ret;
+}
+
+static int send_consecutive(struct j1939_session *sess, const uint8_t src,
+			    const uint8_t dst, const uint8_t *data,
+			    const uint16_t len)
+{
+	uint8_t frame[DLC_MAX];
+	uint16_t off = FF_DATA_LEN;
+	uint8_t sn = 1, wft = 0, block;
+	uint32_t st_min, now;
+	atomic_t pace;
+	int ret;
+
+	while (off < len) {
+		ret = wait_fc(sess);
+		if (ret < 0) {
+			return ret;
+		}
+		if (ret == FS_WAIT) {
+			if (++wft > N_WFT_MAX) {
+				return -J1939_EBUSY;
+			}
+			continue;
+		}
+		if (ret != FS_CTS) {
+			return -J1939_ENO_RESOURCE;
+		}
+
+		wft = 0;
+		block = sess->fc_block_size;
+		st_min = st_min_ms(sess->fc_st_min);
+
+		do {
+			const uint16_t n = MIN(CF_DATA_LEN, len - off);
+
+			frame[0] = (PCI_CF << 4) | (sn++ & 0x0Fu);
+			memcpy(&frame[1], &data[off], n);
+			ret = send_frame(J1939_ISOTP_PGN_PHYS, src, dst, frame,
+					 1 + n);
+			if (ret < 0) {
+				return ret;
+			}
+			off += n;
+
+			/* nothing wakes this up, just sleep */
+			pace = 0;
+			now = j1939_get_time();
+			while (st_min && off < len && !elapsed(now, st_min)) {
+				wait_until(&pace, 0, now, st_min);
+			}
+		} while (off < len && (block == 0 || --block > 0));
+	}
+	return 0;
+}
+
+int j1939_isotp_send(const j1939_pgn_t pgn, const uint8_t src,
+		     const uint8_t dst, const uint8_t *data,
+		     const uint16_t len)
+{
+	struct j1939_session *sess;
+	uint8_t frame[DLC_MAX];
+	int ret;
+
+	if (unlikely(!data || len == 0 || len > J1939_ISOTP_MAX_DATA_LEN)) {
+		return -J1939_EWRONG_DATA_LEN;
+	}
+	if (unlikely(pgn != J1939_ISOTP_PGN_PHYS &&
+		     pgn != J1939_ISOTP_PGN_FUNC)) {
+		return -J1939_EARGS;
+	}
+
+	if (len <= SF_MAX_LEN) {
+		frame[0] = (PCI_SF << 4) | len;
+		memcpy(&frame[1], data, len);
+		ret = send_frame(pgn, src, dst, frame, 1 + len);
+		return ret < 0 ? ret : 0;
+	}
+
+	/* functional addressing is single frame only */
+	if (pgn == J1939_ISOTP_PGN_FUNC) {
+		return -J1939_EWRONG_DATA_LEN;
+	}
+
+	sess = j1939_session_open(src, dst);
+	if (sess == NULL) {
+		return -J1939_ENO_RESOURCE;
+	}
+	sess->isotp = true;
+
+	frame[0] = (PCI_FF << 4) | (len >> 8);
+	frame[1] = len & 0xFFu;
+	memcpy(&frame[2], data, FF_DATA_LEN);
+	ret = send_frame(pgn, src, dst, frame, DLC_MAX);
+	if (ret >= 0) {
+		ret = send_consecutive(sess, src, dst, data, len);
+	}
+
+	j1939_session_close(src, dst);
+	return ret < 0 ? ret : 0;
+}
+
+int j1939_isotp_bind(const uint8_t addr, j1939_isotp_cb_t cb)
+{
+	if (unlikely(cb == NULL)) {
+		return -J1939_EARGS;
+	}
+	for (size_t i = 0; i < num_bindings; i++) {
+		if (bindings[i].addr == addr) {
+			bindings[i].cb = cb;
+			return 0;
+		}
+	}
+	if (num_bindings == J1939_ISOTP_BINDINGS) {
+		return -J1939_ENO_RESOURCE;
+	}
+	bindings[num_bindings].addr = addr;
+	bindings[num_bindings].cb = cb;
+	num_bindings++;
+	return 0;
+}
+
+int j1939_isotp_setup(const struct j1939_isotp_config *cfg)
+{
+	int ret;
+
+	memset(&config, 0, sizeof(config));
+	if (cfg) {
+		config = *cfg;
+	}
+	memset(rx, 0, sizeof(rx));
+	memset(bindings, 0, sizeof(bindings));
+	num_bindings = 0;
+
+	ret = pgn_register(J1939_ISOTP_PGN_PHYS, 0, isotp_received);
+	if (ret >= 0) {
+		ret = pgn_register(J1939_ISOTP_PGN_FUNC, 0, isotp_received);
+	}
+	return ret < 0 ? ret : 0;
+}
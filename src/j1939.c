@@ -34,9 +34,20 @@
 #include <stdint.h>
 #include <string.h>
 #include "j1939.h"
+#include "j1939_busload.h"
 #include "compiler.h"
+#include "config.h"
 #include "pgn.h"
 
+static __j1939_state j1939_frame_hook_t rx_hook;
+static __j1939_state j1939_frame_hook_t tx_hook;
+
+void j1939_set_frame_hooks(j1939_frame_hook_t rx, j1939_frame_hook_t tx)
+{
+	rx_hook = rx;
+	tx_hook = tx;
+}
+
 uint32_t j1939_pgn2id(const j1939_pgn_t pgn, const uint8_t priority,
 		      const uint8_t src)
 {
@@ -44,10 +55,32 @@ uint32_t j1939_pgn2id(const j1939_pgn_t pgn, const uint8_t priority,
 	       ((pgn & PGN_MASK) << 8) | (uint32_t)src;
 }
 
+void j1939_id2pgn(const uint32_t id, j1939_pgn_t *pgn, uint8_t *priority,
+		  uint8_t *src, uint8_t *dst)
+{
+	j1939_pgn_t p = id;
+
+	*priority = (id & 0x1C000000u) >> 26;
+	*src = id & 0x000000FFu;
+
+	/*
+	 * if PGN is peer-to-peer, remove destination from
+	 * PGN itself and calculate destination address
+	 */
+	if (j1939_pdu_is_p2p(p >> 8)) {
+		p = id & 0xFFFF00FFu;
+		*dst = (id >> 8) & 0x000000FFu;
+	} else {
+		*dst = ADDRESS_NULL;
+	}
+	*pgn = (p >> 8) & PGN_MASK;
+}
+
 int j1939_send(const j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 	       const uint8_t dst, uint8_t *data, const uint32_t len)
 {
 	uint32_t id;
+	int ret;
 
 	if (unlikely(!j1939_valid_priority(priority))) {
 		return -1;
@@ -60,7 +93,40 @@ int j1939_send(const j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 		id = (id & 0xFFFF00FFu) | ((uint32_t)dst << 8);
 	}
 
-	return j1939_cansend(id, data, len);
+	if (tx_hook) {
+		tx_hook(id, data, len);
+	}
+
+	ret = j1939_cansend(id, data, len);
+#if defined(J1939_WITH_BUSLOAD)
+	if (ret >= 0) {
+		j1939_busload_frame(id, data, len);
+	}
+#endif
+	return ret;
+}
+
+void j1939_sent_frame(const uint32_t id, uint8_t *data, const uint8_t len)
+{
+	if (tx_hook) {
+		tx_hook(id, data, len);
+	}
+#if defined(J1939_WITH_BUSLOAD)
+	j1939_busload_frame(id, data, len);
+#endif
+}
+
+void j1939_receive_frame(const uint32_t id, const uint8_t *data,
+			 const uint8_t len, j1939_pgn_t *pgn,
+			 uint8_t *priority, uint8_t *src, uint8_t *dst)
+{
+	j1939_id2pgn(id, pgn, priority, src, dst);
+	if (rx_hook) {
+		rx_hook(id, data, len);
+	}
+#if defined(J1939_WITH_BUSLOAD)
+	j1939_busload_frame(id, data, len);
+#endif
 }
 
 int j1939_receive(j1939_pgn_t *pgn, uint8_t *priority, uint8_t *src,
@@ -75,23 +141,11 @@ int j1939_receive(j1939_pgn_t *pgn, uint8_t *priority, uint8_t *src,
 
 	received = j1939_canrcv(&id, data);
 
-	if (received >= 0) {
+	/* 0: nothing read, or consumed by the port (e.g. kernel TP) */
+	if (received > 0) {
 		*len = received;
-		*priority = (id & 0x1C000000u) >> 26;
-		*pgn = id;
-		*src = id & 0x000000FFu;
-
-		/*
-		 * if PGN is peer-to-peer, remove destination from
-		 * PGN itself and calculate destination address
-		 */
-		if (j1939_pdu_is_p2p(*pgn)) {
-			*pgn = id & 0xFFFF00FFu;
-			*dst = (id >> 8) & 0x000000FFu;
-		} else {
-			*dst = ADDRESS_NULL;
-		}
-		*pgn = (*pgn >> 8) & PGN_MASK;
+		j1939_receive_frame(id, data, (uint8_t)received, pgn, priority,
+				    src, dst);
 	}
 
 	return received;
@@ -10,7 +10,9 @@
 #include "atomic.h"
 #include "compat.h"
 #include "compiler.h"
+#include "config.h"
 #include "j1939.h"
+#include "j1939_addr.h"
 #include "pgn.h"
 #include "pgn_pool.h"
 #include "j1939_time.h"
@@ -35,12 +37,26 @@
 #define CONN_MODE_BAM 		0x20u
 #define CONN_MODE_ABORT 	0xFFu
 
-static pgn_callback_t user_rcv_tp_callback;
-static pgn_error_cb_t user_error_cb;
+/* CTS sent again by a receiver waiting for packets, before aborting */
+#define J1939_TP_RX_RETRIES	2u
 
-__weak void j1939_task_yield(void);
+static __j1939_state pgn_callback_t user_rcv_tp_callback;
+static __j1939_state pgn_error_cb_t user_error_cb;
+/* connections being received, checked by j1939_tp_poll() */
+static __j1939_state uint32_t rx_sessions;
 
-static inline uint8_t num_packet_from_size(uint8_t size)
+__weak void j1939_task_yield(void);
+__weak int j1939_wait(atomic_t *addr, const atomic_t expected,
+		      const uint32_t timeout);
+__weak void j1939_wake(atomic_t *addr);
+__weak int j1939_tp_offload(const j1939_pgn_t pgn, const uint8_t priority,
+			    const uint8_t src, const uint8_t dst,
+			    uint8_t *data, const uint16_t len);
+__weak int j1939_cansend_bam(const uint32_t cm_id, const uint32_t dt_id,
+			     uint8_t (*frames)[8], const uint16_t num_frames,
+			     const uint32_t period);
+
+static inline uint8_t num_packet_from_size(uint16_t size)
 {
 	return DIV_ROUND_UP(size, DEFRAG_DLC_MAX);
 }
@@ -62,11 +78,21 @@ static int send_tp_rts(uint8_t priority, uint8_t src, uint8_t dst,
 	return j1939_send(TP_CM, priority, src, dst, data, ARRAY_SIZE(data));
 }
 
+/* Time between TP.DT packets */
+static void tp_pace(void)
+{
+	/* nothing wakes this up, just sleep */
+	atomic_t pace = 0;
+	uint32_t now = j1939_get_time();
+	while (!elapsed(now, SEND_PERIOD)) {
+		wait_until(&pace, 0, now, SEND_PERIOD);
+	}
+}
+
 static int defrag_send(uint16_t size, const uint8_t priority, const uint8_t src,
-		       const uint8_t dest, uint8_t *data)
+		       const uint8_t dest, uint8_t *data, uint8_t seqno)
 {
 	int ret;
-	uint8_t seqno = 1;
 	uint8_t frame[DLC_MAX];
 
 	while (size > 0) {
@@ -89,19 +115,13 @@ static int defrag_send(uint16_t size, const uint8_t priority, const uint8_t src,
 		if (ret < 0) {
 			return ret;
 		}
-
-		uint32_t now = j1939_get_time();
-		while (!elapsed(now, SEND_PERIOD)) {
-#if defined(TP_TASK_YIELD)
-			j1939_task_yield();
-#endif
-		}
+		tp_pace();
 	}
 	return 0;
 }
 
-int send_tp_bam(const uint8_t priority, const uint8_t src, uint8_t *data,
-		const uint16_t len)
+int j1939_tp_bam(const j1939_pgn_t pgn, const uint8_t priority,
+		 const uint8_t src, uint8_t *data, const uint16_t len)
 {
 	int ret;
 	uint8_t num_packets = num_packet_from_size(len);
@@ -111,25 +131,131 @@ int send_tp_bam(const uint8_t priority, const uint8_t src, uint8_t *data,
 		len >> 8,
 		num_packets,
 		0xFF,
-		PGN_SPECIFIC(BAM),
-		PGN_FORMAT(BAM),
-		PGN_DATA_PAGE(BAM),
+		PGN_SPECIFIC(pgn),
+		PGN_FORMAT(pgn),
+		PGN_DATA_PAGE(pgn),
 	};
 
 	if (unlikely(len > J1939_MAX_DATA_LEN)) {
 		return -J1939_EARGS;
 	}
 
+	ret = j1939_tp_offload(pgn, priority, src, ADDRESS_GLOBAL, data, len);
+	if (ret != -J1939_ENOTSUP) {
+		return ret;
+	}
+
 	ret = j1939_send(TP_CM, priority, src, ADDRESS_GLOBAL, bam, DLC_MAX);
 	if (ret < 0) {
 		return ret;
 	}
 
-	return defrag_send(len, priority, src, ADDRESS_GLOBAL, data);
+	return defrag_send(len, priority, src, ADDRESS_GLOBAL, data, 1);
+}
+
+int send_tp_bam(const uint8_t priority, const uint8_t src, uint8_t *data,
+		const uint16_t len)
+{
+	return j1939_tp_bam(BAM, priority, src, data, len);
+}
+
+int j1939_tp_frames_init(struct j1939_tp_frames *set, uint8_t (*frames)[8],
+			 const uint16_t max_frames, const j1939_pgn_t pgn,
+			 const uint8_t priority, const uint8_t src,
+			 const uint8_t *data, const uint16_t len)
+{
+	const uint16_t num_frames = J1939_TP_FRAMES(len);
+	uint8_t *frame;
+
+	if (unlikely(IS_NULL(set) || IS_NULL(frames) || IS_NULL(data) ||
+		     len <= DLC_MAX || len > J1939_MAX_DATA_LEN ||
+		     num_frames > max_frames ||
+		     !j1939_valid_priority(priority))) {
+		return -J1939_EARGS;
+	}
+
+	frame = frames[0];
+	frame[0] = CONN_MODE_BAM;
+	frame[1] = len & 0x00FF;
+	frame[2] = len >> 8;
+	frame[3] = num_frames - 1;
+	frame[4] = 0xFF;
+	frame[5] = PGN_SPECIFIC(pgn);
+	frame[6] = PGN_FORMAT(pgn);
+	frame[7] = PGN_DATA_PAGE(pgn);
+
+	for (uint16_t i = 1; i < num_frames; i++) {
+		frames[i][0] = i;
+	}
+	/* padding of the last packet */
+	memset(&frames[num_frames - 1][1], J1930_NA_8, DEFRAG_DLC_MAX);
+
+	set->frames = frames;
+	set->num_frames = num_frames;
+	set->len = len;
+	set->priority = priority;
+	set->src = src;
+	return j1939_tp_frames_update(set, 0, data, len);
+}
+
+int j1939_tp_frames_update(struct j1939_tp_frames *set, const uint16_t offset,
+			   const uint8_t *data, const uint16_t len)
+{
+	uint16_t pos = offset;
+	uint16_t left = len;
+
+	if (unlikely(IS_NULL(set) || IS_NULL(data) ||
+		     (uint32_t)offset + len > set->len)) {
+		return -J1939_EARGS;
+	}
+
+	/* byte i of the payload is byte 1 + i % 7 of packet 1 + i / 7 */
+	while (left > 0) {
+		const uint16_t at = pos % DEFRAG_DLC_MAX;
+		const uint16_t n = MIN(left, DEFRAG_DLC_MAX - at);
+
+		memcpy(&set->frames[1 + pos / DEFRAG_DLC_MAX][1 + at], data, n);
+		data += n;
+		pos += n;
+		left -= n;
+	}
+	return 0;
+}
+
+int j1939_tp_frames_send(const struct j1939_tp_frames *set)
+{
+	const uint32_t cm_id = j1939_pgn2id(TP_CM | ADDRESS_GLOBAL,
+					    set->priority, set->src);
+	const uint32_t dt_id = j1939_pgn2id(TP_DT | ADDRESS_GLOBAL,
+					    set->priority, set->src);
+	int ret;
+
+	ret = j1939_cansend_bam(cm_id, dt_id, set->frames, set->num_frames,
+				SEND_PERIOD);
+	if (ret != -J1939_ENOTSUP) {
+		if (ret == 0) {
+			j1939_sent_frame(cm_id, set->frames[0], DLC_MAX);
+			for (uint16_t i = 1; i < set->num_frames; i++) {
+				j1939_sent_frame(dt_id, set->frames[i],
+						 DLC_MAX);
+			}
+		}
+		return ret;
+	}
+
+	ret = j1939_send(TP_CM, set->priority, set->src, ADDRESS_GLOBAL,
+			 set->frames[0], DLC_MAX);
+	/* the packets are paced from the announce on */
+	for (uint16_t i = 1; i < set->num_frames && ret >= 0; i++) {
+		tp_pace();
+		ret = j1939_send(TP_DT, set->priority, set->src,
+				 ADDRESS_GLOBAL, set->frames[i], DLC_MAX);
+	}
+	return ret < 0 ? ret : 0;
 }
 
 static int send_abort(const uint8_t src, const uint8_t dst,
-		      const uint8_t reason)
+		      const uint8_t reason, const j1939_pgn_t pgn)
 {
 	uint8_t data[DLC_MAX] = {
 		CONN_MODE_ABORT,
@@ -137,11 +263,11 @@ static int send_abort(const uint8_t src, const uint8_t dst,
 		0xFF,
 		0xFF,
 		0xFF,
-		PGN_SPECIFIC(TP_CM),
-		PGN_FORMAT(TP_CM),
-		PGN_DATA_PAGE(TP_CM),
+		PGN_SPECIFIC(pgn),
+		PGN_FORMAT(pgn),
+		PGN_DATA_PAGE(pgn),
 	};
-	return j1939_send(TP_DT, J1939_PRIORITY_LOW, src, dst, data,
+	return j1939_send(TP_CM, J1939_PRIORITY_LOW, src, dst, data,
 			  ARRAY_SIZE(data));
 }
 
@@ -156,9 +282,11 @@ static int tp_cts_received(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
 	sess->cts_num_packets = data[1];
 	sess->cts_next_packet = data[2];
 	atomic_set(&sess->cts_done, 1);
+	j1939_session_notify(sess);
 	return 1;
 }
 
+/* Wait for the next CTS, or for the EOM ACK once all packets are sent */
 static uint8_t wait_tp_cts(const j1939_pgn_t pgn, const uint8_t src,
 			   const uint8_t dst)
 {
@@ -169,13 +297,20 @@ static uint8_t wait_tp_cts(const j1939_pgn_t pgn, const uint8_t src,
 	}
 
 	sess->timeout = j1939_get_time();
-	while (!elapsed(sess->timeout, T3) && !atomic_get(&sess->cts_done)) {
-#if defined(TP_TASK_YIELD)
-		j1939_task_yield();
-#endif
+	for (;;) {
+		/* read before the flags, not to miss a wakeup */
+		const atomic_t wake = atomic_get(&sess->wake);
+
+		if (atomic_get(&sess->cts_done) || atomic_get(&sess->eom_ack) ||
+		    atomic_get(&sess->aborted) || elapsed(sess->timeout, T3)) {
+			break;
+		}
+		wait_until(&sess->wake, wake, sess->timeout, T3);
 	}
 
-	ret = atomic_get(&sess->cts_done) ? REASON_NONE : REASON_TIMEOUT;
+	ret = (atomic_get(&sess->cts_done) || atomic_get(&sess->eom_ack)) ?
+		      REASON_NONE :
+		      REASON_TIMEOUT;
 	atomic_set(&sess->cts_done, 0);
 	return ret;
 }
@@ -196,6 +331,7 @@ static int tp_eom_ack_received(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
 	}
 
 	atomic_set(&sess->eom_ack, 1);
+	j1939_session_notify(sess);
 	uint16_t eom_ack_size = htobe16((data[1] << 8) | data[2]);
 	uint8_t eom_ack_num_packets = data[3];
 
@@ -205,7 +341,7 @@ static int tp_eom_ack_received(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
 		goto err;
 	}
 
-	j1939_session_close(dest, src);
+	/* the session is closed by j1939_tp() */
 	return 0;
 
 err:
@@ -238,8 +374,8 @@ int j1939_tp(j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 	bool initiated = false;
 	int ret;
 	struct j1939_session *sess;
-	uint8_t num_packets, reason;
-	uint16_t size;
+	uint8_t num_packets, next, reason;
+	uint16_t size, offset;
 
 	if (unlikely(len > J1939_MAX_DATA_LEN)) {
 		return -J1939_EWRONG_DATA_LEN;
@@ -250,6 +386,11 @@ int j1939_tp(j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 		return j1939_send(pgn, priority, src, dst, data, len);
 	}
 
+	ret = j1939_tp_offload(pgn, priority, src, dst, data, len);
+	if (ret != -J1939_ENOTSUP) {
+		return ret;
+	}
+
 	sess = j1939_session_open(src, dst);
 	if (sess == NULL) {
 		return -J1939_ENO_RESOURCE;
@@ -257,6 +398,7 @@ int j1939_tp(j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 
 	num_packets = num_packet_from_size(len);
 
+	sess->pgn = pgn;
 	sess->eom_ack_num_packets = num_packets;
 	sess->eom_ack_size = len;
 
@@ -266,13 +408,21 @@ int j1939_tp(j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 		goto out;
 	}
 
-	uint8_t np = num_packets;
-	while (np > 0) {
+	/*
+	 * Send the packets requested by every CTS, starting from its
+	 * next_packet: after the last one the receiver may ask again for the
+	 * packets it lost, until it sends the EOM ACK.
+	 */
+	for (;;) {
 		/* Wait Clear To Send (CTS) */
 		reason = wait_tp_cts(TP_CM, src, dst);
+		if (unlikely(atomic_get(&sess->aborted))) {
+			ret = -J1939_EABORTED;
+			goto out;
+		}
 		if (unlikely(reason != REASON_NONE)) {
 			if (initiated) {
-				ret = send_abort(src, dst, reason);
+				ret = send_abort(src, dst, reason, pgn);
 			} else {
 				ret = -J1939_EBUSY;
 			}
@@ -281,39 +431,80 @@ int j1939_tp(j1939_pgn_t pgn, const uint8_t priority, const uint8_t src,
 			initiated = true;
 		}
 
-		np -= sess->cts_num_packets;
-		size = MIN(sess->cts_num_packets * DEFRAG_DLC_MAX, len);
-		ret = defrag_send(size, J1939_PRIORITY_LOW, src, dst, data);
+		if (atomic_get(&sess->eom_ack)) {
+			ret = 0;
+			break;
+		}
+
+		/* CTS with 0 packets: hold the connection open */
+		if (sess->cts_num_packets == 0) {
+			continue;
+		}
+
+		next = sess->cts_next_packet ? sess->cts_next_packet : 1;
+		if (unlikely(next > num_packets)) {
+			ret = send_abort(src, dst, REASON_NO_RESOURCE, pgn);
+			goto out;
+		}
+
+		offset = (next - 1) * DEFRAG_DLC_MAX;
+		size = MIN(sess->cts_num_packets * DEFRAG_DLC_MAX,
+			   len - offset);
+		ret = defrag_send(size, J1939_PRIORITY_LOW, src, dst,
+				  data + offset, next);
 		if (unlikely(ret < 0)) {
 			goto out;
 		}
 	}
-	ret = send_tp_eom_ack(src, dst, len, num_packets);
 
 out:
 	j1939_session_close(src, dst);
 	return ret;
 }
 
+/* J1939-81: the NAME is sent least significant byte (identity) first */
+static void name_encode(const ecu_name_t name, uint8_t *data)
+{
+	uint64_t v = name.value;
+
+	for (size_t i = 0; i < 8; i++, v >>= 8) {
+		data[i] = v & 0xFFu;
+	}
+}
+
 int j1939_address_claimed(uint8_t src, ecu_name_t name)
 {
 	const uint8_t dest = 0xFE;
-	uint64_t n = htobe64(name.value);
-	return j1939_send(AC, J1939_PRIORITY_HIGH, src, dest, (uint8_t *)&n,
-			  DLC_MAX);
+	uint8_t n[DLC_MAX];
+	int ret;
+
+	name_encode(name, n);
+	ret = j1939_send(AC, J1939_PRIORITY_HIGH, src, dest, n, DLC_MAX);
+#if defined(J1939_WITH_ADDR)
+	if (ret >= 0) {
+		j1939_addr_claim_update(src, name, J1939_ADDR_CLAIMED);
+	}
+#endif
+	return ret;
 }
 
 int j1939_cannot_claim_address(ecu_name_t name)
 {
-	uint64_t n = htobe64(name.value);
+	uint8_t n[DLC_MAX];
+
+	name_encode(name, n);
+#if defined(J1939_WITH_ADDR)
+	j1939_addr_claim_update(ADDRESS_NOT_CLAIMED, name, J1939_ADDR_NONE);
+#endif
 	return j1939_send(AC, J1939_PRIORITY_DEFAULT, ADDRESS_NOT_CLAIMED,
-			  ADDRESS_GLOBAL, (uint8_t *)&n, 8);
+			  ADDRESS_GLOBAL, n, DLC_MAX);
 }
 
 int j1939_address_claim(const uint8_t src, ecu_name_t name)
 {
 	int ret;
 	uint32_t ac = AC;
+	uint8_t n[DLC_MAX];
 
 	/* Send Request for Address Claimed */
 	ret = j1939_send(RAC, J1939_PRIORITY_DEFAULT, src, ADDRESS_GLOBAL,
@@ -322,9 +513,15 @@ int j1939_address_claim(const uint8_t src, ecu_name_t name)
 		return ret;
 	}
 
-	uint64_t n = htobe64(name.value);
-	return j1939_send(AC, J1939_PRIORITY_DEFAULT, src, ADDRESS_GLOBAL,
-			  (uint8_t *)&n, DLC_MAX);
+	name_encode(name, n);
+	ret = j1939_send(AC, J1939_PRIORITY_DEFAULT, src, ADDRESS_GLOBAL, n,
+			 DLC_MAX);
+#if defined(J1939_WITH_ADDR)
+	if (ret >= 0) {
+		j1939_addr_claim_update(src, name, J1939_ADDR_CLAIMING);
+	}
+#endif
+	return ret;
 }
 
 int j1939_send_tp_cts(const uint8_t src, const uint8_t dst,
@@ -344,9 +541,37 @@ int j1939_send_tp_cts(const uint8_t src, const uint8_t dst,
 			  ARRAY_SIZE(data));
 }
 
+static void rx_close(struct j1939_session *sess)
+{
+	rx_sessions--;
+	j1939_session_close(sess->src, sess->dst);
+}
+
+/* Wait up to period [msec] for the next packet */
+static inline void rx_wait(struct j1939_session *sess, const uint16_t period)
+{
+	sess->timeout = j1939_get_time();
+	sess->rx_period = period;
+}
+
 static int pgn_abort(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
 		     uint8_t dest, uint8_t *data, uint8_t len)
 {
+	struct j1939_session *sess;
+
+	/* the sender gave up */
+	sess = j1939_session_search_addr(src, dest);
+	if (sess && sess->rx) {
+		rx_close(sess);
+	}
+
+	/* the receiver gave up, j1939_tp() closes the session */
+	sess = j1939_session_search_addr(dest, src);
+	if (sess && !sess->rx) {
+		atomic_set(&sess->aborted, 1);
+		j1939_session_notify(sess);
+	}
+
 	if (user_error_cb) {
 		user_error_cb(pgn, priority, src, dest, data[1]);
 	}
@@ -356,16 +581,68 @@ static int pgn_abort(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
 static int request_to_send(j1939_pgn_t pgn, uint8_t priority, uint8_t src,
 			   uint8_t dest, uint8_t *data, uint8_t len)
 {
-	struct j1939_session *sess = j1939_session_open(src, dest);
+	const j1939_pgn_t tp_pgn = ((uint32_t)(data[7] & 0x01u) << 16) |
+				   ((uint32_t)data[6] << 8) | data[5];
+	struct j1939_session *sess = j1939_session_search_addr(src, dest);
+
+	/*
+	 * A new RTS while receiving from the same sender: it has given up the
+	 * previous connection. Drop it and refuse this one, the sender can
+	 * start again on a clean pair.
+	 */
+	if (sess) {
+		if (sess->rx) {
+			rx_close(sess);
+		}
+		send_abort(dest, src, REASON_BUSY, tp_pgn);
+		return -J1939_EBUSY;
+	}
+
+	sess = j1939_session_open(src, dest);
 	if (sess == NULL) {
-		return -1;
+		send_abort(dest, src, REASON_NO_RESOURCE, tp_pgn);
+		return -J1939_ENO_RESOURCE;
 	}
+	rx_sessions++;
 
+	sess->rx = true;
+	sess->pgn = tp_pgn;
 	sess->tp_tot_size = htobe16((data[1] << 8) | data[2]);
 	sess->tp_num_packets = num_packet_from_size(sess->tp_tot_size);
 	sess->eom_ack_num_packets = sess->tp_num_packets;
 	sess->eom_ack_size = sess->tp_tot_size;
-	return j1939_send_tp_cts(dest, src, sess->tp_num_packets, 0);
+	sess->cts_end = sess->tp_num_packets;
+	rx_wait(sess, T2);
+	return j1939_send_tp_cts(dest, src, sess->tp_num_packets, 1);
+}
+
+static inline bool rx_test_and_set(struct j1939_session *sess,
+				   const uint8_t seq)
+{
+	const uint8_t mask = 1u << (seq & 7u);
+	const bool ret = sess->rx_map[seq >> 3] & mask;
+
+	sess->rx_map[seq >> 3] |= mask;
+	return ret;
+}
+
+/* Ask again for the first run of missing packets */
+static int request_missing(struct j1939_session *sess, const uint8_t src,
+			   const uint8_t dest)
+{
+	uint8_t next = 1, num = 0;
+
+	while (sess->rx_map[next >> 3] & (1u << (next & 7u))) {
+		next++;
+	}
+	while (next + num <= sess->eom_ack_num_packets &&
+	       !(sess->rx_map[(next + num) >> 3] & (1u << ((next + num) & 7u)))) {
+		num++;
+	}
+
+	sess->cts_end = next + num - 1;
+	rx_wait(sess, T2);
+	return j1939_send_tp_cts(dest, src, num, next);
 }
 
 static int _rcv_tp(j1939_pgn_t pgn, uint8_t priority, uint8_t src, uint8_t dest,
@@ -373,28 +650,69 @@ static int _rcv_tp(j1939_pgn_t pgn, uint8_t priority, uint8_t src, uint8_t dest,
 {
 	struct j1939_session *sess = j1939_session_search_addr(src, dest);
 
-	if (sess == NULL) {
+	if (sess == NULL || !sess->rx) {
 		return -1;
 	}
 
-	if (sess->tp_num_packets == 1) {
-		/* Next packet expected to be EOM ACK */
-		atomic_set(&sess->eom_ack, 0);
-		sess->timeout = j1939_get_time();
+	/* out of range or duplicated packet */
+	if (data[0] == 0 || data[0] > sess->eom_ack_num_packets ||
+	    rx_test_and_set(sess, data[0])) {
+		return 0;
 	}
 	sess->tp_num_packets--;
+	sess->rx_retries = 0;
+	rx_wait(sess, T1);
 
 	if (user_rcv_tp_callback) {
 		user_rcv_tp_callback(pgn, priority, src, dest, data, len);
 	}
 
+	if (sess->tp_num_packets == 0) {
+		send_tp_eom_ack(src, dest, sess->eom_ack_size,
+				sess->eom_ack_num_packets);
+		rx_close(sess);
+	} else if (data[0] >= sess->cts_end) {
+		/* end of the window with packets lost */
+		request_missing(sess, src, dest);
+	}
+
 	return 0;
 }
 
+int j1939_tp_poll(void)
+{
+	int ret = 0;
+
+	for (size_t i = 0; i < MAX_J1939_SESSIONS && rx_sessions > 0; i++) {
+		struct j1939_session *sess = j1939_session_get(i);
+
+		if (sess == NULL || !sess->rx ||
+		    !elapsed(sess->timeout, sess->rx_period)) {
+			continue;
+		}
+
+		if (sess->rx_retries < J1939_TP_RX_RETRIES) {
+			sess->rx_retries++;
+			request_missing(sess, sess->src, sess->dst);
+			continue;
+		}
+
+		send_abort(sess->dst, sess->src, REASON_TIMEOUT, sess->pgn);
+		if (user_error_cb) {
+			user_error_cb(sess->pgn, J1939_PRIORITY_LOW, sess->src,
+				      sess->dst, -J1939_ETIMEOUT);
+		}
+		rx_close(sess);
+		ret++;
+	}
+	return ret;
+}
+
 int j1939_setup(pgn_callback_t rcv_tp, pgn_error_cb_t err_cb)
 {
 	user_rcv_tp_callback = rcv_tp;
 	user_error_cb = err_cb;
+	rx_sessions = 0;
 
 	pgn_pool_init();
 	pgn_register(TP_CM, CONN_MODE_CTS, tp_cts_received);
@@ -404,6 +722,34 @@ int j1939_setup(pgn_callback_t rcv_tp, pgn_error_cb_t err_cb)
 	pgn_register(TP_DT, 0, _rcv_tp);
 
 	j1939_session_init();
+#if defined(J1939_WITH_ADDR)
+	return j1939_addr_init();
+#else
+	return 0;
+#endif
+}
+
+int j1939_tp_received(const uint8_t priority, const uint8_t src,
+		      const uint8_t dst, const uint8_t *data,
+		      const uint16_t len)
+{
+	uint8_t frame[DLC_MAX];
+	uint8_t seqno = 1;
+
+	if (unlikely(len > J1939_MAX_DATA_LEN)) {
+		return -J1939_EWRONG_DATA_LEN;
+	}
+
+	for (uint16_t off = 0; off < len && user_rcv_tp_callback;
+	     off += DEFRAG_DLC_MAX) {
+		const uint16_t n = MIN(DEFRAG_DLC_MAX, len - off);
+
+		frame[0] = seqno++;
+		memcpy(&frame[1], &data[off], n);
+		memset(&frame[1 + n], J1930_NA_8, DEFRAG_DLC_MAX - n);
+		user_rcv_tp_callback(TP_DT, priority, src, dst, frame,
+				     DLC_MAX);
+	}
 	return 0;
 }
 
@@ -416,3 +762,37 @@ int j1939_dispose(void)
 __weak void j1939_task_yield(void)
 {
 }
+
+__weak int j1939_wait(atomic_t *addr, const atomic_t expected,
+		      const uint32_t timeout)
+{
+	const uint32_t start = j1939_get_time();
+
+	while (atomic_get(addr) == expected) {
+		if (elapsed(start, timeout)) {
+			return -J1939_ETIMEOUT;
+		}
+#if defined(TP_TASK_YIELD)
+		j1939_task_yield();
+#endif
+	}
+	return 0;
+}
+
+__weak void j1939_wake(atomic_t *addr)
+{
+}
+
+__weak int j1939_tp_offload(const j1939_pgn_t pgn, const uint8_t priority,
+			    const uint8_t src, const uint8_t dst,
+			    uint8_t *data, const uint16_t len)
+{
+	return -J1939_ENOTSUP;
+}
+
+__weak int j1939_cansend_bam(const uint32_t cm_id, const uint32_t dt_id,
+			     uint8_t (*frames)[8], const uint16_t num_frames,
+			     const uint32_t period)
+{
+	return -J1939_ENOTSUP;
+}
@@ -0,0 +1,552 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * J1939 binary frame log
+ *
+ * Blocks have a fixed size, so the reader can locate any block from its
+ * index without an external table and a crash leaves at most the last
+ * (partial) block incomplete. The writer rewrites the current block in
+ * place on every flush.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "j1939.h"
+#include "j1939_log.h"
+#include "compiler.h"
+
+#define ID_MASK 0x1FFFFFFFu
+#define ID_FLAG_TX (1u << 29)
+#define ID_FLAG_DLC8 (1u << 31)
+
+#define REC_MAX_SIZE (5u + 4u + 1u + 8u)
+
+#define BLK_NREC 4u
+#define BLK_USED 8u
+#define BLK_T_FIRST 16u
+#define BLK_T_LAST 24u
+#define BLK_PGN_MAP 32u
+
+static struct j1939_log_writer *attached;
+static pthread_mutex_t attached_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void put_le32(uint8_t *p, const uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static inline void put_le64(uint8_t *p, const uint64_t v)
+{
+	put_le32(p, (uint32_t)v);
+	put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get_le64(const uint8_t *p)
+{
+	return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static inline uint32_t pgn_bit(const j1939_pgn_t pgn)
+{
+	return (pgn * 2654435761u) >> (32u - 10u);
+}
+
+static inline void map_set(uint8_t *map, const j1939_pgn_t pgn)
+{
+	uint32_t bit = pgn_bit(pgn);
+	map[bit / 8u] |= 1u << (bit % 8u);
+}
+
+static inline bool map_test(const uint8_t *map, const j1939_pgn_t pgn)
+{
+	uint32_t bit = pgn_bit(pgn);
+	return (map[bit / 8u] >> (bit % 8u)) & 1u;
+}
+
+static inline j1939_pgn_t id_to_pgn(const uint32_t id)
+{
+	j1939_pgn_t pgn;
+	uint8_t priority, src, dst;
+
+	j1939_id2pgn(id, &pgn, &priority, &src, &dst);
+	return pgn;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80u) {
+		p[n++] = (uint8_t)(v | 0x80u);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	uint64_t r = 0;
+	unsigned int shift = 0;
+
+	while (*p < end && shift < 64) {
+		uint8_t b = *(*p)++;
+		r |= (uint64_t)(b & 0x7Fu) << shift;
+		if (!(b & 0x80u)) {
+			*v = r;
+			return true;
+		}
+		shift += 7;
+	}
+	return false;
+}
+
+static void block_reset(struct j1939_log_writer *w)
+{
+	memset(w->block, 0, J1939_LOG_BLOCK_SIZE);
+	w->nrec = 0;
+	w->used = 0;
+}
+
+int j1939_log_flush(struct j1939_log_writer *w)
+{
+	ssize_t ret;
+
+	if (unlikely(!w || w->fd < 0)) {
+		return -J1939_EARGS;
+	}
+
+	if (w->nrec == 0) {
+		return 0;
+	}
+
+	put_le32(w->block, J1939_LOG_BLOCK_MAGIC);
+	put_le32(w->block + BLK_NREC, w->nrec);
+	put_le32(w->block + BLK_USED, w->used);
+	put_le64(w->block + BLK_T_LAST, w->last_time);
+
+	ret = pwrite(w->fd, w->block, J1939_LOG_BLOCK_SIZE, w->block_off);
+	return ret == J1939_LOG_BLOCK_SIZE ? 0 : -J1939_EIO;
+}
+
+int j1939_log_open(struct j1939_log_writer *w, const char *path)
+{
+	uint8_t hdr[J1939_LOG_HDR_SIZE] = { 0 };
+
+	if (unlikely(!w || !path)) {
+		return -J1939_EARGS;
+	}
+
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0) {
+		return -J1939_EIO;
+	}
+
+	memcpy(hdr, J1939_LOG_MAGIC, 8);
+	hdr[8] = J1939_LOG_VERSION;
+	hdr[10] = J1939_LOG_HDR_SIZE;
+	put_le32(&hdr[12], J1939_LOG_BLOCK_SIZE);
+	put_le32(&hdr[16], J1939_LOG_BLOCK_HDR_SIZE);
+
+	if (write(w->fd, hdr, sizeof(hdr)) != sizeof(hdr)) {
+		close(w->fd);
+		w->fd = -1;
+		return -J1939_EIO;
+	}
+
+	w->block_off = J1939_LOG_HDR_SIZE;
+	w->last_time = 0;
+	block_reset(w);
+	return 0;
+}
+
+int j1939_log_append(struct j1939_log_writer *w, uint64_t time, uint32_t id,
+		     uint8_t flags, const uint8_t *data, uint8_t len)
+{
+	uint8_t *rec;
+	uint32_t word;
+	size_t n;
+	int ret;
+
+	if (unlikely(!w || w->fd < 0 || len > 8 || (len && !data))) {
+		return -J1939_EARGS;
+	}
+
+	if (J1939_LOG_BLOCK_HDR_SIZE + w->used + REC_MAX_SIZE >
+	    J1939_LOG_BLOCK_SIZE) {
+		ret = j1939_log_flush(w);
+		if (ret < 0) {
+			return ret;
+		}
+		w->block_off += J1939_LOG_BLOCK_SIZE;
+		block_reset(w);
+	}
+
+	if (time < w->last_time) {
+		time = w->last_time;
+	}
+	if (w->nrec == 0) {
+		put_le64(w->block + BLK_T_FIRST, time);
+		w->last_time = time;
+	}
+
+	id &= ID_MASK;
+	word = id;
+	if (flags & J1939_LOG_FLAG_TX) {
+		word |= ID_FLAG_TX;
+	}
+	if (len == 8) {
+		word |= ID_FLAG_DLC8;
+	}
+
+	rec = w->block + J1939_LOG_BLOCK_HDR_SIZE + w->used;
+	n = put_varint(rec, time - w->last_time);
+	put_le32(rec + n, word);
+	n += 4;
+	if (len != 8) {
+		rec[n++] = len;
+	}
+	memcpy(rec + n, data, len);
+	n += len;
+
+	map_set(w->block + BLK_PGN_MAP, id_to_pgn(id));
+	w->used += n;
+	w->nrec++;
+	w->last_time = time;
+	return 0;
+}
+
+int j1939_log_close(struct j1939_log_writer *w)
+{
+	int ret;
+
+	if (unlikely(!w || w->fd < 0)) {
+		return -J1939_EARGS;
+	}
+
+	ret = j1939_log_flush(w);
+	if (close(w->fd) < 0 && ret == 0) {
+		ret = -J1939_EIO;
+	}
+	w->fd = -1;
+	return ret;
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void log_frame(uint32_t id, const uint8_t *data, uint8_t len,
+		      uint8_t flags)
+{
+	pthread_mutex_lock(&attached_lock);
+	if (attached) {
+		j1939_log_append(attached, now_us(), id, flags, data, len);
+	}
+	pthread_mutex_unlock(&attached_lock);
+}
+
+static void log_rx(uint32_t id, const uint8_t *data, uint8_t len)
+{
+	log_frame(id, data, len, 0);
+}
+
+static void log_tx(uint32_t id, const uint8_t *data, uint8_t len)
+{
+	log_frame(id, data, len, J1939_LOG_FLAG_TX);
+}
+
+void j1939_log_attach(struct j1939_log_writer *w)
+{
+	pthread_mutex_lock(&attached_lock);
+	attached = w;
+	pthread_mutex_unlock(&attached_lock);
+
+	if (w) {
+		j1939_set_frame_hooks(log_rx, log_tx);
+	} else {
+		j1939_set_frame_hooks(NULL, NULL);
+	}
+}
+
+int j1939_log_reader_init(struct j1939_log_reader *r, const uint8_t *base,
+			  const size_t size)
+{
+	if (unlikely(!r || !base || size < J1939_LOG_HDR_SIZE)) {
+		return -J1939_EARGS;
+	}
+
+	if (memcmp(base, J1939_LOG_MAGIC, 8) != 0 ||
+	    base[8] != J1939_LOG_VERSION ||
+	    get_le32(&base[12]) != J1939_LOG_BLOCK_SIZE) {
+		return -J1939_EARGS;
+	}
+
+	r->base = base;
+	r->size = size;
+	r->blocks = base + J1939_LOG_HDR_SIZE;
+	r->nblocks = (size - J1939_LOG_HDR_SIZE) / J1939_LOG_BLOCK_SIZE;
+	r->mapped = false;
+	j1939_log_seek(r, NULL);
+	return 0;
+}
+
+int j1939_log_reader_slice(struct j1939_log_reader *slice,
+			   const struct j1939_log_reader *r, const size_t first,
+			   const size_t num)
+{
+	if (unlikely(!slice || !r || !r->base || first > r->nblocks ||
+		     num > r->nblocks - first)) {
+		return -J1939_EARGS;
+	}
+
+	*slice = *r;
+	slice->blocks = r->blocks + first * J1939_LOG_BLOCK_SIZE;
+	slice->nblocks = num;
+	slice->mapped = false;
+	j1939_log_seek(slice, NULL);
+	return 0;
+}
+
+int j1939_log_reader_open(struct j1939_log_reader *r, const char *path)
+{
+	struct stat st;
+	void *base;
+	int fd, ret;
+
+	if (unlikely(!r || !path)) {
+		return -J1939_EARGS;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -J1939_EIO;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < J1939_LOG_HDR_SIZE) {
+		close(fd);
+		return -J1939_EIO;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return -J1939_EIO;
+	}
+
+	ret = j1939_log_reader_init(r, base, st.st_size);
+	if (ret < 0) {
+		munmap(base, st.st_size);
+		return ret;
+	}
+	r->mapped = true;
+	return 0;
+}
+
+void j1939_log_reader_close(struct j1939_log_reader *r)
+{
+	if (r && r->base) {
+		if (r->mapped) {
+			munmap((void *)r->base, r->size);
+		}
+		r->base = NULL;
+	}
+}
+
+static inline const uint8_t *block_at(const struct j1939_log_reader *r,
+				      const size_t i)
+{
+	return r->blocks + i * J1939_LOG_BLOCK_SIZE;
+}
+
+static inline bool block_valid(const uint8_t *blk)
+{
+	return get_le32(blk) == J1939_LOG_BLOCK_MAGIC &&
+	       get_le32(blk + BLK_NREC) > 0 &&
+	       get_le32(blk + BLK_USED) <=
+		       J1939_LOG_BLOCK_SIZE - J1939_LOG_BLOCK_HDR_SIZE;
+}
+
+void j1939_log_seek(struct j1939_log_reader *r,
+		    const struct j1939_log_query *q)
+{
+	size_t lo = 0;
+	size_t hi;
+
+	if (q) {
+		r->query = *q;
+	} else {
+		memset(&r->query, 0, sizeof(r->query));
+		r->query.t_end = UINT64_MAX;
+	}
+
+	memset(r->pgn_map, 0, sizeof(r->pgn_map));
+	for (size_t i = 0; i < r->query.num_pgns; i++) {
+		map_set(r->pgn_map, r->query.pgns[i]);
+	}
+
+	/* first block ending at or after t_start, invalid blocks sort last */
+	hi = r->nblocks;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const uint8_t *blk = block_at(r, mid);
+		if (block_valid(blk) &&
+		    get_le64(blk + BLK_T_LAST) < r->query.t_start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	r->block = lo;
+	r->rec = NULL;
+	r->rec_end = NULL;
+	r->rec_left = 0;
+	r->time = 0;
+}
+
+static bool block_matches(const struct j1939_log_reader *r,
+			  const uint8_t *blk)
+{
+	const uint8_t *map = blk + BLK_PGN_MAP;
+
+	if (get_le64(blk + BLK_T_LAST) < r->query.t_start) {
+		return false;
+	}
+
+	if (r->query.num_pgns == 0) {
+		return true;
+	}
+
+	for (size_t i = 0; i < sizeof(r->pgn_map); i++) {
+		if (map[i] & r->pgn_map[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool pgn_requested(const struct j1939_log_reader *r, const uint32_t id)
+{
+	j1939_pgn_t pgn;
+
+	if (r->query.num_pgns == 0) {
+		return true;
+	}
+
+	pgn = id_to_pgn(id);
+	if (!map_test(r->pgn_map, pgn)) {
+		return false;
+	}
+	for (size_t i = 0; i < r->query.num_pgns; i++) {
+		if (r->query.pgns[i] == pgn) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool next_block(struct j1939_log_reader *r)
+{
+	while (r->block < r->nblocks) {
+		const uint8_t *blk = block_at(r, r->block++);
+
+		if (!block_valid(blk)) {
+			continue;
+		}
+		if (get_le64(blk + BLK_T_FIRST) > r->query.t_end) {
+			r->block = r->nblocks;
+			return false;
+		}
+		if (!block_matches(r, blk)) {
+			continue;
+		}
+
+		r->rec = blk + J1939_LOG_BLOCK_HDR_SIZE;
+		r->rec_end = r->rec + get_le32(blk + BLK_USED);
+		r->rec_left = get_le32(blk + BLK_NREC);
+		r->time = get_le64(blk + BLK_T_FIRST);
+		return true;
+	}
+	return false;
+}
+
+int j1939_log_next(struct j1939_log_reader *r, struct j1939_log_frame *f)
+{
+	uint64_t delta;
+	uint32_t word;
+
+	if (unlikely(!r || !f || !r->base)) {
+		return 0;
+	}
+
+	for (;;) {
+		if (r->rec_left == 0 && !next_block(r)) {
+			return 0;
+		}
+
+		r->rec_left--;
+		if (!get_varint(&r->rec, r->rec_end, &delta) ||
+		    r->rec + 4 > r->rec_end) {
+			/* corrupted block, skip it */
+			r->rec_left = 0;
+			continue;
+		}
+
+		word = get_le32(r->rec);
+		r->rec += 4;
+		r->time += delta;
+
+		f->time = r->time;
+		f->id = word & ID_MASK;
+		f->flags = (word & ID_FLAG_TX) ? J1939_LOG_FLAG_TX : 0;
+		if (word & ID_FLAG_DLC8) {
+			f->len = 8;
+		} else if (r->rec < r->rec_end && *r->rec <= 8) {
+			f->len = *r->rec++;
+		} else {
+			r->rec_left = 0;
+			continue;
+		}
+
+		if (r->rec + f->len > r->rec_end) {
+			r->rec_left = 0;
+			continue;
+		}
+		memcpy(f->data, r->rec, f->len);
+		r->rec += f->len;
+
+		if (f->time < r->query.t_start) {
+			continue;
+		}
+		if (f->time > r->query.t_end) {
+			r->rec_left = 0;
+			r->block = r->nblocks;
+			return 0;
+		}
+		if (pgn_requested(r, f->id)) {
+			return 1;
+		}
+	}
+}
@@ -2,6 +2,13 @@
 #ifndef __TIME_H__
 #define __TIME_H__
 
+#include <stdint.h>
+#include "atomic.h"
+
 bool elapsed(const uint32_t t, const uint32_t timeout);
 
+/* Sleep until *addr changes or timeout [msec] has elapsed since start */
+void wait_until(atomic_t *addr, const atomic_t expected, const uint32_t start,
+		const uint32_t timeout);
+
 #endif /* __TIME_H__ */
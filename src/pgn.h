@@ -19,6 +19,10 @@
 #define AC 	0x00EE00u
 /** @brief Request for Address Claimed */
 #define RAC 	0x00EA00u
+/** @brief Active Diagnostic Trouble Codes */
+#define DM1 	0x00FECAu
+/** @brief Previously Active Diagnostic Trouble Codes */
+#define DM2 	0x00FECBu
 
 /** @brief Check if PDU format < 240 (peer-to-peer) */
 static inline bool j1939_pdu_is_p2p(const j1939_pgn_t pgn)
@@ -1,61 +1,837 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "pgn_pool.h"
 #include "pgn.h"
 #include "config.h"
+#include "atomic.h"
+#include "compiler.h"
 #include "hasht.h"
+#include "j1939_store.h"
 
 #if !defined(PGN_POOL_SIZE)
 #error "PGN_POOL_SIZE not defined"
 #endif
 
-static struct hasht_entry entries[PGN_POOL_SIZE];
-static struct hasht pgn_pool = HASHT_INIT(entries, PGN_POOL_SIZE);
+#if !defined(PGN_SUBSCRIPTIONS)
+#define PGN_SUBSCRIPTIONS 16
+#endif
+
+#if !defined(PGN_VALUE_CACHE_SIZE)
+#define PGN_VALUE_CACHE_SIZE 32
+#endif
+
+#if !defined(PGN_MUXES)
+#define PGN_MUXES 8
+#endif
+
+#if !defined(PGN_CALLBACKS)
+#define PGN_CALLBACKS 16
+#endif
+
+#if defined(J1939_COMPACT) && PGN_CALLBACKS > 256
+#error "PGN_CALLBACKS above 256, the hasht items are 8-bit indexes"
+#endif
 
+#define SUB_WORDS ((PGN_SUBSCRIPTIONS + 31u) / 32u)
+#define READERS_MASK 0x7FFFFFFFu
+#define LEN_UNDEF 0xFFu
+#define PGN_UNDEF 0xFFFFFFFFu
+
+/*
+ * Subscriptions are matched one identifier field at a time: for every
+ * possible value of a field the index holds the set of subscriptions
+ * accepting it, so a frame matches the AND of five bitsets whatever the
+ * number of subscriptions. The index is rebuilt on (un)subscribe.
+ *
+ * The index takes (4 + 4 * 256) * 4 bytes every 32 subscriptions: the
+ * compact profile matches the subscriptions one by one instead.
+ */
+#if !defined(J1939_COMPACT)
+struct sub_index {
+	uint32_t page[4][SUB_WORDS];
+	uint32_t pf[256][SUB_WORDS];
+	uint32_t ps[256][SUB_WORDS];
+	uint32_t src[256][SUB_WORDS];
+	uint32_t dst[256][SUB_WORDS];
+};
+#endif
+
+extern void j1939_task_yield(void);
+
+static __j1939_state struct pgn_subscription subs[PGN_SUBSCRIPTIONS];
+#if !defined(J1939_COMPACT)
+static __j1939_state struct sub_index sub_index;
+#endif
+static __j1939_state uint32_t num_subs;
+
+/* Change-only PGNs and last delivered payload per PGN and source */
+struct change_only {
+	j1939_pgn_t pgn;
+	uint32_t refresh;
+};
+
+struct last_value {
+	uint64_t data;
+	j1939_pgn_t pgn;
+	uint32_t time;
+	uint8_t src;
+	uint8_t len;
+};
+
+static __j1939_state struct change_only change_cfg[PGN_POOL_SIZE];
+static __j1939_state struct last_value values[PGN_VALUE_CACHE_SIZE];
+static __j1939_state uint32_t num_values;
+#if defined(J1939_COMPACT)
+/* change_cfg and values are scanned, no hash tables */
+static __j1939_state uint32_t num_change;
+#else
+static __j1939_state struct hasht_entry change_entries[PGN_POOL_SIZE];
+static __j1939_state struct hasht change_pgns;
+static __j1939_state struct hasht_entry value_entries[PGN_VALUE_CACHE_SIZE];
+static __j1939_state struct hasht value_cache;
+#endif
+
+/*
+ * Multiplexed PGNs: the callback is chosen by a data byte as well. The
+ * PDU format of every multiplexed PGN is flagged in a bitmap, so frames of
+ * other PGNs (nearly all of them) get code 0 without looking at the table.
+ */
+struct pgn_mux {
+	j1939_pgn_t pgn;
+	uint8_t byte;
+	uint8_t mask;
+};
+
+/*
+ * Callbacks registered with pgn_register() and multiplexers. In the
+ * compact profile the entries hold the index of the callback in cbs[]:
+ * the distinct callbacks are stored once, whatever the number of PGNs
+ * they are registered for.
+ */
+struct pgn_table {
+	struct hasht_entry entries[PGN_POOL_SIZE];
+	struct hasht pool;
+#if defined(J1939_COMPACT)
+	pgn_callback_t cbs[PGN_CALLBACKS];
+#endif
+	struct pgn_mux muxes[PGN_MUXES];
+	uint32_t num_muxes;
+	uint32_t mux_pf[256 / 32];
+};
+
+/*
+ * The tables are copy-on-write, so PGNs can be (de)registered from any
+ * thread while frames are dispatched: writers take turns filling the spare
+ * copy and publish it, lookups never wait.
+ *
+ * Bit 0 of readers is the published copy, the upper bits count the lookups
+ * started on it. A lookup is one atomic add on entry and one on departed[]
+ * of its copy on exit. When a copy is replaced its lookup count is added
+ * to departed[], that gets back to 0 (mod 2^31) once the last lookup on
+ * the copy is over: only then the next writer overwrites it.
+ */
+static __j1939_state struct pgn_table tables[2];
+static __j1939_state atomic_t readers;
+static __j1939_state atomic_t departed[2];
+static __j1939_state atomic_t writer;
+
+/* 18-bit PGN and 8-bit code, hasht keys are 31 bits */
 static inline uint32_t make_key(uint32_t pgn, uint8_t code)
 {
-	return pgn | (code << 24);
+	return (pgn & PGN_MASK) | ((uint32_t)code << 18);
+}
+
+static inline struct pgn_table *table_enter(uint32_t *idx)
+{
+	*idx = (uint32_t)atomic_add(&readers, 2) & 1u;
+	return &tables[*idx];
+}
+
+static inline void table_exit(const uint32_t idx)
+{
+	atomic_add(&departed[idx], -1);
+}
+
+/* Lock the writers out and return a copy of the published table */
+static struct pgn_table *table_write(void)
+{
+	uint32_t spare;
+
+	while (!atomic_cas(&writer, 0, 1)) {
+		j1939_task_yield();
+	}
+
+	/* only writers change the published copy */
+	spare = ((uint32_t)atomic_get(&readers) & 1u) ^ 1u;
+	while (((uint32_t)atomic_get(&departed[spare]) & READERS_MASK) != 0) {
+		j1939_task_yield();
+	}
+
+	tables[spare] = tables[spare ^ 1u];
+	tables[spare].pool.items = tables[spare].entries;
+	return &tables[spare];
+}
+
+/* Publish the copy if changed, and let the next writer in */
+static void table_done(struct pgn_table *t, const bool changed)
+{
+	if (changed) {
+		const atomic_t idx = (atomic_t)(t - tables);
+		atomic_t old;
+
+		do {
+			old = atomic_get(&readers);
+		} while (!atomic_cas(&readers, old, idx));
+		atomic_add(&departed[old & 1], (atomic_t)((uint32_t)old >> 1));
+	}
+	atomic_set(&writer, 0);
+}
+
+static void mux_index(struct pgn_table *t)
+{
+	memset(t->mux_pf, 0, sizeof(t->mux_pf));
+	for (uint32_t i = 0; i < t->num_muxes; i++) {
+		const uint8_t pf = PGN_FORMAT(t->muxes[i].pgn);
+		t->mux_pf[pf / 32u] |= 1u << (pf % 32u);
+	}
+}
+
+static void table_reset(struct pgn_table *t)
+{
+	t->pool.items = t->entries;
+	t->pool.max_size = PGN_POOL_SIZE;
+	t->pool.size = 0;
+	hasht_init(&t->pool);
+#if defined(J1939_COMPACT)
+	memset(t->cbs, 0, sizeof(t->cbs));
+#endif
+
+	/* TP.CM connection management messages: control byte */
+	t->muxes[0].pgn = TP_CM;
+	t->muxes[0].byte = 0;
+	t->muxes[0].mask = 0xFF;
+	t->num_muxes = 1;
+	mux_index(t);
+}
+
+/* -1 if the frame is too short to carry the multiplexer */
+static inline int mux_code(const struct pgn_table *t, const j1939_pgn_t pgn,
+			   const uint8_t *data, const uint8_t len)
+{
+	const uint8_t pf = PGN_FORMAT(pgn);
+
+	if (likely((t->mux_pf[pf / 32u] & (1u << (pf % 32u))) == 0)) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < t->num_muxes; i++) {
+		if (t->muxes[i].pgn == pgn) {
+			if (t->muxes[i].byte >= len) {
+				return -1;
+			}
+			return data[t->muxes[i].byte] & t->muxes[i].mask;
+		}
+	}
+	return 0;
+}
+
+int pgn_multiplex(const uint32_t pgn, const uint8_t byte, const uint8_t mask)
+{
+	struct pgn_table *t;
+	uint32_t i;
+
+	if (byte >= 8 || mask == 0) {
+		return -ERR_PGN_UNKNOWN;
+	}
+
+	t = table_write();
+	for (i = 0; i < t->num_muxes && t->muxes[i].pgn != pgn; i++) {
+	}
+	if (i == t->num_muxes) {
+		if (t->num_muxes == PGN_MUXES) {
+			table_done(t, false);
+			return -ERR_TOO_MANY_PGN;
+		}
+		t->num_muxes++;
+	}
+	t->muxes[i].pgn = pgn;
+	t->muxes[i].byte = byte;
+	t->muxes[i].mask = mask;
+	mux_index(t);
+	table_done(t, true);
+	return 0;
+}
+
+int pgn_multiplex_off(const uint32_t pgn)
+{
+	struct pgn_table *t = table_write();
+
+	for (uint32_t i = 0; i < t->num_muxes; i++) {
+		if (t->muxes[i].pgn == pgn) {
+			t->muxes[i] = t->muxes[--t->num_muxes];
+			mux_index(t);
+			table_done(t, true);
+			return 0;
+		}
+	}
+	table_done(t, false);
+	return -ERR_PGN_UNKNOWN;
 }
 
 void pgn_pool_init(void)
 {
-	hasht_init(&pgn_pool);
+	table_reset(&tables[0]);
+	table_reset(&tables[1]);
+	atomic_set(&readers, 0);
+	atomic_set(&departed[0], 0);
+	atomic_set(&departed[1], 0);
+	atomic_set(&writer, 0);
+	pgn_unsubscribe_all();
+	pgn_change_only_clear();
+}
+
+#if defined(J1939_COMPACT)
+/* index of cb in cbs[], added if new, -1 if cbs[] is full */
+static int cb_index(struct pgn_table *t, const pgn_callback_t cb)
+{
+	int free = -1;
+
+	for (int i = 0; i < PGN_CALLBACKS; i++) {
+		if (t->cbs[i] == cb) {
+			return i;
+		}
+		if (t->cbs[i] == NULL && free < 0) {
+			free = i;
+		}
+	}
+	if (free >= 0) {
+		t->cbs[free] = cb;
+	}
+	return free;
 }
 
+/* free the callback slots no entry refers to any more */
+static void cb_release(struct pgn_table *t)
+{
+	bool used[PGN_CALLBACKS] = { false };
+
+	/* an entry found by its own key is in use, not an empty slot */
+	for (size_t i = 0; i < PGN_POOL_SIZE; i++) {
+		if (hasht_search(&t->pool, t->entries[i].key) ==
+		    &t->entries[i]) {
+			used[t->entries[i].item] = true;
+		}
+	}
+	for (size_t i = 0; i < PGN_CALLBACKS; i++) {
+		if (!used[i]) {
+			t->cbs[i] = NULL;
+		}
+	}
+}
+#endif
+
 int pgn_register(const uint32_t pgn, const uint8_t code,
 		 const pgn_callback_t cb)
 {
-	return hasht_insert(&pgn_pool, make_key(pgn, code), cb);
+	struct pgn_table *t = table_write();
+	int ret;
+
+#if defined(J1939_COMPACT)
+	ret = cb_index(t, cb);
+	if (ret < 0) {
+		table_done(t, false);
+		return -EHASHT_FULL;
+	}
+	ret = hasht_insert(&t->pool, make_key(pgn, code), (hasht_item_t)ret);
+	if (ret < 0) {
+		cb_release(t);
+	}
+#else
+	ret = hasht_insert(&t->pool, make_key(pgn, code), cb);
+#endif
+	table_done(t, ret >= 0);
+	return ret;
 }
 
 int pgn_deregister(const uint32_t pgn, const uint8_t code)
 {
-	return hasht_delete(&pgn_pool, make_key(pgn, code));
+	struct pgn_table *t = table_write();
+	int ret = hasht_delete(&t->pool, make_key(pgn, code));
+
+#if defined(J1939_COMPACT)
+	if (ret == 0) {
+		cb_release(t);
+	}
+#endif
+	table_done(t, ret == 0);
+	return ret;
 }
 
 void pgn_deregister_all(void)
 {
-	hasht_clear(&pgn_pool);
+	struct pgn_table *t = table_write();
+
+	table_reset(t);
+	table_done(t, true);
+	pgn_unsubscribe_all();
+	pgn_change_only_clear();
 }
 
-int pgn_pool_receive(void)
+static struct change_only *change_slot(void)
+{
+	for (size_t i = 0; i < PGN_POOL_SIZE; i++) {
+		if (change_cfg[i].pgn == PGN_UNDEF) {
+			return &change_cfg[i];
+		}
+	}
+	return NULL;
+}
+
+#if defined(J1939_COMPACT)
+static struct change_only *change_find(const j1939_pgn_t pgn)
+{
+	for (size_t i = 0; i < PGN_POOL_SIZE; i++) {
+		if (change_cfg[i].pgn == pgn) {
+			return &change_cfg[i];
+		}
+	}
+	return NULL;
+}
+
+static int change_add(const j1939_pgn_t pgn, struct change_only *cfg)
+{
+	cfg->pgn = pgn;
+	num_change++;
+	return 0;
+}
+
+static void change_del(struct change_only *cfg)
+{
+	cfg->pgn = PGN_UNDEF;
+	num_change--;
+}
+
+static inline bool change_any(void)
+{
+	return num_change > 0;
+}
+
+static struct last_value *value_find(const j1939_pgn_t pgn, const uint8_t src)
+{
+	for (uint32_t i = 0; i < num_values; i++) {
+		if (values[i].pgn == pgn && values[i].src == src) {
+			return &values[i];
+		}
+	}
+	return NULL;
+}
+
+static void value_add(struct last_value *last, const j1939_pgn_t pgn,
+		      const uint8_t src)
+{
+	last->pgn = pgn;
+	last->src = src;
+}
+
+/* free values[i], the last value moves into the slot */
+static void value_del(const uint32_t i)
+{
+	values[i] = values[--num_values];
+}
+#else
+static inline uint32_t value_key(const j1939_pgn_t pgn, const uint8_t src)
+{
+	return (pgn & PGN_MASK) | (src << 18);
+}
+
+static struct change_only *change_find(const j1939_pgn_t pgn)
+{
+	struct hasht_entry *entry = hasht_search(&change_pgns, pgn);
+	return entry ? entry->item : NULL;
+}
+
+static int change_add(const j1939_pgn_t pgn, struct change_only *cfg)
+{
+	if (hasht_insert(&change_pgns, pgn, cfg) < 0) {
+		return -1;
+	}
+	cfg->pgn = pgn;
+	return 0;
+}
+
+static void change_del(struct change_only *cfg)
+{
+	hasht_delete(&change_pgns, cfg->pgn);
+	cfg->pgn = PGN_UNDEF;
+}
+
+static inline bool change_any(void)
+{
+	return change_pgns.size > 0;
+}
+
+static struct last_value *value_find(const j1939_pgn_t pgn, const uint8_t src)
+{
+	struct hasht_entry *entry;
+
+	entry = hasht_search(&value_cache, value_key(pgn, src));
+	return entry ? entry->item : NULL;
+}
+
+static void value_add(struct last_value *last, const j1939_pgn_t pgn,
+		      const uint8_t src)
+{
+	last->pgn = pgn;
+	last->src = src;
+	hasht_insert(&value_cache, value_key(pgn, src), last);
+}
+
+/* free values[i], the last value moves into the slot */
+static void value_del(const uint32_t i)
 {
 	struct hasht_entry *entry;
+
+	hasht_delete(&value_cache, value_key(values[i].pgn, values[i].src));
+	if (i == --num_values) {
+		return;
+	}
+	values[i] = values[num_values];
+	entry = hasht_search(&value_cache,
+			     value_key(values[i].pgn, values[i].src));
+	entry->item = &values[i];
+}
+#endif
+
+/* Least recently delivered value, recycled when the cache is full */
+static uint32_t value_oldest(const uint32_t now)
+{
+	uint32_t oldest = 0;
+
+	for (uint32_t i = 1; i < num_values; i++) {
+		if (now - values[i].time > now - values[oldest].time) {
+			oldest = i;
+		}
+	}
+	return oldest;
+}
+
+int pgn_change_only(const uint32_t pgn, const uint32_t refresh_ms)
+{
+	struct change_only *cfg;
+
+	cfg = change_find(pgn);
+	if (cfg == NULL) {
+		cfg = change_slot();
+		if (cfg == NULL || change_add(pgn, cfg) < 0) {
+			return -ERR_TOO_MANY_PGN;
+		}
+	}
+	cfg->refresh = refresh_ms;
+
+	/* the next frame of every source is delivered */
+	for (uint32_t i = 0; i < num_values; i++) {
+		if (values[i].pgn == pgn) {
+			values[i].len = LEN_UNDEF;
+		}
+	}
+	return 0;
+}
+
+int pgn_change_only_off(const uint32_t pgn)
+{
+	struct change_only *cfg = change_find(pgn);
+
+	if (cfg == NULL) {
+		return -ERR_PGN_UNKNOWN;
+	}
+	change_del(cfg);
+
+	for (uint32_t i = 0; i < num_values;) {
+		if (values[i].pgn == pgn) {
+			value_del(i);
+		} else {
+			i++;
+		}
+	}
+	return 0;
+}
+
+void pgn_change_only_clear(void)
+{
+#if defined(J1939_COMPACT)
+	num_change = 0;
+#else
+	change_pgns.items = change_entries;
+	change_pgns.max_size = PGN_POOL_SIZE;
+	change_pgns.size = 0;
+	hasht_init(&change_pgns);
+
+	value_cache.items = value_entries;
+	value_cache.max_size = PGN_VALUE_CACHE_SIZE;
+	value_cache.size = 0;
+	hasht_init(&value_cache);
+#endif
+	for (size_t i = 0; i < PGN_POOL_SIZE; i++) {
+		change_cfg[i].pgn = PGN_UNDEF;
+	}
+	num_values = 0;
+}
+
+/*
+ * True if the payload is the last one delivered for the PGN and source,
+ * and the refresh period has not elapsed. A new PGN/source pair takes the
+ * slot of the least recently delivered one when the cache is full.
+ */
+static bool unchanged(const j1939_pgn_t pgn, const uint8_t src,
+		      const uint8_t *data, const uint8_t len)
+{
+	const struct change_only *cfg;
+	struct last_value *last;
+	uint64_t v = 0;
+	uint32_t now;
+
+	cfg = change_find(pgn);
+	if (cfg == NULL) {
+		return false;
+	}
+
+	memcpy(&v, data, len);
+	now = j1939_get_time();
+
+	last = value_find(pgn, src);
+	if (last) {
+		if (last->data == v && last->len == len &&
+		    (cfg->refresh == 0 || now - last->time < cfg->refresh)) {
+			return true;
+		}
+	} else {
+		if (num_values == PGN_VALUE_CACHE_SIZE) {
+			value_del(value_oldest(now));
+		}
+		last = &values[num_values];
+		value_add(last, pgn, src);
+		num_values++;
+	}
+
+	last->data = v;
+	last->len = len;
+	last->time = now;
+	return false;
+}
+
+#if defined(J1939_COMPACT)
+static inline void index_subscription(const int id __arg_unused,
+				      const bool set __arg_unused)
+{
+}
+#else
+static inline void index_field(uint32_t (*rows)[SUB_WORDS],
+			       const size_t num_rows, const uint32_t value,
+			       const uint32_t mask, const int id, const bool set)
+{
+	const uint32_t bit = 1u << (id % 32);
+
+	for (size_t v = 0; v < num_rows; v++) {
+		uint32_t *w = &rows[v][id / 32];
+		if (set && ((v ^ value) & mask) == 0) {
+			*w |= bit;
+		} else {
+			*w &= ~bit;
+		}
+	}
+}
+
+static void index_subscription(const int id, const bool set)
+{
+	const struct pgn_subscription *sub = &subs[id];
+
+	index_field(sub_index.page, 4, sub->pgn >> 16, sub->pgn_mask >> 16,
+		    id, set);
+	index_field(sub_index.pf, 256, PGN_FORMAT(sub->pgn),
+		    PGN_FORMAT(sub->pgn_mask), id, set);
+	index_field(sub_index.ps, 256, PGN_SPECIFIC(sub->pgn),
+		    PGN_SPECIFIC(sub->pgn_mask), id, set);
+	index_field(sub_index.src, 256, sub->src, sub->src_mask, id, set);
+	index_field(sub_index.dst, 256, sub->dst, sub->dst_mask, id, set);
+}
+#endif
+
+int pgn_subscribe(const struct pgn_subscription *sub)
+{
+	if (IS_NULL(sub) || IS_NULL(sub->cb)) {
+		return -ERR_PGN_UNKNOWN;
+	}
+
+	for (int id = 0; id < PGN_SUBSCRIPTIONS; id++) {
+		if (subs[id].cb == NULL) {
+			subs[id] = *sub;
+			index_subscription(id, true);
+			num_subs++;
+			return id;
+		}
+	}
+	return -ERR_TOO_MANY_PGN;
+}
+
+int pgn_unsubscribe(const int id)
+{
+	if (id < 0 || id >= PGN_SUBSCRIPTIONS || subs[id].cb == NULL) {
+		return -ERR_PGN_UNKNOWN;
+	}
+
+	index_subscription(id, false);
+	subs[id].cb = NULL;
+	num_subs--;
+	return 0;
+}
+
+void pgn_unsubscribe_all(void)
+{
+	memset(subs, 0, sizeof(subs));
+#if !defined(J1939_COMPACT)
+	memset(&sub_index, 0, sizeof(sub_index));
+#endif
+	num_subs = 0;
+}
+
+#if defined(J1939_COMPACT)
+static inline bool sub_match(const struct pgn_subscription *sub,
+			     const j1939_pgn_t pgn, const uint8_t src,
+			     const uint8_t dest)
+{
+	return ((pgn ^ sub->pgn) & sub->pgn_mask) == 0 &&
+	       ((src ^ sub->src) & sub->src_mask) == 0 &&
+	       ((dest ^ sub->dst) & sub->dst_mask) == 0;
+}
+
+static int fan_out(const j1939_pgn_t pgn, const uint8_t priority,
+		   const uint8_t src, const uint8_t dest, uint8_t *data,
+		   const uint8_t len, int ret)
+{
+	for (int id = 0; id < PGN_SUBSCRIPTIONS; id++) {
+		/* may be removed by a previous callback */
+		const pgn_callback_t cb = subs[id].cb;
+		if (cb && sub_match(&subs[id], pgn, src, dest)) {
+			int r = (*cb)(pgn, priority, src, dest, data, len);
+			if (r < 0 && ret >= 0) {
+				ret = r;
+			}
+		}
+	}
+	return ret;
+}
+#else
+static inline int lowest_bit(const uint32_t m)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(m);
+#else
+	int i = 0;
+	while ((m & (1u << i)) == 0) {
+		i++;
+	}
+	return i;
+#endif
+}
+
+static int fan_out(const j1939_pgn_t pgn, const uint8_t priority,
+		   const uint8_t src, const uint8_t dest, uint8_t *data,
+		   const uint8_t len, int ret)
+{
+	const uint32_t *page = sub_index.page[(pgn >> 16) & 0x3u];
+	const uint32_t *pf = sub_index.pf[PGN_FORMAT(pgn)];
+	const uint32_t *ps = sub_index.ps[PGN_SPECIFIC(pgn)];
+	const uint32_t *s = sub_index.src[src];
+	const uint32_t *d = sub_index.dst[dest];
+
+	for (uint32_t w = 0; w < SUB_WORDS; w++) {
+		uint32_t m = page[w] & pf[w] & ps[w] & s[w] & d[w];
+		while (m != 0) {
+			const int id = w * 32 + lowest_bit(m);
+			/* may be removed by a previous callback */
+			const pgn_callback_t cb = subs[id].cb;
+			m &= m - 1;
+			if (cb) {
+				int r = (*cb)(pgn, priority, src, dest, data,
+					      len);
+				if (r < 0 && ret >= 0) {
+					ret = r;
+				}
+			}
+		}
+	}
+	return ret;
+}
+#endif
+
+static int dispatch(const j1939_pgn_t pgn, const uint8_t priority,
+		    const uint8_t src, const uint8_t dest, uint8_t *data,
+		    const uint8_t len)
+{
+	struct pgn_table *t;
+	struct hasht_entry *entry;
+	pgn_callback_t cb = NULL;
+	uint32_t idx;
+	int code;
+	int ret = len;
+
+#if defined(J1939_WITH_STORE)
+	j1939_store_update(pgn, src, data, len);
+#endif
+
+	if (change_any() && unchanged(pgn, src, data, len)) {
+		return len;
+	}
+
+	/* the callback runs outside of the lookup, it may (de)register */
+	t = table_enter(&idx);
+	code = mux_code(t, pgn, data, len);
+	if (code >= 0) {
+		entry = hasht_search(&t->pool, make_key(pgn, code));
+		if (entry) {
+#if defined(J1939_COMPACT)
+			cb = t->cbs[entry->item];
+#else
+			cb = (pgn_callback_t)entry->item;
+#endif
+		}
+	}
+	table_exit(idx);
+
+	if (cb) {
+		ret = (*cb)(pgn, priority, src, dest, data, len);
+	}
+	if (num_subs > 0) {
+		ret = fan_out(pgn, priority, src, dest, data, len, ret);
+	}
+	return ret;
+}
+
+int pgn_pool_receive(void)
+{
 	j1939_pgn_t pgn;
-	uint8_t code, src, priority, dest;
+	uint8_t src, priority, dest;
 	uint32_t len;
 	uint8_t data[8];
 	int ret;
 
 	ret = j1939_receive(&pgn, &priority, &src, &dest, data, &len);
 	if (ret > 0) {
-		code = (pgn == TP_CM) ? data[0] : 0;
-		entry = hasht_search(&pgn_pool, make_key(pgn, code));
-		if (entry && entry->item) {
-			pgn_callback_t cb = (pgn_callback_t)entry->item;
-			return (*cb)(pgn, priority, src, dest, data, len);
-		}
+		return dispatch(pgn, priority, src, dest, data, len);
 	}
 	return ret;
+}
+
+int pgn_pool_dispatch(const uint32_t id, uint8_t *data, const uint8_t len)
+{
+	j1939_pgn_t pgn;
+	uint8_t src, priority, dest;
+
+	if (unlikely(!data || len == 0 || len > 8)) {
+		return -1;
+	}
+
+	j1939_receive_frame(id, data, len, &pgn, &priority, &src, &dest);
+	return dispatch(pgn, priority, src, dest, data, len);
 }
\ No newline at end of file
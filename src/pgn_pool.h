@@ -10,9 +10,118 @@
 #define ERR_DUPLICATE_PGN 3
 
 void pgn_pool_init(void);
+
+/**
+ * @brief (De)register the callback of a PGN
+ *
+ * Safe from any thread and from the callbacks while frames are
+ * dispatched: the change is made on a copy of the table that replaces the
+ * published one, the lookups in progress finish on the old copy. A frame
+ * dispatched concurrently with pgn_deregister() may still reach the
+ * deregistered callback. Changes from several threads are serialized, a
+ * writer may yield (j1939_task_yield()) until the lookups on the copy it
+ * reuses are over.
+ *
+ * @return negative value in case of error
+ */
 int pgn_register(const uint32_t pgn, uint8_t code, pgn_callback_t cb);
 int pgn_deregister(const uint32_t pgn, uint8_t code);
 void pgn_deregister_all(void);
 int pgn_pool_receive(void);
 
+/**
+ * @brief Dispatch a PGN on one of its data bytes
+ *
+ * Frames of the PGN are delivered to the callback registered with
+ * pgn_register(pgn, code) where code is (data[byte] & mask), found with
+ * a single lookup. Frames not carrying the byte, or with a code nothing
+ * is registered for, only reach the subscriptions.
+ *
+ * TP_CM is multiplexed on its control byte (byte 0) by pgn_pool_init(),
+ * up to PGN_MUXES PGNs can be multiplexed. Like pgn_register(), it can
+ * be called while frames are dispatched.
+ *
+ * E.g. proprietary A messages told apart by the low nibble of byte 0:
+ * pgn_multiplex(0xEF00, 0, 0x0F); pgn_register(0xEF00, 0x3, cb);
+ *
+ * @param pgn PGN
+ * @param byte position of the multiplexer in the payload (0..7)
+ * @param mask bits of the multiplexer
+ * @return 0 on success, -ERR_TOO_MANY_PGN if PGN_MUXES PGNs are already
+ * multiplexed
+ */
+int pgn_multiplex(const uint32_t pgn, const uint8_t byte, const uint8_t mask);
+int pgn_multiplex_off(const uint32_t pgn);
+
+/**
+ * @brief Subscription to the PGNs, source and destination addresses
+ * matching the masks, in the style of struct j1939_pgn_filter: a frame
+ * matches when (field & mask) == (value & mask) for all the fields.
+ *
+ * E.g. all the Proprietary B PGNs from any source:
+ * { .pgn = 0xFF00, .pgn_mask = 0x3FF00, .cb = ... }
+ */
+struct pgn_subscription {
+	j1939_pgn_t pgn;
+	j1939_pgn_t pgn_mask;
+	uint8_t src;
+	uint8_t src_mask;
+	uint8_t dst;
+	uint8_t dst_mask;
+	pgn_callback_t cb;
+};
+
+/**
+ * @brief Add a subscriber
+ *
+ * Unlike pgn_register(), the subscriptions are changed in place: call
+ * pgn_subscribe(), pgn_unsubscribe() and pgn_unsubscribe_all() from the
+ * thread dispatching the frames only (e.g. from a callback, or between two
+ * pgn_pool_receive() calls).
+ *
+ * Any number of subscriptions may match the same frame: they are called
+ * in id order, after the callback registered with pgn_register() for the
+ * PGN (if any). A subscription takes the lowest free id, the one of a
+ * removed subscription included, so it is not always called last.
+ *
+ * @return subscription id, -ERR_TOO_MANY_PGN if PGN_SUBSCRIPTIONS are
+ * already in use
+ */
+int pgn_subscribe(const struct pgn_subscription *sub);
+int pgn_unsubscribe(const int id);
+void pgn_unsubscribe_all(void);
+
+/**
+ * @brief Deliver a PGN only when its payload changes
+ *
+ * The last payload delivered for every source of the PGN is cached (up to
+ * PGN_VALUE_CACHE_SIZE PGN/source pairs, the least recently delivered
+ * pair makes room for a new one): frames with the same payload are
+ * dropped before running any callback.
+ *
+ * The dispatching thread updates the cache for every frame: call
+ * pgn_change_only(), pgn_change_only_off() and pgn_change_only_clear()
+ * from that thread only, like pgn_subscribe().
+ *
+ * @param pgn PGN
+ * @param refresh_ms deliver unchanged payloads anyway once refresh_ms [msec]
+ * have elapsed since the last delivery, 0 to never do that
+ * @return 0 on success, -ERR_TOO_MANY_PGN if PGN_POOL_SIZE PGNs are
+ * already change-only
+ */
+int pgn_change_only(const uint32_t pgn, const uint32_t refresh_ms);
+int pgn_change_only_off(const uint32_t pgn);
+void pgn_change_only_clear(void);
+
+/**
+ * @brief Dispatch a frame not read through j1939_canrcv()
+ *
+ * @param id CAN identifier
+ * @param data payload
+ * @param len payload length (1..8)
+ * @return callback return value (the first negative one if more
+ * callbacks are called), len if no callback is registered
+ */
+int pgn_pool_dispatch(const uint32_t id, uint8_t *data, const uint8_t len);
+
 #endif /* __PGN_POOL_H__ */
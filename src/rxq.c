@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Interrupt driven reception
+ *
+ * head is written only by the interrupt, tail only by the task: each side
+ * publishes its index with a release store after touching the slot and
+ * reads the other one with an acquire load, so no lock (nor disabling
+ * interrupts) is needed. Indexes run freely, the slot is index & mask.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "atomic.h"
+#include "compiler.h"
+#include "config.h"
+#include "j1939.h"
+#include "j1939_rxq.h"
+#include "pgn_pool.h"
+
+#if !defined(J1939_RXQ_SIZE)
+#define J1939_RXQ_SIZE 64
+#endif
+
+#if (J1939_RXQ_SIZE & (J1939_RXQ_SIZE - 1)) != 0
+#error "J1939_RXQ_SIZE must be a power of two"
+#endif
+
+#define RXQ_MASK ((uint32_t)J1939_RXQ_SIZE - 1u)
+
+struct rxq_frame {
+	uint32_t id;
+	uint8_t len;
+	uint8_t data[8];
+};
+
+static struct rxq_frame ring[J1939_RXQ_SIZE];
+static atomic_t head;
+static atomic_t tail;
+/* written by the interrupt only */
+static atomic_t frames;
+static atomic_t overruns;
+static atomic_t high_water;
+
+static inline void isr_count(atomic_t *counter)
+{
+	atomic_set_release(counter,
+			   (atomic_t)((uint32_t)atomic_get_relaxed(counter) + 1u));
+}
+
+int j1939_rxq_push_isr(const uint32_t id, const uint8_t *data,
+		       const uint8_t len)
+{
+	const uint32_t h = (uint32_t)atomic_get_relaxed(&head);
+	const uint32_t used = h - (uint32_t)atomic_get_acquire(&tail);
+	struct rxq_frame *f;
+
+	if (unlikely(used > RXQ_MASK)) {
+		isr_count(&overruns);
+		return -J1939_EBUSY;
+	}
+
+	f = &ring[h & RXQ_MASK];
+	f->id = id;
+	f->len = len > 8u ? 8u : len;
+	memcpy(f->data, data, f->len);
+	atomic_set_release(&head, (atomic_t)(h + 1u));
+
+	isr_count(&frames);
+	if (used + 1u > (uint32_t)atomic_get_relaxed(&high_water)) {
+		atomic_set_release(&high_water, (atomic_t)(used + 1u));
+	}
+	return 0;
+}
+
+uint32_t j1939_process(const uint32_t max)
+{
+	const uint32_t h = (uint32_t)atomic_get_acquire(&head);
+	uint32_t t = (uint32_t)atomic_get_relaxed(&tail);
+	uint32_t n = h - t;
+	struct rxq_frame f;
+
+	if (max != 0 && n > max) {
+		n = max;
+	}
+
+	for (uint32_t i = 0; i < n; i++, t++) {
+		/* free the slot before running the callbacks */
+		f = ring[t & RXQ_MASK];
+		atomic_set_release(&tail, (atomic_t)(t + 1u));
+		if (f.len > 0) {
+			pgn_pool_dispatch(f.id, f.data, f.len);
+		}
+	}
+	return n;
+}
+
+uint32_t j1939_rxq_pending(void)
+{
+	return (uint32_t)atomic_get_acquire(&head) -
+	       (uint32_t)atomic_get_acquire(&tail);
+}
+
+void j1939_rxq_get_stats(struct j1939_rxq_stats *stats)
+{
+	if (IS_NULL(stats)) {
+		return;
+	}
+	stats->frames = (uint32_t)atomic_get_acquire(&frames);
+	stats->overruns = (uint32_t)atomic_get_acquire(&overruns);
+	stats->high_water = (uint32_t)atomic_get_acquire(&high_water);
+}
@@ -3,17 +3,49 @@
 #ifndef __SESSION_H__
 #define __SESSION_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "atomic.h"
+#include "config.h"
+
+/* Fields sorted by size, not to pad them */
 struct j1939_session {
+	atomic_t cts_done;
+	atomic_t eom_ack;
+	/* sender: the receiver sent a TP.CM abort */
+	atomic_t aborted;
+	/* bumped on every CTS/EOM ACK/abort, j1939_wait() address */
+	atomic_t wake;
+	uint32_t timeout;
+	/* PGN being transferred */
+	uint32_t pgn;
+	uint16_t eom_ack_size;
+	uint16_t tp_tot_size;
+	/* receiver: max time [msec] from timeout to the next packet */
+	uint16_t rx_period;
 	int8_t id;
+	uint8_t src;
+	uint8_t dst;
+	/* receiver side of a connection (RTS received) */
+	bool rx;
+	/* receiver: CTS sent again without receiving any packet */
+	uint8_t rx_retries;
 	uint8_t cts_num_packets;
 	uint8_t cts_next_packet;
-	uint16_t eom_ack_size;
 	uint8_t eom_ack_num_packets;
 	uint8_t tp_num_packets;
-	uint16_t tp_tot_size;
-	atomic_t cts_done;
-	atomic_t eom_ack;
-	uint32_t timeout;
+	/* receiver: last packet of the current CTS window */
+	uint8_t cts_end;
+	/* receiver: bit n set if packet n (1..255) has been received */
+	uint8_t rx_map[32];
+#if defined(J1939_WITH_ISOTP)
+	/* ISO-TP sender: last Flow Control received (see isotp.c) */
+	bool isotp;
+	uint8_t fc_status;
+	uint8_t fc_block_size;
+	uint8_t fc_st_min;
+#endif
 };
 
 void j1939_session_init(void);
@@ -23,5 +55,9 @@ int j1939_session_close(const uint8_t src, const uint8_t dest);
 struct j1939_session *j1939_session_search(const uint16_t id);
 struct j1939_session *j1939_session_search_addr(const uint16_t src,
 						const uint16_t dst);
+/* Session in slot i (0..MAX_J1939_SESSIONS - 1), NULL if the slot is free */
+struct j1939_session *j1939_session_get(const size_t i);
+/* Wake up the sender waiting on sess->wake */
+void j1939_session_notify(struct j1939_session *sess);
 
 #endif /* __SESSION_H__ */
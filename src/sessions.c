@@ -4,7 +4,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "atomic.h"
+#include "compiler.h"
 #include "hasht.h"
+#include "j1939.h"
 #include "session.h"
 
 #define SESSION_UNDEF (-1)
@@ -12,9 +14,11 @@
 #error "MAX_J1939_SESSIONS not defined"
 #endif
 
-static struct j1939_session session_dict[MAX_J1939_SESSIONS];
-static struct hasht_entry entries[MAX_J1939_SESSIONS];
-static struct hasht sessions = HASHT_INIT(entries, MAX_J1939_SESSIONS);
+static __j1939_state struct j1939_session session_dict[MAX_J1939_SESSIONS];
+#if !defined(J1939_COMPACT)
+static __j1939_state struct hasht_entry entries[MAX_J1939_SESSIONS];
+static __j1939_state struct hasht sessions;
+#endif
 
 uint16_t j1939_session_hash(const uint8_t s, const uint8_t d)
 {
@@ -23,7 +27,12 @@ uint16_t j1939_session_hash(const uint8_t s, const uint8_t d)
 
 void j1939_session_init(void)
 {
+#if !defined(J1939_COMPACT)
+	sessions.items = entries;
+	sessions.max_size = MAX_J1939_SESSIONS;
+	sessions.size = 0;
 	hasht_init(&sessions);
+#endif
 	for (size_t i = 0; i < MAX_J1939_SESSIONS; i++) {
 		session_dict[i].id = SESSION_UNDEF;
 	}
@@ -49,7 +58,15 @@ struct j1939_session *j1939_session_open(const uint8_t src, const uint8_t dest)
 	if (j1939_session_search(key) == NULL) {
 		sess = assign_session();
 		if (sess) {
-			hasht_insert(&sessions, key, sess);
+			sess->src = src;
+			sess->dst = dest;
+#if !defined(J1939_COMPACT)
+			if (hasht_insert(&sessions, key, sess) < 0) {
+				/* j1939_session_init() not called yet */
+				sess->id = SESSION_UNDEF;
+				return NULL;
+			}
+#endif
 			return sess;
 		}
 	}
@@ -63,12 +80,35 @@ struct j1939_session *j1939_session_search_addr(const uint16_t src,
 	return j1939_session_search(key);
 }
 
+#if defined(J1939_COMPACT)
+/* A handful of sessions, scanning them is cheaper than a hash table */
+struct j1939_session *j1939_session_search(const uint16_t id)
+{
+	for (size_t i = 0; i < MAX_J1939_SESSIONS; i++) {
+		if (session_dict[i].id >= 0 &&
+		    j1939_session_hash(session_dict[i].src,
+				       session_dict[i].dst) == id) {
+			return &session_dict[i];
+		}
+	}
+	return NULL;
+}
+#else
 struct j1939_session *j1939_session_search(const uint16_t id)
 {
 	struct hasht_entry *s;
 	s = hasht_search(&sessions, id);
 	return s != NULL ? (struct j1939_session *)s->item : NULL;
 }
+#endif
+
+struct j1939_session *j1939_session_get(const size_t i)
+{
+	if (i < MAX_J1939_SESSIONS && session_dict[i].id >= 0) {
+		return &session_dict[i];
+	}
+	return NULL;
+}
 
 int j1939_session_close(const uint8_t src, const uint8_t dest)
 {
@@ -77,7 +117,17 @@ int j1939_session_close(const uint8_t src, const uint8_t dest)
 	sess = j1939_session_search(key);
 	if (sess) {
 		sess->id = SESSION_UNDEF;
+#if defined(J1939_COMPACT)
+		return 0;
+#else
 		return hasht_delete(&sessions, key);
+#endif
 	}
 	return -1;
 }
+
+void j1939_session_notify(struct j1939_session *sess)
+{
+	atomic_inc(&sess->wake);
+	j1939_wake(&sess->wake);
+}
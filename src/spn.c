@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * J1939 SPN decoding
+ *
+ * PGN payloads are little-endian: SPNs are extracted loading the payload
+ * into a 64-bit word and using a shift and a mask, so that the same code
+ * runs on both little and big endian targets (e.g. TMS570).
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "j1939.h"
+#include "j1939_spn.h"
+#include "compiler.h"
+
+static inline uint64_t load_le64(const uint8_t *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+	       ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+	       ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+	       ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline uint64_t spn_mask(const uint8_t length)
+{
+	return ((uint64_t)1 << length) - 1u;
+}
+
+static inline uint8_t spn_status(const struct j1939_spn_def *def,
+				 const uint32_t raw)
+{
+	return (uint8_t)((raw > def->max) + (raw >= def->na));
+}
+
+static inline bool spn_valid_def(const struct j1939_spn_def *def)
+{
+	return def->length > 0 && def->length <= J1939_SPN_MAX_BITS;
+}
+
+const struct j1939_spn_pgn *j1939_spn_find(const struct j1939_spn_pgn *table,
+					   const size_t num,
+					   const j1939_pgn_t pgn)
+{
+	size_t lo = 0;
+	size_t hi = num;
+
+	if (unlikely(!table)) {
+		return NULL;
+	}
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (table[mid].pgn == pgn) {
+			return &table[mid];
+		}
+		if (table[mid].pgn < pgn) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return NULL;
+}
+
+int j1939_spn_raw(const struct j1939_spn_def *def, const uint8_t *data,
+		  const uint32_t len, uint32_t *raw)
+{
+	uint64_t word = 0;
+	size_t first, last;
+
+	if (unlikely(!def || !data || !raw || !spn_valid_def(def))) {
+		return -J1939_EARGS;
+	}
+
+	if (unlikely((uint32_t)def->start_bit + def->length > len * 8u)) {
+		return -J1939_EWRONG_DATA_LEN;
+	}
+
+	/* at most 5 bytes hold a 32 bit SPN starting at any bit offset */
+	first = def->start_bit / 8u;
+	last = (def->start_bit + def->length - 1u) / 8u;
+	for (size_t i = last + 1; i-- > first;) {
+		word = (word << 8) | data[i];
+	}
+
+	*raw = (uint32_t)((word >> (def->start_bit % 8u)) &
+			  spn_mask(def->length));
+	return 0;
+}
+
+int j1939_spn_decode(const struct j1939_spn_pgn *pgn, const uint8_t *data,
+		     const uint32_t len, float *values, uint8_t *status)
+{
+	uint32_t raw;
+	uint8_t st;
+	int ret;
+
+	if (unlikely(!pgn || !data || !values)) {
+		return -J1939_EARGS;
+	}
+
+	for (size_t i = 0; i < pgn->num_spns; i++) {
+		const struct j1939_spn_def *def = &pgn->spns[i];
+
+		ret = j1939_spn_raw(def, data, len, &raw);
+		if (unlikely(ret < 0)) {
+			return ret;
+		}
+
+		st = spn_status(def, raw);
+		values[i] = (st == J1939_SPN_VALID) ?
+				    (float)raw * def->scale + def->offset :
+				    NAN;
+		if (status) {
+			status[i] = st;
+		}
+	}
+	return (int)pgn->num_spns;
+}
+
+int j1939_spn_decode_batch(const struct j1939_spn_pgn *pgn,
+			   const uint8_t (*frames)[8], const size_t nframes,
+			   float *const *values, uint8_t *const *status)
+{
+	if (unlikely(!pgn || !frames || !values)) {
+		return -J1939_EARGS;
+	}
+
+	for (size_t s = 0; s < pgn->num_spns; s++) {
+		const struct j1939_spn_def *def = &pgn->spns[s];
+		if (unlikely(!spn_valid_def(def) ||
+			     def->start_bit + def->length > 64u)) {
+			return -J1939_EARGS;
+		}
+	}
+
+	/*
+	 * One SPN at a time over all the frames: every column is written
+	 * sequentially and the loop body has no branches.
+	 */
+	for (size_t s = 0; s < pgn->num_spns; s++) {
+		const struct j1939_spn_def *def = &pgn->spns[s];
+		const uint64_t mask = spn_mask(def->length);
+		const uint8_t shift = (uint8_t)def->start_bit;
+		const float scale = def->scale;
+		const float offset = def->offset;
+		float *col = values[s];
+
+		for (size_t i = 0; i < nframes; i++) {
+			uint32_t raw = (uint32_t)((load_le64(frames[i]) >>
+						   shift) & mask);
+			float v = (float)raw * scale + offset;
+			col[i] = spn_status(def, raw) ? NAN : v;
+		}
+
+		if (status && status[s]) {
+			uint8_t *st_col = status[s];
+			for (size_t i = 0; i < nframes; i++) {
+				uint32_t raw = (uint32_t)((load_le64(frames[i]) >>
+							   shift) & mask);
+				st_col[i] = spn_status(def, raw);
+			}
+		}
+	}
+	return (int)nframes;
+}
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Latest value store
+ *
+ * Entries are allocated by the writer in an open addressing table and
+ * never move nor get freed: once its key is published a reader can keep
+ * using an entry, and only has to check its sequence number. The sequence
+ * is odd while the writer is updating the entry.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "j1939.h"
+#include "j1939_store.h"
+#include "atomic.h"
+#include "compiler.h"
+#include "config.h"
+#include "hasht.h"
+#include "pgn.h"
+
+#if !defined(PGN_POOL_SIZE)
+#error "PGN_POOL_SIZE not defined"
+#endif
+
+#if !defined(J1939_STORE_SIZE)
+#define J1939_STORE_SIZE 32
+#endif
+
+struct store_entry {
+	/* PGN and source + 1, 0 if free */
+	atomic_t key;
+	atomic_t seq;
+	uint32_t time;
+	uint8_t len;
+	uint8_t data[8];
+};
+
+static struct hasht_entry tracked_entries[PGN_POOL_SIZE];
+static struct hasht tracked = HASHT_INIT(tracked_entries, PGN_POOL_SIZE);
+static struct store_entry store[J1939_STORE_SIZE];
+static size_t num_entries;
+
+static inline atomic_t store_key(const j1939_pgn_t pgn, const uint8_t src)
+{
+	return (atomic_t)(((pgn & PGN_MASK) | ((uint32_t)src << 18)) + 1u);
+}
+
+static struct store_entry *lookup(const atomic_t key)
+{
+	size_t i = (uint32_t)key % J1939_STORE_SIZE;
+
+	for (size_t n = 0; n < J1939_STORE_SIZE; n++) {
+		atomic_t k = atomic_get_acquire(&store[i].key);
+		if (k == key) {
+			return &store[i];
+		}
+		if (k == 0) {
+			break;
+		}
+		i = (i + 1) % J1939_STORE_SIZE;
+	}
+	return NULL;
+}
+
+int j1939_store_track(const j1939_pgn_t pgn)
+{
+	struct hasht_entry *entry;
+
+	/* the static table is not initialized until the first PGN */
+	if (tracked.size == 0) {
+		hasht_clear(&tracked);
+	}
+	/* the keys are the tracked PGNs, the items are not used */
+	entry = hasht_search(&tracked, pgn);
+	if (entry) {
+		return 0;
+	}
+	if (hasht_insert(&tracked, pgn, 0) < 0) {
+		return -J1939_ENO_RESOURCE;
+	}
+	return 0;
+}
+
+void j1939_store_update(const j1939_pgn_t pgn, const uint8_t src,
+			const uint8_t *data, const uint8_t len)
+{
+	struct hasht_entry *entry;
+	struct store_entry *e;
+	const atomic_t key = store_key(pgn, src);
+	atomic_t seq;
+
+	if (tracked.size == 0) {
+		return;
+	}
+	entry = hasht_search(&tracked, pgn);
+	if (entry == NULL) {
+		return;
+	}
+
+	e = lookup(key);
+	if (e == NULL) {
+		size_t i = (uint32_t)key % J1939_STORE_SIZE;
+
+		if (num_entries == J1939_STORE_SIZE) {
+			return;
+		}
+		while (atomic_get_relaxed(&store[i].key) != 0) {
+			i = (i + 1) % J1939_STORE_SIZE;
+		}
+		e = &store[i];
+		e->time = j1939_get_time();
+		e->len = len;
+		memcpy(e->data, data, len);
+		/* publish the entry with its first value */
+		atomic_set_release(&e->key, key);
+		num_entries++;
+		return;
+	}
+
+	seq = atomic_get_relaxed(&e->seq);
+	atomic_set(&e->seq, seq + 1);
+	atomic_fence_release();
+	e->time = j1939_get_time();
+	e->len = len;
+	memcpy(e->data, data, len);
+	atomic_set_release(&e->seq, seq + 2);
+}
+
+int j1939_store_read(const j1939_pgn_t pgn, const uint8_t src,
+		     struct j1939_store_value *value)
+{
+	const struct store_entry *e;
+	atomic_t seq;
+
+	e = lookup(store_key(pgn, src));
+	if (IS_NULL(e) || IS_NULL(value)) {
+		return -J1939_ENODATA;
+	}
+
+	do {
+		seq = atomic_get_acquire(&e->seq);
+		value->time = e->time;
+		value->len = e->len;
+		memcpy(value->data, e->data, sizeof(value->data));
+		atomic_fence_acquire();
+	} while ((seq & 1) || seq != atomic_get_relaxed(&e->seq));
+
+	value->age = j1939_get_time() - value->time;
+	return 0;
+}
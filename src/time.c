@@ -17,3 +17,13 @@ bool elapsed(const uint32_t t, const uint32_t timeout)
 
 	return delta > timeout;
 }
+
+void wait_until(atomic_t *addr, const atomic_t expected, const uint32_t start,
+		const uint32_t timeout)
+{
+	const uint32_t waited = j1939_get_time() - start;
+
+	if (waited <= timeout) {
+		j1939_wait(addr, expected, timeout - waited + 1u);
+	}
+}
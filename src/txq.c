@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Multi-producer, single-consumer transmit queue
+ *
+ * Slot i of lap n has sequence number:
+ *   n * size + i       free, the producer reserving position n * size + i
+ *                      (CAS on head) fills it
+ *   n * size + i + 1   filled, the writer sends it and frees it for the
+ *                      next lap with n * size + i + size
+ *
+ * Positions and sequence numbers wrap around: they are only compared
+ * through their (signed) difference.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "atomic.h"
+#include "compiler.h"
+#include "j1939.h"
+#include "j1939_txq.h"
+
+static inline int seq_diff(const int a, const int b)
+{
+	return (int)((uint32_t)a - (uint32_t)b);
+}
+
+static inline int seq_add(const int a, const uint32_t n)
+{
+	return (int)((uint32_t)a + n);
+}
+
+int j1939_txq_init(struct j1939_txq *q, struct j1939_txq_frame *slots,
+		   const uint32_t num_slots)
+{
+	if (IS_NULL(q) || IS_NULL(slots) || num_slots < 2 ||
+	    (num_slots & (num_slots - 1)) != 0) {
+		return -J1939_EARGS;
+	}
+
+	q->slots = slots;
+	q->mask = num_slots - 1;
+	for (uint32_t i = 0; i < num_slots; i++) {
+		atomic_set(&slots[i].seq, (int)i);
+	}
+	atomic_set(&q->head, 0);
+	q->tail = 0;
+	atomic_set(&q->wake, 0);
+	atomic_set(&q->waiting, 0);
+	return 0;
+}
+
+int j1939_txq_push(struct j1939_txq *q, const uint32_t id,
+		   const uint8_t *data, const uint8_t len)
+{
+	struct j1939_txq_frame *f;
+	int pos, d;
+
+	if (unlikely(len > 8)) {
+		return -J1939_EARGS;
+	}
+
+	pos = atomic_get_relaxed(&q->head);
+	for (;;) {
+		f = &q->slots[(uint32_t)pos & q->mask];
+		d = seq_diff(atomic_get_acquire(&f->seq), pos);
+		if (d == 0) {
+			if (atomic_cas(&q->head, pos, seq_add(pos, 1))) {
+				break;
+			}
+			pos = atomic_get_relaxed(&q->head);
+		} else if (d < 0) {
+			/* the writer has not freed the slot yet */
+			return -J1939_EBUSY;
+		} else {
+			/* taken by another producer */
+			pos = atomic_get_relaxed(&q->head);
+		}
+	}
+
+	f->id = id;
+	f->len = len;
+	memcpy(f->data, data, len);
+	atomic_set_release(&f->seq, seq_add(pos, 1));
+
+	j1939_txq_kick(q);
+	return len;
+}
+
+void j1939_txq_kick(struct j1939_txq *q)
+{
+	/* see j1939_txq_wait() */
+	atomic_inc(&q->wake);
+	if (atomic_get(&q->waiting)) {
+		j1939_wake(&q->wake);
+	}
+}
+
+size_t j1939_txq_pop(struct j1939_txq *q, struct j1939_txq_frame *frames,
+		     const size_t max)
+{
+	const uint32_t size = q->mask + 1;
+	size_t n = 0;
+
+	while (n < max) {
+		struct j1939_txq_frame *f = &q->slots[(uint32_t)q->tail & q->mask];
+
+		if (atomic_get_acquire(&f->seq) != seq_add(q->tail, 1)) {
+			/* empty, or still being filled */
+			break;
+		}
+		frames[n].id = f->id;
+		frames[n].len = f->len;
+		memcpy(frames[n].data, f->data, f->len);
+		atomic_set_release(&f->seq, seq_add(q->tail, size));
+		q->tail = seq_add(q->tail, 1);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * The writer announces it is about to sleep before checking the queue, a
+ * producer bumps wake before checking the announcement: either the writer
+ * sees the frame or the producer sees the writer waiting. A wake bumped
+ * between the check and the sleep makes j1939_wait() return at once.
+ */
+void j1939_txq_wait(struct j1939_txq *q, const uint32_t timeout)
+{
+	const int wake = atomic_get(&q->wake);
+	const struct j1939_txq_frame *f;
+
+	atomic_set(&q->waiting, 1);
+	f = &q->slots[(uint32_t)q->tail & q->mask];
+	if (atomic_get(&f->seq) != seq_add(q->tail, 1)) {
+		j1939_wait(&q->wake, wake, timeout);
+	}
+	atomic_set(&q->waiting, 0);
+}
@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Generate specialized J1939 decoders/encoders from a DBC file.
+
+For every J1939 message in the DBC the generator emits:
+
+  - a structure holding the physical value of every signal,
+  - a decode function made of straight-line shifts and masks,
+  - an encode function filling unused bits with 1 (not available),
+  - an SPN table compatible with j1939_spn.h,
+
+plus the list of PGNs as registration table and kernel filters.
+
+Usage:
+  dbc2c.py --dbc file.dbc --out-c j1939_dbc.c --out-h j1939_dbc.h
+  dbc2c.py --dbc file.dbc --out-cmake j1939_dbc.cmake
+"""
+
+import argparse
+import re
+import sys
+
+PGN_MASK = 0x3FFFF
+
+RE_BO = re.compile(r'^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+(\w+)')
+RE_SG = re.compile(r'^SG_\s+(\w+)\s*(?:(M|m\d+)\s*)?:\s*(\d+)\|(\d+)@([01])([+-])'
+                   r'\s*\(([^,]+),([^)]+)\)\s*\[([^|]*)\|([^\]]*)\]\s*"([^"]*)"')
+RE_SPN = re.compile(r'^BA_\s+"SPN"\s+SG_\s+(\d+)\s+(\w+)\s+(\d+)\s*;')
+
+
+class Signal:
+    def __init__(self, name, start, length, signed, scale, offset, unit):
+        self.name = name
+        self.start = start
+        self.length = length
+        self.signed = signed
+        self.scale = scale
+        self.offset = offset
+        self.unit = unit
+        self.spn = 0
+
+
+class Message:
+    def __init__(self, can_id, name, dlc):
+        self.can_id = can_id
+        self.name = name
+        self.dlc = dlc
+        self.signals = []
+
+    @property
+    def pgn(self):
+        pgn = (self.can_id >> 8) & PGN_MASK
+        if ((pgn >> 8) & 0xFF) < 240:
+            pgn &= ~0xFF
+        return pgn
+
+    @property
+    def p2p(self):
+        return ((self.pgn >> 8) & 0xFF) < 240
+
+
+def ident(name):
+    name = re.sub(r'(?<=[a-z0-9])(?=[A-Z])', '_', name)
+    return re.sub(r'[^0-9a-zA-Z_]', '_', name).lower()
+
+
+def parse_dbc(path):
+    messages = {}
+    current = None
+
+    with open(path, encoding='latin-1') as f:
+        for line in f:
+            line = line.strip()
+            m = RE_BO.match(line)
+            if m:
+                can_id = int(m.group(1))
+                current = None
+                # J1939 messages use extended (29-bit) identifiers
+                if not can_id & 0x80000000:
+                    continue
+                current = Message(can_id & 0x1FFFFFFF, m.group(2),
+                                  int(m.group(3)))
+                messages[current.can_id] = current
+                continue
+
+            m = RE_SG.match(line)
+            if m and current is not None:
+                if m.group(2):
+                    sys.stderr.write('dbc2c: multiplexed signal %s.%s '
+                                     'skipped\n' % (current.name, m.group(1)))
+                    continue
+                if m.group(5) != '1':
+                    sys.stderr.write('dbc2c: big endian signal %s.%s '
+                                     'skipped\n' % (current.name, m.group(1)))
+                    continue
+                length = int(m.group(4))
+                if length > 32:
+                    sys.stderr.write('dbc2c: signal %s.%s longer than '
+                                     '32 bits skipped\n'
+                                     % (current.name, m.group(1)))
+                    continue
+                current.signals.append(Signal(m.group(1), int(m.group(3)),
+                                              length, m.group(6) == '-',
+                                              float(m.group(7)),
+                                              float(m.group(8)),
+                                              m.group(11)))
+                continue
+
+            m = RE_SPN.match(line)
+            if m:
+                msg = messages.get(int(m.group(1)) & 0x1FFFFFFF)
+                if msg is None:
+                    continue
+                for sig in msg.signals:
+                    if sig.name == m.group(2):
+                        sig.spn = int(m.group(3))
+
+    # one decoder per PGN, the first definition wins
+    by_pgn = {}
+    for msg in messages.values():
+        if msg.signals and msg.pgn not in by_pgn:
+            by_pgn[msg.pgn] = msg
+    return [by_pgn[p] for p in sorted(by_pgn)]
+
+
+def na_threshold(length):
+    if length >= 8:
+        return 0xFF << (length - 8)
+    if length > 1:
+        return (1 << length) - 1
+    return 0xFFFFFFFF
+
+
+def valid_max(length):
+    """Largest valid raw value: 0xFA, 0xFAFF, 0xFAFFFFFF... (J1939-71)"""
+    if length >= 8:
+        return (0xFB << (length - 8)) - 1
+    if length > 1:
+        return (1 << length) - 3
+    return 1
+
+
+def cfloat(v):
+    s = repr(float(v)) + 'f'
+    return '(%s)' % s if v < 0 else s
+
+
+def byte_chunks(sig):
+    """Yield (byte, shift_in_byte, nbits, shift_in_value) for a signal"""
+    pos = sig.start
+    done = 0
+    while done < sig.length:
+        byte = pos // 8
+        bit = pos % 8
+        n = min(8 - bit, sig.length - done)
+        yield byte, bit, n, done
+        pos += n
+        done += n
+
+
+def gen_extract(sig):
+    terms = []
+    for byte, bit, n, shift in byte_chunks(sig):
+        term = '(uint32_t)data[%d]' % byte
+        if bit:
+            term = '(%s >> %d)' % (term, bit)
+        if n != 8:
+            term = '(%s & 0x%Xu)' % (term, (1 << n) - 1)
+        if shift:
+            term = '(%s << %d)' % (term, shift)
+        terms.append(term)
+    return ' |\n\t      '.join(terms)
+
+
+def gen_insert(sig):
+    lines = []
+    for byte, bit, n, shift in byte_chunks(sig):
+        mask = ((1 << n) - 1) << bit
+        val = 'raw'
+        if shift:
+            val = '(raw >> %d)' % shift
+        if n == 8:
+            lines.append('\tdata[%d] = (uint8_t)%s;' % (byte, val))
+            continue
+        if bit:
+            val = '(%s << %d)' % (val, bit)
+        lines.append('\tdata[%d] = (uint8_t)((data[%d] & 0x%02Xu) | '
+                     '(%s & 0x%02Xu));'
+                     % (byte, byte, ~mask & 0xFF, val, mask))
+    return '\n'.join(lines)
+
+
+def gen_header(messages, out):
+    w = out.write
+    w('/* SPDX-License-Identifier: Apache-2.0 */\n\n')
+    w('/* Generated by tools/dbc2c.py, do not edit */\n\n')
+    w('#ifndef __J1939_DBC_H__\n#define __J1939_DBC_H__\n\n')
+    w('#include <stdbool.h>\n#include <stddef.h>\n#include <stdint.h>\n')
+    w('#include "j1939.h"\n#include "j1939_spn.h"\n\n')
+    w('#define J1939_DBC_NUM_PGNS %du\n\n' % len(messages))
+    for msg in messages:
+        n = ident(msg.name)
+        w('#define J1939_DBC_PGN_%s 0x%05Xu\n\n' % (n.upper(), msg.pgn))
+        w('struct j1939_dbc_%s {\n' % n)
+        for sig in msg.signals:
+            unit = (' [%s]' % sig.unit) if sig.unit else ''
+            w('\t/* SPN %d%s */\n' % (sig.spn, unit))
+            w('\tfloat %s;\n' % ident(sig.name))
+        w('};\n\n')
+        w('int j1939_dbc_decode_%s(const uint8_t *data, const uint32_t len,\n'
+          '\t\t\tstruct j1939_dbc_%s *msg);\n' % (n, n))
+        w('int j1939_dbc_encode_%s(const struct j1939_dbc_%s *msg,\n'
+          '\t\t\tuint8_t *data, const uint32_t len);\n\n' % (n, n))
+    w('/** @brief SPN tables sorted by PGN, see j1939_spn_find() */\n')
+    w('extern const struct j1939_spn_pgn j1939_dbc_spn_table[];\n\n')
+    w('/** @brief Acceptance filters, one per PGN, see j1939_filter() */\n')
+    w('extern struct j1939_pgn_filter j1939_dbc_filters[];\n\n')
+    w('/**\n * @brief Register the same callback for every PGN in the DBC\n')
+    w(' *\n * @param cb callback invoked on reception\n')
+    w(' * @return 0 on success, a negative value otherwise\n */\n')
+    w('int j1939_dbc_register(pgn_callback_t cb);\n\n')
+    w('#endif /* __J1939_DBC_H__ */\n')
+
+
+def gen_source(messages, header, out):
+    w = out.write
+    w('/* SPDX-License-Identifier: Apache-2.0 */\n\n')
+    w('/* Generated by tools/dbc2c.py, do not edit */\n\n')
+    w('#include <math.h>\n#include <stdbool.h>\n#include <stdint.h>\n'
+      '#include <string.h>\n')
+    w('#include "%s"\n#include "compiler.h"\n#include "pgn_pool.h"\n\n'
+      % header)
+
+    for msg in messages:
+        n = ident(msg.name)
+        w('int j1939_dbc_decode_%s(const uint8_t *data, const uint32_t len,\n'
+          '\t\t\tstruct j1939_dbc_%s *msg)\n{\n' % (n, n))
+        w('\tuint32_t raw;\n\n')
+        w('\tif (unlikely(!data || !msg || len < %du)) {\n'
+          '\t\treturn -J1939_EWRONG_DATA_LEN;\n\t}\n\n' % msg.dlc)
+        for sig in msg.signals:
+            f = ident(sig.name)
+            w('\traw = %s;\n' % gen_extract(sig))
+            if sig.signed:
+                # sign extension, signed signals have no NA/error range
+                w('\tmsg->%s = (float)((int64_t)(raw ^ 0x%Xu) - 0x%XLL) *\n'
+                  '\t\t%s + %s;\n'
+                  % (f, 1 << (sig.length - 1), 1 << (sig.length - 1),
+                     cfloat(sig.scale), cfloat(sig.offset)))
+            else:
+                w('\tmsg->%s = raw > 0x%Xu ? NAN :\n'
+                  '\t\t(float)raw * %s + %s;\n'
+                  % (f, valid_max(sig.length), cfloat(sig.scale),
+                     cfloat(sig.offset)))
+        w('\treturn 0;\n}\n\n')
+
+        w('int j1939_dbc_encode_%s(const struct j1939_dbc_%s *msg,\n'
+          '\t\t\tuint8_t *data, const uint32_t len)\n{\n' % (n, n))
+        w('\tuint32_t raw;\n\n')
+        w('\tif (unlikely(!data || !msg || len < %du)) {\n'
+          '\t\treturn -J1939_EWRONG_DATA_LEN;\n\t}\n\n' % msg.dlc)
+        w('\tmemset(data, J1930_NA_8, %du);\n' % msg.dlc)
+        for sig in msg.signals:
+            f = ident(sig.name)
+            mask = (1 << sig.length) - 1
+            w('\tif (isnan(msg->%s)) {\n\t\traw = 0x%Xu;\n\t} else {\n'
+              % (f, na_threshold(sig.length) & mask))
+            if sig.signed:
+                w('\t\tfloat v = (msg->%s - %s) / %s;\n'
+                  % (f, cfloat(sig.offset), cfloat(sig.scale)))
+                w('\t\traw = (uint32_t)(int32_t)(v < 0.0f ? v - 0.5f : '
+                  'v + 0.5f) &\n\t\t      0x%Xu;\n' % mask)
+            else:
+                w('\t\tfloat v = (msg->%s - %s) / %s + 0.5f;\n'
+                  % (f, cfloat(sig.offset), cfloat(sig.scale)))
+                w('\t\traw = v <= 0.0f ? 0u : v >= (float)0x%Xu ? 0x%Xu :\n'
+                  '\t\t      (uint32_t)v;\n'
+                  % (valid_max(sig.length), valid_max(sig.length)))
+            w('\t}\n%s\n' % gen_insert(sig))
+        w('\treturn %d;\n}\n\n' % msg.dlc)
+
+        w('static const struct j1939_spn_def %s_spns[] = {\n' % n)
+        for sig in msg.signals:
+            w('\tJ1939_SPN_DEF(%d, %d, %d, %s, %s),\n'
+              % (sig.spn, sig.start, sig.length, cfloat(sig.scale),
+                 cfloat(sig.offset)))
+        w('};\n\n')
+
+    w('const struct j1939_spn_pgn j1939_dbc_spn_table[] = {\n')
+    for msg in messages:
+        n = ident(msg.name)
+        w('\t{ .pgn = 0x%05Xu, .len = %d, .spns = %s_spns,\n'
+          '\t  .num_spns = ARRAY_SIZE(%s_spns) },\n' % (msg.pgn, msg.dlc, n, n))
+    w('};\n\n')
+
+    w('struct j1939_pgn_filter j1939_dbc_filters[] = {\n')
+    for msg in messages:
+        mask = 0x3FF00 if msg.p2p else PGN_MASK
+        w('\t{ .pgn = 0x%05Xu, .pgn_mask = 0x%05Xu, .priority = 0,\n'
+          '\t  .addr = 0, .addr_mask = 0 },\n' % (msg.pgn, mask))
+    w('};\n\n')
+
+    w('int j1939_dbc_register(pgn_callback_t cb)\n{\n\tint ret;\n\n')
+    w('\tfor (size_t i = 0; i < J1939_DBC_NUM_PGNS; i++) {\n')
+    w('\t\tret = pgn_register(j1939_dbc_spn_table[i].pgn, 0, cb);\n')
+    w('\t\tif (ret < 0) {\n\t\t\treturn ret;\n\t\t}\n\t}\n')
+    w('\treturn 0;\n}\n')
+
+
+def gen_cmake(messages, out):
+    out.write('# Generated by tools/dbc2c.py, do not edit\n')
+    out.write('set(J1939_DBC_NUM_PGNS %d)\n' % len(messages))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split('\n')[1])
+    ap.add_argument('--dbc', required=True)
+    ap.add_argument('--out-c')
+    ap.add_argument('--out-h')
+    ap.add_argument('--out-cmake')
+    args = ap.parse_args()
+
+    messages = parse_dbc(args.dbc)
+    if not messages:
+        sys.stderr.write('dbc2c: no J1939 messages in %s\n' % args.dbc)
+        return 1
+
+    if args.out_cmake:
+        with open(args.out_cmake, 'w') as f:
+            gen_cmake(messages, f)
+    if args.out_h:
+        with open(args.out_h, 'w') as f:
+            gen_header(messages, f)
+    if args.out_c:
+        header = args.out_h.replace('\\', '/').split('/')[-1] \
+            if args.out_h else 'j1939_dbc.h'
+        with open(args.out_c, 'w') as f:
+            gen_source(messages, header, f)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())